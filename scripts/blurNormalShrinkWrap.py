@@ -1,13 +1,19 @@
+import os
+import struct
+
 from maya import cmds
+from maya.api import OpenMaya as om
 
 
 def buildNormalShrinkWrap(deformed, controlMesh):
-    sourceStatic = cmds.duplicate(deformed, name=deformed + "Static")[0]
+    """Wrap one or more meshes to the control mesh with a single deformer
+    Every piece is bound against the same bvh of the control mesh
+    """
+    if isinstance(deformed, str):
+        deformed = [deformed]
+
     targetStatic = cmds.duplicate(controlMesh, name=controlMesh + "Static")[0]
 
-    sourceStaticShape = cmds.listRelatives(
-        sourceStatic, shapes=True, noIntermediate=True, fullPath=True
-    )[0]
     targetStaticShape = cmds.listRelatives(
         targetStatic, shapes=True, noIntermediate=True, fullPath=True
     )[0]
@@ -16,17 +22,99 @@ def buildNormalShrinkWrap(deformed, controlMesh):
     )[0]
 
     dfm = cmds.deformer(deformed, type="blurNormalShrinkWrap")[0]
-    cmds.connectAttr(
-        f"{sourceStatic}.worldInverseMatrix[0]", f"{dfm}.sourceStaticInvWorld"
-    )
     cmds.connectAttr(
         f"{targetStatic}.worldInverseMatrix[0]", f"{dfm}.targetStaticInvWorld"
     )
     cmds.connectAttr(f"{controlMesh}.worldInverseMatrix[0]", f"{dfm}.targetInvWorld")
 
-    cmds.connectAttr(f"{sourceStaticShape}.outMesh", f"{dfm}.sourceStatic")
     cmds.connectAttr(f"{targetStaticShape}.outMesh", f"{dfm}.targetStatic")
     cmds.connectAttr(f"{targetShape}.outMesh", f"{dfm}.target")
 
+    # Each deformed geometry gets its own static copy at its own multiIndex
+    geos = cmds.deformer(dfm, query=True, geometry=True) or []
+    indices = cmds.deformer(dfm, query=True, geometryIndices=True) or []
+    for geo, idx in zip(geos, indices):
+        piece = cmds.listRelatives(geo, parent=True, fullPath=True)[0]
+        name = piece.rsplit("|", 1)[-1]
+        sourceStatic = cmds.duplicate(piece, name=name + "Static")[0]
+        sourceStaticShape = cmds.listRelatives(
+            sourceStatic, shapes=True, noIntermediate=True, fullPath=True
+        )[0]
+        cmds.connectAttr(
+            f"{sourceStatic}.worldInverseMatrix[0]",
+            f"{dfm}.sourceStaticInvWorld[{idx}]",
+        )
+        cmds.connectAttr(f"{sourceStaticShape}.outMesh", f"{dfm}.sourceStatic[{idx}]")
+
+    return dfm
+
+
+def _writeCpm(shape, path):
+    """Write a mesh the way the node reads it: raw object space points, the
+    triangles from getTriangles, and the vertex normals as the node gets them
+    """
+    sel = om.MSelectionList()
+    sel.add(shape)
+    fnMesh = om.MFnMesh(sel.getDagPath(0))
+    points = fnMesh.getPoints(om.MSpace.kObject)
+    _counts, triVerts = fnMesh.getTriangles()
+    normals = fnMesh.getVertexNormals(False, om.MSpace.kObject)
+
+    with open(path, "wb") as f:
+        f.write(struct.pack("<8sIIQQ", b"CPOMMESH", 1, 1, len(points), len(triVerts) // 3))
+        f.write(struct.pack(f"<{3 * len(points)}f", *[c for p in points for c in (p.x, p.y, p.z)]))
+        f.write(struct.pack(f"<{len(triVerts)}i", *triVerts))
+        f.write(struct.pack(f"<{3 * len(normals)}f", *[c for n in normals for c in (n.x, n.y, n.z)]))
+
+
+def exportBindAsset(dfm, directory, manifest, cacheFile=None):
+    """Write the static meshes of a blurNormalShrinkWrap out for cpom_bind,
+    and add an asset for them to the manifest.  The settings and matrices
+    are written exactly, so the cache file it makes is one the node takes.
+    Set the deformer's cacheFile to the same path before its next bind
+    """
+    if not os.path.isdir(directory):
+        os.makedirs(directory)
+    if cacheFile is None:
+        cacheFile = os.path.join(directory, f"{dfm}.cpbind")
+
+    targetShape = cmds.listConnections(
+        f"{dfm}.targetStatic", source=True, destination=False, shapes=True
+    )[0]
+    targetPath = os.path.join(directory, f"{dfm}_target.cpm")
+    _writeCpm(targetShape, targetPath)
+    targetInv = om.MMatrix(cmds.getAttr(f"{dfm}.targetStaticInvWorld"))
+
+    lines = [f'asset "{cacheFile}"', f'target "{targetPath}"']
+    sel = om.MSelectionList()
+    sel.add(dfm)
+    fnNode = om.MFnDependencyNode(sel.getDependNode(0))
+    angle = fnNode.findPlug("angleTolerance", False).asMAngle().asRadians()
+    lines.append(f"set angleTolerance {angle!r}")
+    for attr in (
+        "floatTolerance", "neighborCount", "neighborRadius", "maxDistance",
+        "searchMode", "toleranceFallback", "precision", "buildStrategy",
+    ):
+        lines.append(f"set {attr} {cmds.getAttr(f'{dfm}.{attr}')!r}")
+
+    for idx in cmds.getAttr(f"{dfm}.sourceStatic", multiIndices=True) or []:
+        sourceShape = cmds.listConnections(
+            f"{dfm}.sourceStatic[{idx}]", source=True, destination=False, shapes=True
+        )
+        if not sourceShape:
+            continue
+        sourcePath = os.path.join(directory, f"{dfm}_source{idx}.cpm")
+        _writeCpm(sourceShape[0], sourcePath)
+        # Built the same way the node builds it, so it keys the same
+        sourceInv = om.MMatrix(cmds.getAttr(f"{dfm}.sourceStaticInvWorld[{idx}]"))
+        tranMat = sourceInv.inverse() * targetInv
+        values = " ".join(repr(tranMat.getElement(r, c)) for r in range(4) for c in range(4))
+        lines.append(f'source {idx} "{sourcePath}" {values}')
+
+    with open(manifest, "a") as f:
+        f.write("\n".join(lines) + "\n")
+    return cacheFile
+
 
-#buildNormalShrinkWrap(*cmds.ls(selection=True)[:2])
+# sel = cmds.ls(selection=True)
+# buildNormalShrinkWrap(sel[:-1], sel[-1])
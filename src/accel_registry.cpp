@@ -0,0 +1,93 @@
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "accel_registry.h"
+#include "bind_cache.h"
+
+
+AccelRegistry& AccelRegistry::instance() {
+    static AccelRegistry registry;
+    return registry;
+}
+
+template <typename T>
+std::shared_ptr<TargetAccel<T>> AccelRegistry::find(uint64_t key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& map = entries<T>();
+    auto it = map.find(key);
+    std::shared_ptr<TargetAccel<T>> ret;
+    if (it != map.end()) ret = it->second.lock();
+    if (ret) ++hits;
+    else ++misses;
+    return ret;
+}
+
+template <typename T>
+std::shared_ptr<TargetAccel<T>> AccelRegistry::insert(uint64_t key, std::shared_ptr<TargetAccel<T>> accel) {
+    std::lock_guard<std::mutex> lock(mutex);
+    purge();
+    auto& entry = entries<T>()[key];
+    if (auto existing = entry.lock()) {
+        if (existing != accel) ++hits;
+        return existing;
+    }
+    entry = accel;
+    return accel;
+}
+
+template <typename T>
+void AccelRegistry::remove(uint64_t key, const TargetAccel<T>* accel) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& map = entries<T>();
+    auto it = map.find(key);
+    if (it == map.end()) return;
+    auto existing = it->second.lock();
+    if (!existing || existing.get() == accel) map.erase(it);
+}
+
+// Drop the entries nothing holds any more.  Called with the lock held
+void AccelRegistry::purge() {
+    std::erase_if(entriesF, [](const auto& kv) { return kv.second.expired(); });
+    std::erase_if(entriesD, [](const auto& kv) { return kv.second.expired(); });
+}
+
+RegistryStats AccelRegistry::stats() {
+    std::lock_guard<std::mutex> lock(mutex);
+    purge();
+    RegistryStats ret;
+    auto add = [&ret](const auto& map) {
+        for (const auto& kv : map) {
+            auto accel = kv.second.lock();
+            if (!accel) continue;
+            // Not counting the reference just taken here
+            size_t users = (size_t)accel.use_count() - 1;
+            size_t bytes = accel->memory_bytes();
+            ret.entries += 1;
+            ret.users += users;
+            ret.bytes += bytes;
+            ret.savedBytes += (users > 1) ? (users - 1) * bytes : 0;
+        }
+    };
+    add(entriesF);
+    add(entriesD);
+    ret.hits = hits;
+    ret.misses = misses;
+    return ret;
+}
+
+void AccelRegistry::reset_counters() {
+    std::lock_guard<std::mutex> lock(mutex);
+    hits = 0;
+    misses = 0;
+}
+
+
+#define CPOM_INSTANTIATE_REGISTRY(T) \
+    template std::shared_ptr<TargetAccel<T>> AccelRegistry::find<T>(uint64_t); \
+    template std::shared_ptr<TargetAccel<T>> AccelRegistry::insert<T>(uint64_t, std::shared_ptr<TargetAccel<T>>); \
+    template void AccelRegistry::remove<T>(uint64_t, const TargetAccel<T>*);
+
+CPOM_INSTANTIATE_REGISTRY(float)
+CPOM_INSTANTIATE_REGISTRY(double)
@@ -0,0 +1,67 @@
+#ifndef ACCEL_REGISTRY_H
+#define ACCEL_REGISTRY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "bind_cache.h"
+
+struct RegistryStats {
+    size_t entries = 0;     // Structures that something still holds
+    size_t users = 0;       // Caches holding them, summed over the entries
+    size_t bytes = 0;       // Memory of the entries, counted once each
+    size_t savedBytes = 0;  // Memory that would be spent on copies without sharing
+    size_t hits = 0;        // Lookups that found a structure to share
+    size_t misses = 0;      // Lookups that had to build one
+
+    double hit_rate() const {
+        size_t lookups = hits + misses;
+        return lookups ? (double)hits / (double)lookups : 0.0;
+    }
+};
+
+// Every built target structure in the process, keyed by the target_key() of
+// its points, triangles, precision and leaf size.  The registry only keeps
+// weak references, so an entry goes away with the last cache that holds it.
+// All of it is safe to call from any thread
+class AccelRegistry {
+public:
+    static AccelRegistry& instance();
+
+    // The registered structure with this key, or null
+    template <typename T>
+    std::shared_ptr<TargetAccel<T>> find(uint64_t key);
+
+    // Register a structure under the key and get it back.  If a live one is
+    // already there, that one is returned instead and should be used
+    template <typename T>
+    std::shared_ptr<TargetAccel<T>> insert(uint64_t key, std::shared_ptr<TargetAccel<T>> accel);
+
+    // Drop the key, but only if it still refers to this structure
+    template <typename T>
+    void remove(uint64_t key, const TargetAccel<T>* accel);
+
+    RegistryStats stats();
+    void reset_counters();
+
+private:
+    AccelRegistry() {};
+
+    template <typename T>
+    std::unordered_map<uint64_t, std::weak_ptr<TargetAccel<T>>>& entries() {
+        if constexpr (std::is_same_v<T, float>) return entriesF;
+        else return entriesD;
+    }
+    void purge();
+
+    std::mutex mutex;
+    std::unordered_map<uint64_t, std::weak_ptr<TargetAccel<float>>> entriesF;
+    std::unordered_map<uint64_t, std::weak_ptr<TargetAccel<double>>> entriesD;
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include <vector>
+#include <algorithm>
+#include <numbers>
+
+#include "bind_batch.h"
+#include "cpom_normal.h"
+
+
+FallbackTolerances fallback_tolerances(short mode, double angleTol) {
+    FallbackTolerances ret;
+    if (mode == 1 || mode == 2) ret.angles[ret.count++] = 2.0 * angleTol;
+    if (mode == 2 || mode == 3) ret.angles[ret.count++] = std::numbers::pi;
+    return ret;
+}
+
+
+// Everything runs in the precision the structure was built in, and the points
+// come straight from the raw float buffers, so the float path never widens them
+// to double
+template <typename T>
+void append_queries(
+    const double matrix[4][4],
+    const float* points,
+    const float* normals,
+    const std::vector<unsigned int>& verts,
+    std::vector<Vec3T<T>>& qps,
+    std::vector<Vec3T<T>>& qns
+) {
+    T m[4][3];
+    for (int r = 0; r < 4; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            m[r][c] = static_cast<T>(matrix[r][c]);
+        }
+    }
+    qps.reserve(qps.size() + verts.size());
+    qns.reserve(qns.size() + verts.size());
+    for (unsigned int i : verts) {
+        T x = points[3 * i + 0];
+        T y = points[3 * i + 1];
+        T z = points[3 * i + 2];
+        qps.emplace_back(
+            x * m[0][0] + y * m[1][0] + z * m[2][0] + m[3][0],
+            x * m[0][1] + y * m[1][1] + z * m[2][1] + m[3][1],
+            x * m[0][2] + y * m[1][2] + z * m[2][2] + m[3][2]
+        );
+        const float* n = &normals[3 * i];
+        qns.emplace_back(n[0], n[1], n[2]);
+    }
+}
+
+
+template <typename T>
+void bind_queries(
+    bvh::v2::ThreadPool& threadPool,
+    const TargetAccel<T>& accel,
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& qns,
+    const BindSettings& settings,
+    QueryResult& result
+) {
+    if (settings.neighbors > 1) {
+        // The max distance caps the blend radius too
+        double radius = settings.radius;
+        if (settings.maxDistance > 0.0) {
+            radius = (radius > 0.0) ? std::min(radius, settings.maxDistance) : settings.maxDistance;
+        }
+        std::vector<double> weights;
+        result.stats = QueryStats();
+        get_closest_k_batch(threadPool,
+            accel.bvh,
+            accel.packed,
+            accel.cones,
+            qps,
+            qns,
+            settings.angleTol,
+            settings.neighbors,
+            radius,
+            result.triIdxs,
+            result.barys,
+            weights,
+            &result.stats
+        );
+        for (size_t k = 0; k < result.barys.size(); ++k) result.barys[k] = result.barys[k] * weights[k];
+
+        // The nearest entry is filled first, so it says if anything was found
+        result.widened.assign(qps.size(), 0);
+        result.tiers.resize(qps.size());
+        for (size_t i = 0; i < qps.size(); ++i) {
+            result.tiers[i] = (result.triIdxs[i * settings.neighbors] != InvalidIndex) ? 0 : -1;
+        }
+        return;
+    }
+
+    FallbackTolerances fallbacks = fallback_tolerances(settings.fallbackMode, settings.angleTol);
+    QueryOptions options;
+    options.maxDistance = settings.maxDistance;
+    options.refineTol = settings.floatTol;
+    options.progressive = settings.progressive;
+    options.fallbacks = &fallbacks;
+    get_closest_batch(threadPool,
+        accel.bvh,
+        accel.tris,
+        accel.packed,
+        accel.cones,
+        qps,
+        qns,
+        settings.angleTol,
+        result,
+        options
+    );
+}
+
+
+template void append_queries<float>(
+    const double matrix[4][4], const float*, const float*, const std::vector<unsigned int>&,
+    std::vector<Vec3T<float>>&, std::vector<Vec3T<float>>&
+);
+template void append_queries<double>(
+    const double matrix[4][4], const float*, const float*, const std::vector<unsigned int>&,
+    std::vector<Vec3T<double>>&, std::vector<Vec3T<double>>&
+);
+
+template void bind_queries<float>(
+    bvh::v2::ThreadPool&, const TargetAccel<float>&, const std::vector<Vec3T<float>>&, const std::vector<Vec3T<float>>&,
+    const BindSettings&, QueryResult&
+);
+template void bind_queries<double>(
+    bvh::v2::ThreadPool&, const TargetAccel<double>&, const std::vector<Vec3T<double>>&, const std::vector<Vec3T<double>>&,
+    const BindSettings&, QueryResult&
+);
@@ -0,0 +1,59 @@
+#ifndef BIND_BATCH_H
+#define BIND_BATCH_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <numbers>
+
+#include "bvh/v2/thread_pool.h"
+
+#include "cpom_types.h"
+#include "cpom_normal.h"
+#include "bind_cache.h"
+
+// The part of a bind that doesn't need Maya, so the node and the headless
+// binder land on exactly the same answer from the same inputs
+
+// Everything a bind depends on besides the meshes, as the node's attributes give them
+struct BindSettings {
+    double angleTol = std::numbers::pi / 3.0;  // Radians
+    double floatTol = 1.0e-6;
+    size_t neighbors = 1;
+    double radius = 0.0;       // Only used with more than one neighbor, and kept 0 otherwise
+    double maxDistance = 0.0;
+    bool progressive = false;
+    short fallbackMode = 0;    // toleranceFallback: off, double, doubleThenAny, any
+};
+
+// The looser tolerances a toleranceFallback setting tries, tightest first
+FallbackTolerances fallback_tolerances(short mode, double angleTol);
+
+// Move the given source vertices into target space and add them to the
+// queries.  The matrix is row major with the translation in the last row,
+// the way Maya stores one
+template <typename T>
+void append_queries(
+    const double matrix[4][4],
+    const float* points,
+    const float* normals,
+    const std::vector<unsigned int>& verts,
+    std::vector<Vec3T<T>>& qps,
+    std::vector<Vec3T<T>>& qns
+);
+
+// Bind every query against the accel.  With one neighbor there's one entry
+// per query in triIdxs and barys, and otherwise settings.neighbors entries in
+// a row with the blend weights already folded into the barys.  widened and
+// tiers get one entry per query either way
+template <typename T>
+void bind_queries(
+    bvh::v2::ThreadPool& threadPool,
+    const TargetAccel<T>& accel,
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& qns,
+    const BindSettings& settings,
+    QueryResult& result
+);
+
+#endif
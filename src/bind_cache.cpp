@@ -0,0 +1,174 @@
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "bvh/v2/thread_pool.h"
+
+#include "bind_cache.h"
+#include "cpom_types.h"
+#include "cpom_normal.h"
+#include "accel_registry.h"
+#include "mesh_ingest.h"
+
+
+std::shared_ptr<bvh::v2::ThreadPool> BindCache::get_pool(size_t threadCount) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!pool || threadCount != poolThreadCount) {
+        // The old pool finishes up and joins once the last user lets go of it
+        pool = std::make_shared<bvh::v2::ThreadPool>(threadCount);
+        poolThreadCount = threadCount;
+    }
+    return pool;
+}
+
+template <typename T>
+void BindCache::ingest_tris(TargetAccel<T>& accel, const float* points, bvh::v2::ThreadPool& threadPool) {
+    auto start = std::chrono::steady_clock::now();
+    assemble_tris(threadPool, points, accel.triVerts, accel.tris);
+    timings.ingestMs = elapsed_ms(start);
+}
+
+void BindCache::ingest(const float* points, size_t threadCount) {
+    if (precision == Precision::Float) {
+        auto threadPool = get_pool(threadCount);
+        ingest_tris(*accel_ptr<float>(), points, *threadPool);
+    }
+    else {
+        timings.ingestMs = 0.0;
+    }
+}
+
+template <typename T>
+void BindCache::make_private(std::shared_ptr<TargetAccel<T>>& accel, bool keepContents) {
+    if (key != 0) {
+        AccelRegistry::instance().remove<T>(key, accel.get());
+        key = 0;
+    }
+    // Out of the registry, nobody new can pick it up.  So if this is
+    // the only holder now, it stays that way
+    if (accel.use_count() > 1) {
+        accel = keepContents ? accel->clone() : std::make_shared<TargetAccel<T>>();
+    }
+}
+
+void BindCache::release() {
+    // Just letting go, so the registry entries stay for anyone else using them
+    accelF.reset();
+    accelD.reset();
+    key = 0;
+}
+
+void BindCache::publish(uint64_t newKey) {
+    if (newKey == 0 || !is_valid()) return;
+    key = newKey;
+    if (precision == Precision::Float) {
+        accelF = AccelRegistry::instance().insert<float>(key, accelF);
+    }
+    else {
+        accelD = AccelRegistry::instance().insert<double>(key, accelD);
+    }
+}
+
+bool BindCache::share(uint64_t newKey, Precision newPrecision) {
+    if (newKey == 0) return false;
+    auto& registry = AccelRegistry::instance();
+    bool found = false;
+    if (newPrecision == Precision::Float) {
+        if (auto accel = registry.find<float>(newKey)) {
+            release();
+            accelF = accel;
+            found = true;
+        }
+    }
+    else {
+        if (auto accel = registry.find<double>(newKey)) {
+            release();
+            accelD = accel;
+            found = true;
+        }
+    }
+    if (!found) return false;
+
+    precision = newPrecision;
+    key = newKey;
+    timings.ingestMs = 0.0;
+    timings.buildMs = 0.0;
+    timings.refit = false;
+    timings.loaded = false;
+    timings.shared = true;
+    return true;
+}
+
+template <typename T>
+void BindCache::update_accel(
+    std::shared_ptr<TargetAccel<T>>& accel,
+    const float* points,
+    const std::vector<int>& newTriVerts,
+    bool sameTopo,
+    bvh::v2::ThreadPool& threadPool
+) {
+    // Refitting changes the structure, so copy it first if another cache is using it
+    make_private(accel, sameTopo);
+    if (!sameTopo) accel->triVerts = newTriVerts;
+    ingest_tris(*accel, points, threadPool);
+
+    auto start = std::chrono::steady_clock::now();
+    if (sameTopo) {
+        refit_bvh(threadPool, accel->bvh, accel->tris, accel->packed, accel->cones);
+    }
+    else {
+        accel->strategy = resolve_build_strategy(buildStrategy, accel->tris.size());
+        accel->bvh = build_bvh(threadPool, accel->tris, accel->packed, accel->cones, leafSize, accel->strategy);
+        accel->leafSize = leafSize;
+    }
+    if constexpr (!TargetAccel<T>::keepsTris) accel->tris = std::vector<TriT<T>>();
+    timings.buildMs = elapsed_ms(start);
+    timings.refit = sameTopo;
+    timings.loaded = false;
+    timings.shared = false;
+}
+
+void BindCache::update(
+    const float* points,
+    const std::vector<int>& newTriVerts,
+    size_t threadCount,
+    Precision newPrecision,
+    uint64_t newKey
+) {
+    if (newKey != 0 && newKey == key && newPrecision == precision && is_valid()) {
+        // Exactly what's already here
+        timings.ingestMs = 0.0;
+        timings.buildMs = 0.0;
+        return;
+    }
+    if (share(newKey, newPrecision)) return;
+
+    auto threadPool = get_pool(threadCount);
+    if (precision != newPrecision) {
+        release();
+        precision = newPrecision;
+    }
+
+    // The old tree is still usable as long as the connectivity, leaf size and builder match
+    bool sameTopo = false;
+    if (is_valid()) {
+        bool isFloat = precision == Precision::Float;
+        size_t builtLeafSize = isFloat ? accelF->leafSize : accelD->leafSize;
+        BuildStrategy builtStrategy = isFloat ? accelF->strategy : accelD->strategy;
+        sameTopo = newTriVerts == tri_verts() && builtLeafSize == leafSize &&
+            builtStrategy == resolve_build_strategy(buildStrategy, newTriVerts.size() / 3);
+    }
+
+    if (precision == Precision::Float) {
+        update_accel(accel_ptr<float>(), points, newTriVerts, sameTopo, *threadPool);
+    }
+    else {
+        update_accel(accel_ptr<double>(), points, newTriVerts, sameTopo, *threadPool);
+    }
+    publish(newKey);
+}
+
+void BindCache::clear() {
+    release();
+    timings = BindTimings();
+}
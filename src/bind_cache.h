@@ -0,0 +1,193 @@
+#ifndef BIND_CACHE_H
+#define BIND_CACHE_H
+
+#include <vector>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <type_traits>
+
+#include "bvh/v2/thread_pool.h"
+
+#include "cpom_types.h"
+#include "leaf_kernel.h"
+
+// Milliseconds since the given time point
+inline double elapsed_ms(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct BindTimings {
+    double ingestMs = 0.0;  // Assembling the triangles from the raw points, on the pool
+    double buildMs = 0.0;   // The full build or the refit, whichever happened
+    double bindMs = 0.0;    // The last batch of closest point queries
+    bool refit = false;     // Whether the last update refit instead of rebuilding
+    bool loaded = false;    // Whether the bvh was read from a cache file instead
+    bool shared = false;    // Whether the bvh came from another node through the registry
+};
+
+// The bvh and the per-triangle data it was built from, at one precision
+template <typename T>
+struct TargetAccel {
+    // Only a float structure reads the original tris after the build, to
+    // re-run its ambiguous queries in double.  Everything else works off
+    // the packed copy, so a double structure lets them go
+    static constexpr bool keepsTris = std::is_same_v<T, float>;
+
+    WideBvhT<T> bvh;
+    std::vector<int> triVerts;  // 3 point indices per triangle
+    std::vector<TriT<T>> tris;
+    PackedTrisT<T> packed;  // The tris again, in bvh leaf order
+    size_t leafSize = 0;    // The max leaf size the bvh was built with
+    BuildStrategy strategy = BuildStrategy::Sah;  // The builder it came from, never Auto
+    std::vector<NormalConeT<T>> cones;  // One per child of each bvh node
+
+    bool is_valid() const { return !packed.empty(); }
+    void clear() {
+        bvh = WideBvhT<T>();
+        triVerts.clear();
+        tris.clear();
+        packed.clear();
+        cones.clear();
+        leafSize = 0;
+        strategy = BuildStrategy::Sah;
+    }
+
+    std::shared_ptr<TargetAccel> clone() const {
+        return std::make_shared<TargetAccel>(*this);
+    }
+
+    // Heap memory held by all the arrays
+    size_t memory_bytes() const {
+        return (
+            bvh.nodes.capacity() * sizeof(WideNode) +
+            bvh.prim_ids.capacity() * sizeof(uint32_t) +
+            triVerts.capacity() * sizeof(int) +
+            tris.capacity() * sizeof(TriT<T>) +
+            packed.data.capacity() * sizeof(T) +
+            cones.capacity() * sizeof(NormalConeT<T>)
+        );
+    }
+};
+
+// Holds the acceleration structure for the static target, along with
+// a thread pool that lives as long as the node does.
+// When the triangle connectivity hasn't changed between updates, the
+// bvh bounds are refit instead of building from scratch.
+// Only the structure for the current precision is kept around.
+//
+// Given a content key, the structure is shared through the AccelRegistry
+// with every other cache that has the same target.  A shared structure is
+// never changed.  A cache only refits in place when nobody else holds it
+class BindCache {
+public:
+    BindCache() {};
+
+    // Get the long-lived pool. It is only re-created if the thread count changes
+    // A threadCount of 0 means use every core.  Hold on to it for as long as
+    // it's in use, since a call with another thread count replaces it, and
+    // the old one only goes away once the last holder lets go
+    std::shared_ptr<bvh::v2::ThreadPool> get_pool(size_t threadCount);
+
+    // Bring the bvh up to date with the given points and triangle corners
+    // triVerts holds 3 point indices per triangle.  A key of 0 keeps the
+    // structure private, otherwise it must be the target_key() of the inputs
+    void update(
+        const float* points,
+        const std::vector<int>& newTriVerts,
+        size_t threadCount,
+        Precision newPrecision = Precision::Double,
+        uint64_t newKey = 0
+    );
+
+    // Assemble the current precision's triangles from the points and
+    // triVerts on the pool, if its queries need them
+    void ingest(const float* points, size_t threadCount = 0);
+
+    // Hand the current structure to the registry under the given key
+    // If another cache got there first, theirs is used instead
+    void publish(uint64_t newKey);
+
+    // Use the registered structure with this key, if there is one
+    bool share(uint64_t newKey, Precision newPrecision);
+
+    void clear();
+    bool is_valid() const {
+        return (precision == Precision::Float) ? (accelF && accelF->is_valid()) : (accelD && accelD->is_valid());
+    }
+
+    template <typename T>
+    const TargetAccel<T>& get_accel() {
+        return *accel_ptr<T>();
+    }
+
+    // A fresh, empty structure that only this cache holds, for filling in by hand
+    template <typename T>
+    TargetAccel<T>& reset_accel() {
+        release();
+        return *accel_ptr<T>();
+    }
+
+    // Heap memory of the current structure, which may be shared with other caches
+    size_t memory_bytes() {
+        if (!is_valid()) return 0;
+        return (precision == Precision::Float) ? accelF->memory_bytes() : accelD->memory_bytes();
+    }
+
+    const std::vector<int>& tri_verts() {
+        return (precision == Precision::Float) ? accel_ptr<float>()->triVerts : accel_ptr<double>()->triVerts;
+    }
+
+    Precision precision = Precision::Double;
+    uint64_t key = 0;  // What the current structure is registered under, or 0
+
+    // Largest leaf the builder makes.  Changing it forces a rebuild
+    size_t leafSize = kLeafLanes;
+    // Which builder to use.  Changing it forces a rebuild too, unless Auto
+    // resolves to the one the current bvh came from
+    BuildStrategy buildStrategy = BuildStrategy::Auto;
+
+    BindTimings timings;
+
+private:
+    template <typename T>
+    std::shared_ptr<TargetAccel<T>>& accel_ptr() {
+        if constexpr (std::is_same_v<T, float>) {
+            if (!accelF) accelF = std::make_shared<TargetAccel<float>>();
+            return accelF;
+        }
+        else {
+            if (!accelD) accelD = std::make_shared<TargetAccel<double>>();
+            return accelD;
+        }
+    }
+
+    // Take the current structure out of the registry, and stop using it
+    // if anyone else still is, so it can be changed safely
+    template <typename T>
+    void make_private(std::shared_ptr<TargetAccel<T>>& accel, bool keepContents);
+    // Stop using the current structures
+    void release();
+
+    template <typename T>
+    void ingest_tris(TargetAccel<T>& accel, const float* points, bvh::v2::ThreadPool& threadPool);
+
+    template <typename T>
+    void update_accel(
+        std::shared_ptr<TargetAccel<T>>& accel,
+        const float* points,
+        const std::vector<int>& newTriVerts,
+        bool sameTopo,
+        bvh::v2::ThreadPool& threadPool
+    );
+
+    std::shared_ptr<TargetAccel<float>> accelF;
+    std::shared_ptr<TargetAccel<double>> accelD;
+
+    std::mutex poolMutex;
+    std::shared_ptr<bvh::v2::ThreadPool> pool;
+    size_t poolThreadCount = 0;
+};
+
+#endif
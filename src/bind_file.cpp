@@ -0,0 +1,452 @@
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+#include <type_traits>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "bind_file.h"
+#include "bind_cache.h"
+#include "cpom_types.h"
+#include "cpom_normal.h"
+
+
+namespace {
+
+enum Section {
+    SecNodes,
+    SecPrimIds,
+    SecTriVerts,
+    SecPacked,
+    SecCones,
+    SecBaryIdxs,
+    SecBarys,
+    SecBindTiers,
+    SectionCount,
+};
+
+struct SectionSpan {
+    uint64_t offset;
+    uint64_t size;  // In bytes
+};
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t precision;
+    uint32_t scalarSize;
+    uint32_t nodeSize;
+    uint32_t indexSize;
+    uint32_t coneSize;
+    uint64_t byteOrder;    // Reads back wrong if the file came from the other endianness
+    uint64_t targetKey;
+    uint64_t bindKey;
+    uint64_t leafSize;
+    uint64_t buildStrategy;
+    uint64_t packedCount;  // Triangles in the packed planes, not counting the padding
+    SectionSpan sections[SectionCount];
+};
+
+constexpr char kMagic[8] = {'C', 'P', 'O', 'M', 'B', 'I', 'N', 'D'};
+constexpr uint64_t kByteOrder = 0x0102030405060708ULL;
+
+// Every array starts on a cache line, which is plenty for the simd loads
+constexpr uint64_t kAlign = 64;
+
+static_assert(std::is_trivially_copyable_v<FileHeader>);
+static_assert(std::is_trivially_copyable_v<WideNode>);
+static_assert(std::is_trivially_copyable_v<NormalConeT<float>> && std::is_trivially_copyable_v<NormalConeT<double>>);
+static_assert(std::is_trivially_copyable_v<Vec3>);
+
+inline uint64_t mix64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint64_t align_up(uint64_t x) {
+    return (x + kAlign - 1) & ~(kAlign - 1);
+}
+
+uint32_t node_size(Precision) {
+    return (uint32_t)sizeof(WideNode);
+}
+
+uint32_t cone_size(Precision precision) {
+    return (uint32_t)((precision == Precision::Float) ? sizeof(NormalConeT<float>) : sizeof(NormalConeT<double>));
+}
+
+// Copy one section into a vector, if it holds a whole number of items
+template <typename V>
+bool read_section(const unsigned char* base, const SectionSpan& span, V& out) {
+    using Item = typename V::value_type;
+    if (span.size % sizeof(Item) != 0) return false;
+    out.resize(span.size / sizeof(Item));
+    if (span.size > 0) std::memcpy(out.data(), base + span.offset, span.size);
+    return true;
+}
+
+// Every link in the tree has to land inside the arrays, and an inner child
+// has to come after its parent, so a damaged file can't send a traversal
+// out of bounds or around in circles
+bool valid_tree(const std::vector<WideNode>& nodes, const std::vector<uint32_t>& primIds, uint64_t packedCount) {
+    for (size_t i = 0; i < nodes.size(); ++i) {
+        const WideNode& node = nodes[i];
+        if (node.childCount == 0 || node.childCount > kWideArity) return false;
+        for (size_t c = 0; c < node.childCount; ++c) {
+            uint64_t child = node.child[c];
+            if (node.primCount[c] == 0) {
+                if (child <= i || child >= nodes.size()) return false;
+            }
+            else if (child + node.primCount[c] > packedCount) {
+                return false;
+            }
+        }
+    }
+    for (uint32_t id : primIds) {
+        if (id >= packedCount) return false;
+    }
+    return true;
+}
+
+// The stored corners have to be the ones the caller hashed into the target
+// key, which also keeps a colliding key from pairing the tree with another mesh
+bool same_tri_verts(const unsigned char* base, const SectionSpan& span, const std::vector<int>& triVerts) {
+    return span.size == triVerts.size() * sizeof(int) && std::memcmp(base + span.offset, triVerts.data(), span.size) == 0;
+}
+
+template <typename T>
+bool load_accel_typed(
+    const FileHeader& header,
+    const unsigned char* base,
+    BindCache& cache,
+    const float* points,
+    const std::vector<int>& triVerts,
+    size_t threadCount
+) {
+    TargetAccel<T>& accel = cache.reset_accel<T>();
+
+    using P = PackedTrisT<T>;
+    const auto& sec = header.sections;
+    uint64_t stride = header.packedCount + P::pad;
+    if (sec[SecPacked].size != stride * P::PlaneCount * sizeof(T)) return false;
+
+    if (triVerts.size() != 3 * header.packedCount || !same_tri_verts(base, sec[SecTriVerts], triVerts)) return false;
+
+    bool ok = (
+        read_section(base, sec[SecNodes], accel.bvh.nodes) &&
+        read_section(base, sec[SecPrimIds], accel.bvh.prim_ids) &&
+        read_section(base, sec[SecCones], accel.cones) &&
+        read_section(base, sec[SecPacked], accel.packed.data)
+    );
+    ok = ok && !accel.bvh.nodes.empty();
+    ok = ok && accel.bvh.prim_ids.size() == header.packedCount;
+    ok = ok && valid_tree(accel.bvh.nodes, accel.bvh.prim_ids, header.packedCount);
+    ok = ok && (accel.cones.empty() || accel.cones.size() == accel.bvh.nodes.size() * kWideArity);
+    ok = ok && (header.buildStrategy == (uint64_t)BuildStrategy::Sah || header.buildStrategy == (uint64_t)BuildStrategy::Lbvh);
+    if (!ok) {
+        accel.clear();
+        return false;
+    }
+    accel.triVerts = triVerts;
+    accel.packed.count = header.packedCount;
+    accel.packed.stride = stride;
+    accel.leafSize = header.leafSize;
+    accel.strategy = (BuildStrategy)header.buildStrategy;
+
+    cache.ingest(points, threadCount);
+    return true;
+}
+
+template <typename T>
+SectionSpan write_section(std::ofstream& f, const std::vector<T>& values) {
+    uint64_t at = (uint64_t)f.tellp();
+    uint64_t offset = align_up(at);
+    static const char zeros[kAlign] = {};
+    f.write(zeros, (std::streamsize)(offset - at));
+    uint64_t size = values.size() * sizeof(T);
+    if (size > 0) f.write(reinterpret_cast<const char*>(values.data()), (std::streamsize)size);
+    return {offset, size};
+}
+
+template <typename T>
+bool write_accel_typed(std::ofstream& f, FileHeader& header, const TargetAccel<T>& accel) {
+    header.packedCount = accel.packed.count;
+    header.leafSize = accel.leafSize;
+    header.buildStrategy = (uint64_t)accel.strategy;
+    header.sections[SecNodes] = write_section(f, accel.bvh.nodes);
+    header.sections[SecPrimIds] = write_section(f, accel.bvh.prim_ids);
+    header.sections[SecTriVerts] = write_section(f, accel.triVerts);
+    header.sections[SecPacked] = write_section(f, accel.packed.data);
+    header.sections[SecCones] = write_section(f, accel.cones);
+    return (bool)f;
+}
+
+const FileHeader& header_of(const MappedFile& map) {
+    return *reinterpret_cast<const FileHeader*>(map.data);
+}
+
+} // namespace
+
+
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    uint64_t h = mix64(seed ^ (size * 0x9e3779b97f4a7c15ULL));
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, p + i, 8);
+        h = (h ^ mix64(w)) * 0x9e3779b97f4a7c15ULL;
+    }
+    uint64_t tail = 0;
+    if (i < size) std::memcpy(&tail, p + i, size - i);
+    return mix64(h ^ mix64(tail ^ (size - i)));
+}
+
+
+bool MappedFile::open(const std::string& path) {
+    close();
+#ifdef _WIN32
+    HANDLE fh = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (fh == INVALID_HANDLE_VALUE) return false;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(fh, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(fh);
+        return false;
+    }
+    HANDLE mh = CreateFileMappingA(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mh == NULL) {
+        CloseHandle(fh);
+        return false;
+    }
+    void* view = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+    if (view == NULL) {
+        CloseHandle(mh);
+        CloseHandle(fh);
+        return false;
+    }
+    fileHandle = fh;
+    mapHandle = mh;
+    data = static_cast<const unsigned char*>(view);
+    size = (size_t)fileSize.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive on its own
+    ::close(fd);
+    if (view == MAP_FAILED) return false;
+    data = static_cast<const unsigned char*>(view);
+    size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+void MappedFile::close() {
+    if (data == nullptr) return;
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+    CloseHandle(mapHandle);
+    CloseHandle(fileHandle);
+    mapHandle = nullptr;
+    fileHandle = nullptr;
+#else
+    munmap(const_cast<unsigned char*>(data), size);
+#endif
+    data = nullptr;
+    size = 0;
+}
+
+
+bool BindFile::open(const std::string& path) {
+    if (!map.open(path)) return false;
+
+    bool ok = map.size >= sizeof(FileHeader);
+    if (ok) {
+        const FileHeader& header = header_of(map);
+        Precision precision = (Precision)header.precision;
+        ok = (
+            std::memcmp(header.magic, kMagic, sizeof(kMagic)) == 0 &&
+            header.version == kBindFileVersion &&
+            header.byteOrder == kByteOrder &&
+            (precision == Precision::Float || precision == Precision::Double) &&
+            header.scalarSize == ((precision == Precision::Float) ? sizeof(float) : sizeof(double)) &&
+            header.nodeSize == node_size(precision) &&
+            header.coneSize == cone_size(precision) &&
+            header.indexSize == sizeof(Index)
+        );
+        for (int i = 0; ok && i < SectionCount; ++i) {
+            const SectionSpan& span = header.sections[i];
+            ok = span.offset % kAlign == 0 && span.offset <= map.size && span.size <= map.size - span.offset;
+        }
+    }
+    if (!ok) map.close();
+    return ok;
+}
+
+uint64_t BindFile::target_key() const {
+    return is_open() ? header_of(map).targetKey : 0;
+}
+
+uint64_t BindFile::bind_key() const {
+    return is_open() ? header_of(map).bindKey : 0;
+}
+
+bool BindFile::load_accel(BindCache& cache, const float* points, const std::vector<int>& triVerts, size_t threadCount) const {
+    if (!is_open()) return false;
+    auto start = std::chrono::steady_clock::now();
+    const FileHeader& header = header_of(map);
+
+    Precision precision = (Precision)header.precision;
+    cache.clear();
+    cache.precision = precision;
+    cache.leafSize = header.leafSize;
+
+    bool ok;
+    if (precision == Precision::Float) {
+        ok = load_accel_typed<float>(header, map.data, cache, points, triVerts, threadCount);
+    }
+    else {
+        ok = load_accel_typed<double>(header, map.data, cache, points, triVerts, threadCount);
+    }
+    if (!ok) return false;
+
+    // The ingest time was already recorded, so this is just the copy out of the map
+    cache.timings.buildMs = elapsed_ms(start) - cache.timings.ingestMs;
+    cache.timings.refit = false;
+    cache.timings.loaded = true;
+    cache.timings.shared = false;
+    return true;
+}
+
+bool BindFile::load_binding(std::vector<Index>& baryIdxs, std::vector<Vec3>& barys, std::vector<int8_t>& tiers) const {
+    if (!is_open()) return false;
+    const FileHeader& header = header_of(map);
+    bool ok = (
+        read_section(map.data, header.sections[SecBaryIdxs], baryIdxs) &&
+        read_section(map.data, header.sections[SecBarys], barys) &&
+        read_section(map.data, header.sections[SecBindTiers], tiers)
+    );
+    return ok && baryIdxs.size() == barys.size();
+}
+
+
+uint64_t target_key(
+    const float* points,
+    size_t numPoints,
+    const std::vector<int>& triVerts,
+    Precision precision,
+    size_t leafSize,
+    BuildStrategy strategy
+) {
+    uint64_t key = hash_bytes(points, numPoints * 3 * sizeof(float), kBindFileVersion);
+    key = hash_vector(triVerts, key);
+    key = hash_value((uint32_t)precision, key);
+    key = hash_value((uint64_t)leafSize, key);
+    return hash_value((uint32_t)resolve_build_strategy(strategy, triVerts.size() / 3), key);
+}
+
+uint64_t bind_key(uint64_t targetKey, const BindSettings& settings) {
+    uint64_t key = hash_value(settings.angleTol, targetKey);
+    key = hash_value(settings.floatTol, key);
+    key = hash_value(settings.neighbors, key);
+    key = hash_value(settings.radius, key);
+    key = hash_value(settings.maxDistance, key);
+    return hash_value(settings.fallbackMode, key);
+}
+
+uint64_t bind_piece_key(
+    uint64_t key,
+    unsigned int multiIndex,
+    const float* points,
+    size_t numPoints,
+    const std::vector<float>& normals,
+    const double matrix[4][4]
+) {
+    key = hash_value(multiIndex, key);
+    key = hash_bytes(points, 3 * numPoints * sizeof(float), key);
+    key = hash_vector(normals, key);
+    return hash_bytes(matrix, 16 * sizeof(double), key);
+}
+
+bool write_bind_file(
+    const std::string& path,
+    BindCache& cache,
+    uint64_t targetKey,
+    uint64_t bindKey,
+    const std::vector<Index>& baryIdxs,
+    const std::vector<Vec3>& barys,
+    const std::vector<int8_t>& tiers
+) {
+    if (!cache.is_valid()) return false;
+
+    FileHeader header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kBindFileVersion;
+    header.precision = (uint32_t)cache.precision;
+    header.scalarSize = (cache.precision == Precision::Float) ? sizeof(float) : sizeof(double);
+    header.nodeSize = node_size(cache.precision);
+    header.coneSize = cone_size(cache.precision);
+    header.indexSize = sizeof(Index);
+    header.byteOrder = kByteOrder;
+    header.targetKey = targetKey;
+    header.bindKey = bindKey;
+
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream f(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!f) return false;
+        // Room for the header, which gets filled in once the offsets are known
+        f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        bool ok;
+        if (cache.precision == Precision::Float) {
+            ok = write_accel_typed(f, header, cache.get_accel<float>());
+        }
+        else {
+            ok = write_accel_typed(f, header, cache.get_accel<double>());
+        }
+        header.sections[SecBaryIdxs] = write_section(f, baryIdxs);
+        header.sections[SecBarys] = write_section(f, barys);
+        header.sections[SecBindTiers] = write_section(f, tiers);
+
+        f.seekp(0);
+        f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        f.close();
+        if (!ok || !f) {
+            std::error_code ec;
+            std::filesystem::remove(tmpPath, ec);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec) {
+        std::filesystem::remove(tmpPath, ec);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,125 @@
+#ifndef BIND_FILE_H
+#define BIND_FILE_H
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "cpom_types.h"
+#include "bind_cache.h"
+#include "bind_batch.h"
+
+// On-disk cache of a target's bvh and a source's binding, so opening a scene
+// doesn't have to rebuild anything.  The file is a fixed header followed by
+// raw arrays, each aligned so it can be read straight out of a memory map:
+//   wide nodes, prim_ids, triVerts, packed tris, cones, bary indices, barys,
+//   and the fallback tier of each bound vertex
+// The header keeps two keys.  The target key covers everything the bvh was
+// built from, and the bind key covers everything the binding depends on.
+// Bump the version whenever the layout or any of the stored types change
+
+static constexpr uint32_t kBindFileVersion = 4;
+
+// A quick, non-cryptographic 64 bit hash for building the keys
+uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0);
+
+template <typename T>
+uint64_t hash_value(const T& value, uint64_t seed) {
+    return hash_bytes(&value, sizeof(T), seed);
+}
+
+template <typename T>
+uint64_t hash_vector(const std::vector<T>& values, uint64_t seed) {
+    return hash_bytes(values.data(), values.size() * sizeof(T), seed);
+}
+
+// A read-only memory map of a whole file
+class MappedFile {
+public:
+    MappedFile() {};
+    ~MappedFile() { close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+    bool is_open() const { return data != nullptr; }
+
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+
+private:
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mapHandle = nullptr;
+#endif
+};
+
+// A mapped cache file.  Opening only checks the header.  The arrays are
+// read in place when they're loaded, and the map stays open until close()
+class BindFile {
+public:
+    // False if the file is missing, or was written by a different layout
+    bool open(const std::string& path);
+    void close() { map.close(); }
+    bool is_open() const { return map.is_open(); }
+
+    uint64_t target_key() const;
+    uint64_t bind_key() const;
+
+    // Hand the stored bvh to the cache instead of building one.  A float
+    // structure still assembles its tris from the points, which are what the
+    // target key covers, on the cache's pool of threadCount threads
+    // False if the stored triangle corners aren't exactly triVerts, or any
+    // node or prim id points outside the arrays
+    // The loaded structure is private to the cache until it's published
+    bool load_accel(BindCache& cache, const float* points, const std::vector<int>& triVerts, size_t threadCount = 0) const;
+
+    // Copy out the stored binding.  The tiers are empty if none were written
+    bool load_binding(std::vector<Index>& baryIdxs, std::vector<Vec3>& barys, std::vector<int8_t>& tiers) const;
+
+private:
+    MappedFile map;
+};
+
+// Everything the bvh depends on.  Auto is resolved first, so it keys the
+// same as the builder it picks
+uint64_t target_key(
+    const float* points,
+    size_t numPoints,
+    const std::vector<int>& triVerts,
+    Precision precision,
+    size_t leafSize,
+    BuildStrategy strategy
+);
+
+// The start of a bind key: the target key and the settings.  The search mode
+// is left out since both modes give the same answers
+uint64_t bind_key(uint64_t targetKey, const BindSettings& settings);
+
+// Fold one source into a bind key.  The sources go in by multiIndex order,
+// and each is the raw points, the vertex normals and the source to target matrix
+uint64_t bind_piece_key(
+    uint64_t key,
+    unsigned int multiIndex,
+    const float* points,
+    size_t numPoints,
+    const std::vector<float>& normals,
+    const double matrix[4][4]
+);
+
+// Write the cache's bvh along with a binding and its tiers, which may be empty.
+// The file is written next to the path and then moved over it, so a reader
+// never sees half of one
+bool write_bind_file(
+    const std::string& path,
+    BindCache& cache,
+    uint64_t targetKey,
+    uint64_t bindKey,
+    const std::vector<Index>& baryIdxs,
+    const std::vector<Vec3>& barys,
+    const std::vector<int8_t>& tiers
+);
+
+#endif
@@ -0,0 +1,15 @@
+#include "bindingData.h"
+
+MTypeId BindingData::id(0x00122715);
+const MString BindingData::typeName(BINDING_DATA_NAME);
+
+
+void BindingData::copy(const MPxData& other) {
+    const BindingData* src = dynamic_cast<const BindingData*>(&other);
+    if (src != nullptr) pieces = src->pieces;
+}
+
+std::shared_ptr<const DeformBinding> BindingData::find(unsigned int multiIndex) const {
+    auto it = pieces.find(multiIndex);
+    return (it == pieces.end()) ? nullptr : it->second;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <maya/MPxData.h>
+#include <maya/MTypeId.h>
+#include <maya/MString.h>
+#include <map>
+#include <memory>
+
+#include "deform_kernel.h"
+
+#define BINDING_DATA_NAME "blurNormalShrinkWrapBinding"
+
+
+// The finished binding of every deformed geometry, passed from compute to
+// deform through the data block.  Copies share the same bindings, which are
+// never changed once built, so overlapping evaluations can all read them
+class BindingData : public MPxData {
+public:
+    static void* creator() { return new BindingData(); }
+
+    void copy(const MPxData& other) override;
+    MTypeId typeId() const override { return id; }
+    MString name() const override { return typeName; }
+
+    // The binding at this multiIndex, or null
+    std::shared_ptr<const DeformBinding> find(unsigned int multiIndex) const;
+
+    static MTypeId id;
+    static const MString typeName;
+
+    // Keyed by the deformer's multiIndex
+    std::map<unsigned int, std::shared_ptr<const DeformBinding>> pieces;
+};
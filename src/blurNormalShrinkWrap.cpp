@@ -2,6 +2,9 @@
 #include <numbers>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <cmath>
 #include <maya/MItGeometry.h>
 #include <maya/MFloatVectorArray.h>
 #include <maya/MGlobal.h>
@@ -15,23 +18,59 @@
 #include <maya/MFloatMatrix.h>
 #include <maya/MBoundingBox.h>
 #include <maya/MPointArray.h>
+#include <maya/MVectorArray.h>
 #include <maya/MAngle.h>
 #include <maya/MFnPointArrayData.h>
 #include <maya/MFnIntArrayData.h>
+#include <maya/MFnVectorArrayData.h>
+#include <maya/MArrayDataHandle.h>
+#include <maya/MArrayDataBuilder.h>
+#include <maya/MFnPluginData.h>
+#include <maya/MProfiler.h>
+#include <maya/MProfilingScope.h>
 
 #include "blurNormalShrinkWrap.h"
+#include "bindingData.h"
 #include "cpom_types.h"
+#include "bind_batch.h"
 
 #define CHECKSTAT(stat, msg) if ( !stat ) {  MGlobal::displayError(msg); return stat; }
 
 MTypeId NormalShrinkWrapDeformer::id(0x00122714);
+int NormalShrinkWrapDeformer::profilerCategory = -1;
 
 MObject NormalShrinkWrapDeformer::aBvhComputed;
 
 MObject NormalShrinkWrapDeformer::aBaryIndices;
 MObject NormalShrinkWrapDeformer::aBaryValues;
+MObject NormalShrinkWrapDeformer::aBaryCorners;
+MObject NormalShrinkWrapDeformer::aBaryOffsets;
+MObject NormalShrinkWrapDeformer::aBinding;
 
 MObject NormalShrinkWrapDeformer::aAngleTolerance;
+MObject NormalShrinkWrapDeformer::aThreadCount;
+MObject NormalShrinkWrapDeformer::aPrecision;
+MObject NormalShrinkWrapDeformer::aBuildStrategy;
+MObject NormalShrinkWrapDeformer::aFloatTolerance;
+MObject NormalShrinkWrapDeformer::aRebindTolerance;
+MObject NormalShrinkWrapDeformer::aNeighborCount;
+MObject NormalShrinkWrapDeformer::aNeighborRadius;
+MObject NormalShrinkWrapDeformer::aKeepOffset;
+MObject NormalShrinkWrapDeformer::aMaxDistance;
+MObject NormalShrinkWrapDeformer::aSearchMode;
+MObject NormalShrinkWrapDeformer::aToleranceFallback;
+MObject NormalShrinkWrapDeformer::aCacheFile;
+
+MObject NormalShrinkWrapDeformer::aBuildTime;
+MObject NormalShrinkWrapDeformer::aBuildWasRefit;
+MObject NormalShrinkWrapDeformer::aBuildWasLoaded;
+MObject NormalShrinkWrapDeformer::aBvhMemory;
+MObject NormalShrinkWrapDeformer::aBindTime;
+MObject NormalShrinkWrapDeformer::aRebindCount;
+MObject NormalShrinkWrapDeformer::aWideSearch;
+MObject NormalShrinkWrapDeformer::aWideSearchCount;
+MObject NormalShrinkWrapDeformer::aBindTier;
+MObject NormalShrinkWrapDeformer::aFallbackCount;
 
 MObject NormalShrinkWrapDeformer::aTargetStaticMesh;
 MObject NormalShrinkWrapDeformer::aTargetStaticInvWorld;
@@ -45,6 +84,16 @@ MObject NormalShrinkWrapDeformer::aTargetInvWorld;
 
 void* NormalShrinkWrapDeformer::creator() { return new NormalShrinkWrapDeformer(); }
 
+NodeStats NormalShrinkWrapDeformer::getStats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return stats;
+}
+
+void NormalShrinkWrapDeformer::resetStats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    stats = NodeStats();
+}
+
 MStatus NormalShrinkWrapDeformer::initialize() {
     MStatus status;
     MFnNumericAttribute nAttr;
@@ -56,19 +105,52 @@ MStatus NormalShrinkWrapDeformer::initialize() {
     aBvhComputed = nAttr.create("bvhComputed", "bc", MFnNumericData::kBoolean, false);
     CHECKSTAT(status, "Error creating aBvhComputed");
     nAttr.setHidden(true);
+    // The bvh itself isn't saved, so a saved true would be a lie on load
+    nAttr.setStorable(false);
     status = addAttribute(aBvhComputed);
     CHECKSTAT(status, "Error adding aBvhComputed");
 
+    // The binding outputs have one element per deformed geometry
     aBaryIndices = tAttr.create("baryIndices", "bi", MFnData::kIntArray, MObject::kNullObj, &status);
     CHECKSTAT(status, "Error creating aBaryIndices");
     uAttr.setKeyable(false);
+    tAttr.setArray(true);
+    tAttr.setUsesArrayDataBuilder(true);
     status = addAttribute(aBaryIndices);
     CHECKSTAT(status, "Error adding aBaryIndices");
     aBaryValues = tAttr.create("baryValues", "bv", MFnData::kPointArray, MObject::kNullObj, &status);
     CHECKSTAT(status, "Error creating aBaryValues");
     uAttr.setKeyable(false);
+    tAttr.setArray(true);
+    tAttr.setUsesArrayDataBuilder(true);
     status = addAttribute(aBaryValues);
     CHECKSTAT(status, "Error adding aBaryValues");
+    // The 3 target point indices of each bound triangle, in the same order as
+    // the bary values.  Saving these lets deform run without the bvh on load
+    aBaryCorners = tAttr.create("baryCorners", "bco", MFnData::kIntArray, MObject::kNullObj, &status);
+    CHECKSTAT(status, "Error creating aBaryCorners");
+    tAttr.setArray(true);
+    tAttr.setUsesArrayDataBuilder(true);
+    status = addAttribute(aBaryCorners);
+    CHECKSTAT(status, "Error adding aBaryCorners");
+    // How far each vertex sat off its bound spot, in the frame of the
+    // triangle (see triangle_frame) and scaled like the bary values
+    aBaryOffsets = tAttr.create("baryOffsets", "bof", MFnData::kVectorArray, MObject::kNullObj, &status);
+    CHECKSTAT(status, "Error creating aBaryOffsets");
+    tAttr.setArray(true);
+    tAttr.setUsesArrayDataBuilder(true);
+    status = addAttribute(aBaryOffsets);
+    CHECKSTAT(status, "Error adding aBaryOffsets");
+
+    // What deform actually reads: the bary outputs flattened into an index
+    // per geometry.  It's rebuilt from them, so there's nothing to save
+    aBinding = tAttr.create("binding", "bnd", BindingData::id, MObject::kNullObj, &status);
+    CHECKSTAT(status, "Error creating aBinding");
+    tAttr.setHidden(true);
+    tAttr.setWritable(false);
+    tAttr.setStorable(false);
+    status = addAttribute(aBinding);
+    CHECKSTAT(status, "Error adding aBinding");
 
     aAngleTolerance = uAttr.create("angleTolerance", "at", MFnUnitAttribute::kAngle, std::numbers::pi / 3.0, &status);
     CHECKSTAT(status, "Error creating angleTolerance");
@@ -79,6 +161,203 @@ MStatus NormalShrinkWrapDeformer::initialize() {
     status = addAttribute(aAngleTolerance);
     CHECKSTAT(status, "Error adding angleTolerance");
 
+    // Zero means use every available core
+    aThreadCount = nAttr.create("threadCount", "tc", MFnNumericData::kInt, 0, &status);
+    CHECKSTAT(status, "Error creating threadCount");
+    nAttr.setMin(0);
+    nAttr.setKeyable(false);
+    nAttr.setChannelBox(true);
+    status = addAttribute(aThreadCount);
+    CHECKSTAT(status, "Error adding threadCount");
+
+    // Float halves the memory of the bvh and doubles the simd width.
+    // Any float result that's too close to call gets re-checked in double
+    aPrecision = eAttr.create("precision", "pr", (short)Precision::Double, &status);
+    CHECKSTAT(status, "Error creating precision");
+    eAttr.addField("double", (short)Precision::Double);
+    eAttr.addField("float", (short)Precision::Float);
+    eAttr.setKeyable(false);
+    eAttr.setChannelBox(true);
+    status = addAttribute(aPrecision);
+    CHECKSTAT(status, "Error adding precision");
+
+    // Sah builds the fastest tree to query, lbvh builds much faster for
+    // interactive edits to the target, and auto picks lbvh for big targets
+    aBuildStrategy = eAttr.create("buildStrategy", "bst", (short)BuildStrategy::Auto, &status);
+    CHECKSTAT(status, "Error creating buildStrategy");
+    eAttr.addField("auto", (short)BuildStrategy::Auto);
+    eAttr.addField("sah", (short)BuildStrategy::Sah);
+    eAttr.addField("lbvh", (short)BuildStrategy::Lbvh);
+    eAttr.setKeyable(false);
+    eAttr.setChannelBox(true);
+    status = addAttribute(aBuildStrategy);
+    CHECKSTAT(status, "Error adding buildStrategy");
+
+    // Relative distance under which two float candidates are considered a tie
+    aFloatTolerance = nAttr.create("floatTolerance", "ft", MFnNumericData::kDouble, 1.0e-6, &status);
+    CHECKSTAT(status, "Error creating floatTolerance");
+    nAttr.setMin(0.0);
+    nAttr.setSoftMax(1.0e-3);
+    nAttr.setKeyable(false);
+    status = addAttribute(aFloatTolerance);
+    CHECKSTAT(status, "Error adding floatTolerance");
+
+    // When the source changes, only vertices that moved or turned by more
+    // than this get bound again.  Everything else keeps its binding
+    aRebindTolerance = nAttr.create("rebindTolerance", "rbt", MFnNumericData::kDouble, 1.0e-6, &status);
+    CHECKSTAT(status, "Error creating rebindTolerance");
+    nAttr.setMin(0.0);
+    nAttr.setKeyable(false);
+    status = addAttribute(aRebindTolerance);
+    CHECKSTAT(status, "Error adding rebindTolerance");
+
+    // Blend each vertex over this many of the nearest triangles instead of
+    // sticking to the closest one, to smooth out the facets of a coarse target
+    aNeighborCount = nAttr.create("neighborCount", "nbc", MFnNumericData::kInt, 1, &status);
+    CHECKSTAT(status, "Error creating neighborCount");
+    nAttr.setMin(1);
+    nAttr.setMax((int)kMaxNeighbors - 1);
+    nAttr.setKeyable(false);
+    nAttr.setChannelBox(true);
+    status = addAttribute(aNeighborCount);
+    CHECKSTAT(status, "Error adding neighborCount");
+    // Only triangles this close get blended.  Zero means no limit
+    aNeighborRadius = nAttr.create("neighborRadius", "nbr", MFnNumericData::kDouble, 0.0, &status);
+    CHECKSTAT(status, "Error creating neighborRadius");
+    nAttr.setMin(0.0);
+    nAttr.setKeyable(false);
+    status = addAttribute(aNeighborRadius);
+    CHECKSTAT(status, "Error adding neighborRadius");
+
+    // Keep each vertex at its bound offset from the target, carried along
+    // with the triangle, instead of snapping it onto the surface
+    aKeepOffset = nAttr.create("keepOffset", "ko", MFnNumericData::kBoolean, false, &status);
+    CHECKSTAT(status, "Error creating keepOffset");
+    nAttr.setKeyable(true);
+    nAttr.setChannelBox(true);
+    status = addAttribute(aKeepOffset);
+    CHECKSTAT(status, "Error adding keepOffset");
+
+    // Vertices farther than this from any facing triangle stay unbound
+    // without searching the rest of the target.  Zero means no limit
+    aMaxDistance = nAttr.create("maxDistance", "md", MFnNumericData::kDouble, 0.0, &status);
+    CHECKSTAT(status, "Error creating maxDistance");
+    nAttr.setMin(0.0);
+    nAttr.setKeyable(false);
+    nAttr.setChannelBox(true);
+    status = addAttribute(aMaxDistance);
+    CHECKSTAT(status, "Error adding maxDistance");
+    // Progressive searches a small radius first and only widens on a miss.
+    // The full search already walks nearest first from a neighbor's answer,
+    // so this rarely pays: on dense meshes it measured even to 20% slower,
+    // in mesh order or not.  Only try it on a large target that most vertices
+    // sit right on, and compare bindTime.  With a maxDistance the capped full
+    // search is always used, since widening up to the cap was always slower.
+    // The binding comes out the same either way
+    aSearchMode = eAttr.create("searchMode", "sm", 0, &status);
+    CHECKSTAT(status, "Error creating searchMode");
+    eAttr.addField("full", 0);
+    eAttr.addField("progressive", 1);
+    eAttr.setKeyable(false);
+    eAttr.setChannelBox(true);
+    status = addAttribute(aSearchMode);
+    CHECKSTAT(status, "Error adding searchMode");
+    // Looser tolerances for the vertices that find nothing within the angle
+    // tolerance, tried in turn on just the ones still missing.  Each vertex
+    // takes the tightest one that found anything.  Only used with a single neighbor
+    aToleranceFallback = eAttr.create("toleranceFallback", "tfb", 0, &status);
+    CHECKSTAT(status, "Error creating toleranceFallback");
+    eAttr.addField("off", 0);
+    eAttr.addField("double", 1);
+    eAttr.addField("doubleThenAny", 2);
+    eAttr.addField("any", 3);
+    eAttr.setKeyable(false);
+    eAttr.setChannelBox(true);
+    status = addAttribute(aToleranceFallback);
+    CHECKSTAT(status, "Error adding toleranceFallback");
+
+    // Where to keep the bvh and binding between sessions.  On the first build
+    // a matching file is loaded instead, and every new bind writes it back out
+    aCacheFile = tAttr.create("cacheFile", "cf", MFnData::kString, MObject::kNullObj, &status);
+    CHECKSTAT(status, "Error creating cacheFile");
+    tAttr.setUsedAsFilename(true);
+    status = addAttribute(aCacheFile);
+    CHECKSTAT(status, "Error adding cacheFile");
+
+    // Read-only timings (in milliseconds) of the last bvh update and bind
+    aBuildTime = nAttr.create("buildTime", "bdt", MFnNumericData::kDouble, 0.0, &status);
+    CHECKSTAT(status, "Error creating buildTime");
+    nAttr.setWritable(false);
+    nAttr.setStorable(false);
+    status = addAttribute(aBuildTime);
+    CHECKSTAT(status, "Error adding buildTime");
+    aBuildWasRefit = nAttr.create("buildWasRefit", "bwr", MFnNumericData::kBoolean, false, &status);
+    CHECKSTAT(status, "Error creating buildWasRefit");
+    nAttr.setWritable(false);
+    nAttr.setStorable(false);
+    status = addAttribute(aBuildWasRefit);
+    CHECKSTAT(status, "Error adding buildWasRefit");
+    aBuildWasLoaded = nAttr.create("buildWasLoaded", "bwl", MFnNumericData::kBoolean, false, &status);
+    CHECKSTAT(status, "Error creating buildWasLoaded");
+    nAttr.setWritable(false);
+    nAttr.setStorable(false);
+    status = addAttribute(aBuildWasLoaded);
+    CHECKSTAT(status, "Error adding buildWasLoaded");
+    // Megabytes held by the target bvh, its triangles and cones.  A structure
+    // shared with other nodes through the registry shows up on each of them
+    aBvhMemory = nAttr.create("bvhMemory", "bvm", MFnNumericData::kDouble, 0.0, &status);
+    CHECKSTAT(status, "Error creating bvhMemory");
+    nAttr.setWritable(false);
+    nAttr.setStorable(false);
+    status = addAttribute(aBvhMemory);
+    CHECKSTAT(status, "Error adding bvhMemory");
+    aBindTime = nAttr.create("bindTime", "bnt", MFnNumericData::kDouble, 0.0, &status);
+    CHECKSTAT(status, "Error creating bindTime");
+    nAttr.setWritable(false);
+    nAttr.setStorable(false);
+    status = addAttribute(aBindTime);
+    CHECKSTAT(status, "Error adding bindTime");
+    // Read-only count of the vertices the last bind actually queried
+    aRebindCount = nAttr.create("rebindCount", "rbc", MFnNumericData::kInt, 0, &status);
+    CHECKSTAT(status, "Error creating rebindCount");
+    nAttr.setWritable(false);
+    nAttr.setStorable(false);
+    status = addAttribute(aRebindCount);
+    CHECKSTAT(status, "Error adding rebindCount");
+    // Per geometry, 1 for each vertex a progressive search had to take all
+    // the way to the full search, and the total of those over every geometry
+    aWideSearch = tAttr.create("wideSearch", "ws", MFnData::kIntArray, MObject::kNullObj, &status);
+    CHECKSTAT(status, "Error creating wideSearch");
+    tAttr.setArray(true);
+    tAttr.setUsesArrayDataBuilder(true);
+    tAttr.setWritable(false);
+    tAttr.setStorable(false);
+    status = addAttribute(aWideSearch);
+    CHECKSTAT(status, "Error adding wideSearch");
+    aWideSearchCount = nAttr.create("wideSearchCount", "wsc", MFnNumericData::kInt, 0, &status);
+    CHECKSTAT(status, "Error creating wideSearchCount");
+    nAttr.setWritable(false);
+    nAttr.setStorable(false);
+    status = addAttribute(aWideSearchCount);
+    CHECKSTAT(status, "Error adding wideSearchCount");
+    // Per geometry, the tolerance tier each vertex was bound at (0 for the
+    // angle tolerance, 1 and up for the fallbacks, -1 for unbound), and the
+    // number of fallbacks over every geometry
+    aBindTier = tAttr.create("bindTier", "btr", MFnData::kIntArray, MObject::kNullObj, &status);
+    CHECKSTAT(status, "Error creating bindTier");
+    tAttr.setArray(true);
+    tAttr.setUsesArrayDataBuilder(true);
+    tAttr.setWritable(false);
+    tAttr.setStorable(false);
+    status = addAttribute(aBindTier);
+    CHECKSTAT(status, "Error adding bindTier");
+    aFallbackCount = nAttr.create("fallbackCount", "fbc", MFnNumericData::kInt, 0, &status);
+    CHECKSTAT(status, "Error creating fallbackCount");
+    nAttr.setWritable(false);
+    nAttr.setStorable(false);
+    status = addAttribute(aFallbackCount);
+    CHECKSTAT(status, "Error adding fallbackCount");
+
     aTargetStaticMesh = tAttr.create("targetStatic", "ts", MFnData::kMesh, MObject::kNullObj, &status);
     CHECKSTAT(status, "Error creating targetStatic");
     status = addAttribute(aTargetStaticMesh);
@@ -88,12 +367,15 @@ MStatus NormalShrinkWrapDeformer::initialize() {
     status = addAttribute(aTargetStaticInvWorld);
     CHECKSTAT(status, "Error adding targetStaticInvWorld");
 
+    // One static source and matrix per deformed geometry, at the same multiIndex
     aSourceStaticMesh = tAttr.create("sourceStatic", "ss", MFnData::kMesh, MObject::kNullObj, &status);
     CHECKSTAT(status, "Error creating sourceStatic");
+    tAttr.setArray(true);
     status = addAttribute(aSourceStaticMesh);
     CHECKSTAT(status, "Error adding sourceStatic");
     aSourceStaticInvWorld = mAttr.create("sourceStaticInvWorld", "ssiw", MFnMatrixAttribute::kDouble, &status);
     CHECKSTAT(status, "Error creating sourceStaticInvWorld");
+    mAttr.setArray(true);
     status = addAttribute(aSourceStaticInvWorld);
     CHECKSTAT(status, "Error adding sourceStaticInvWorld");
 
@@ -110,6 +392,14 @@ MStatus NormalShrinkWrapDeformer::initialize() {
     std::vector<MObject*> masters, clients;
 
     masters.push_back(&aAngleTolerance);
+    masters.push_back(&aPrecision);
+    masters.push_back(&aBuildStrategy);
+    masters.push_back(&aFloatTolerance);
+    masters.push_back(&aNeighborCount);
+    masters.push_back(&aNeighborRadius);
+    masters.push_back(&aMaxDistance);
+    masters.push_back(&aSearchMode);
+    masters.push_back(&aToleranceFallback);
     masters.push_back(&aBvhComputed);
     masters.push_back(&aSourceStaticInvWorld);
     masters.push_back(&aSourceStaticMesh);
@@ -118,6 +408,9 @@ MStatus NormalShrinkWrapDeformer::initialize() {
 
     clients.push_back(&aBaryIndices);
     clients.push_back(&aBaryValues);
+    clients.push_back(&aBaryCorners);
+    clients.push_back(&aBaryOffsets);
+    clients.push_back(&aBinding);
     clients.push_back(&outputGeom);
 
     for (auto master: masters){
@@ -128,7 +421,36 @@ MStatus NormalShrinkWrapDeformer::initialize() {
 
     attributeAffects(aBaryIndices, outputGeom);
     attributeAffects(aBaryValues, outputGeom);
+    attributeAffects(aBaryCorners, outputGeom);
+    attributeAffects(aBaryIndices, aBinding);
+    attributeAffects(aBaryValues, aBinding);
+    attributeAffects(aBaryCorners, aBinding);
+    attributeAffects(aBaryOffsets, outputGeom);
+    attributeAffects(aBaryOffsets, aBinding);
+    attributeAffects(aKeepOffset, aBinding);
+    attributeAffects(aKeepOffset, outputGeom);
+    attributeAffects(aBinding, outputGeom);
     attributeAffects(aTargetStaticMesh, aBvhComputed);
+    attributeAffects(aTargetStaticMesh, aBuildTime);
+    attributeAffects(aTargetStaticMesh, aBuildWasRefit);
+    attributeAffects(aTargetStaticMesh, aBuildWasLoaded);
+    attributeAffects(aTargetStaticMesh, aBvhMemory);
+    attributeAffects(aPrecision, aBvhComputed);
+    attributeAffects(aPrecision, aBuildTime);
+    attributeAffects(aPrecision, aBuildWasRefit);
+    attributeAffects(aPrecision, aBvhMemory);
+    attributeAffects(aBuildStrategy, aBvhComputed);
+    attributeAffects(aBuildStrategy, aBuildTime);
+    attributeAffects(aBuildStrategy, aBuildWasRefit);
+    attributeAffects(aBuildStrategy, aBvhMemory);
+    for (auto master: masters){
+        attributeAffects(*master, aBindTime);
+        attributeAffects(*master, aRebindCount);
+        attributeAffects(*master, aWideSearch);
+        attributeAffects(*master, aWideSearchCount);
+        attributeAffects(*master, aBindTier);
+        attributeAffects(*master, aFallbackCount);
+    }
     attributeAffects(aTargetMesh, outputGeom);
     attributeAffects(aTargetInvWorld, outputGeom);
 
@@ -136,10 +458,162 @@ MStatus NormalShrinkWrapDeformer::initialize() {
 }
 
 
+// One deformed geometry's share of a bind
+struct BindJob {
+    const float* points;   // Raw xyz floats of the static source
+    const float* normals;  // Its vertex normals, also as xyz floats
+    MMatrix tranMatInv;    // Source space to target space
+    std::vector<unsigned int> verts;  // The vertices that need binding
+    PieceBinding* piece;
+    bool changedOnly;      // Only the changed vertices are being rebound
+};
+
+
+// Move the vertices of every job into target space and bind them all in one
+// batch, so the pieces share the thread pool instead of taking turns.
+// The results land at each vertex's own index in its piece, or its own run
+// of neighbors entries when blending
+template <typename T>
+static void bindSourcePoints(
+    BindCache& cache,
+    bvh::v2::ThreadPool& threadPool,
+    const std::vector<BindJob>& jobs,
+    const BindSettings& settings,
+    QueryStats* stats
+) {
+    std::vector<Vec3T<T>> qps, qns;
+    for (const auto& job : jobs) {
+        append_queries<T>(job.tranMatInv.matrix, job.points, job.normals, job.verts, qps, qns);
+    }
+
+    QueryResult result;
+    bind_queries(threadPool, cache.get_accel<T>(), qps, qns, settings, result);
+    if (stats != nullptr) stats->merge(result.stats);
+
+    size_t neighbors = settings.neighbors;
+    size_t k = 0;
+    for (const auto& job : jobs) {
+        for (unsigned int i : job.verts) {
+            for (size_t j = 0; j < neighbors; ++j) {
+                job.piece->baryIdxs[i * neighbors + j] = result.triIdxs[k * neighbors + j];
+                job.piece->barys[i * neighbors + j] = result.barys[k * neighbors + j];
+            }
+            job.piece->widened[i] = result.widened[k];
+            job.piece->tiers[i] = result.tiers[k];
+            ++k;
+        }
+    }
+}
+
+
+// Look up the target point indices of each bound triangle
+// Unbound points get -1 for all three
+static void cornersFromIndices(const MIntArray& baryIdxArr, const std::vector<int>& triVerts, MIntArray& baryCornerArr) {
+    unsigned int count = baryIdxArr.length();
+    baryCornerArr.setLength(3 * count);
+    for (unsigned int i = 0; i < count; ++i) {
+        int qIdx = baryIdxArr[i];
+        bool bound = qIdx >= 0 && 3 * (size_t)qIdx + 2 < triVerts.size();
+        for (unsigned int k = 0; k < 3; ++k) {
+            baryCornerArr[3 * i + k] = bound ? triVerts[3 * (size_t)qIdx + k] : -1;
+        }
+    }
+}
+
+
+// The offset of each bound source point from its spot on the static target,
+// in the frame of the triangle.  The spot comes from the bary values, which
+// may be scaled by the entry's share of a blend, so the offset gets the same scale
+static void offsetsFromBarys(
+    const MIntArray& baryCornerArr,
+    const MPointArray& baryValArr,
+    unsigned int neighbors,
+    const float* sourcePoints,
+    const MMatrix& tranMatInv,
+    const float* targetPoints,
+    int numTargetPoints,
+    MVectorArray& baryOffsetArr
+) {
+    unsigned int count = baryValArr.length();
+    baryOffsetArr.setLength(count);
+    for (unsigned int e = 0; e < count; ++e) {
+        baryOffsetArr[e] = MVector(0.0, 0.0, 0.0);
+        double c[3][3];
+        bool bound = 3 * e + 2 < baryCornerArr.length();
+        for (unsigned int j = 0; bound && j < 3; ++j) {
+            int v = baryCornerArr[3 * e + j];
+            bound = v >= 0 && v < numTargetPoints;
+            if (!bound) break;
+            for (unsigned int k = 0; k < 3; ++k) c[j][k] = targetPoints[3 * v + k];
+        }
+        const MPoint& bary = baryValArr[e];
+        double w = bary[0] + bary[1] + bary[2];
+        if (!bound || w == 0.0) continue;
+
+        const float* sp = &sourcePoints[3 * (e / neighbors)];
+        MPoint q = MPoint(sp[0], sp[1], sp[2]) * tranMatInv;
+        double d[3];
+        for (unsigned int k = 0; k < 3; ++k) {
+            d[k] = q[k] - (bary[0] * c[0][k] + bary[1] * c[1][k] + bary[2] * c[2][k]) / w;
+        }
+        double t[3], b[3], n[3];
+        triangle_frame(c[0], c[1], c[2], t, b, n);
+        baryOffsetArr[e] = MVector(
+            w * (d[0] * t[0] + d[1] * t[1] + d[2] * t[2]),
+            w * (d[0] * b[0] + d[1] * b[1] + d[2] * b[2]),
+            w * (d[0] * n[0] + d[1] * n[1] + d[2] * n[2])
+        );
+    }
+}
+
+
+// Flatten one geometry's bary outputs into what deform reads
+// Each vertex has neighbors entries in a row, and entry j fills slots 3j to
+// 3j + 2.  Missing entries leave their slots empty, and a vertex with no
+// entries at all is unbound
+// With offsets given (one per entry), they ride along with the triangles
+static std::shared_ptr<const DeformBinding> makeDeformBinding(
+    const MIntArray& baryCornerArr,
+    const MPointArray& baryValArr,
+    const MVectorArray* baryOffsetArr,
+    unsigned int neighbors
+) {
+    unsigned int count = std::min(baryCornerArr.length() / 3, baryValArr.length()) / neighbors;
+
+    auto binding = std::make_shared<DeformBinding>();
+    DeformIndex& deformIndex = binding->index;
+    deformIndex.resize(count, 3 * neighbors, baryOffsetArr != nullptr);
+    for (unsigned int i = 0; i < count; ++i) {
+        int slot = 0;
+        for (unsigned int j = 0; j < neighbors; ++j) {
+            unsigned int e = i * neighbors + j;
+            int a = baryCornerArr[3 * e + 0];
+            int b = baryCornerArr[3 * e + 1];
+            int c = baryCornerArr[3 * e + 2];
+            if (a < 0 || b < 0 || c < 0) continue;
+            const MPoint& bary = baryValArr[e];
+            if (baryOffsetArr != nullptr) {
+                const MVector& off = (*baryOffsetArr)[e];
+                deformIndex.set_offset(i, slot, (float)off[0], (float)off[1], (float)off[2]);
+            }
+            deformIndex.set_slot(i, slot++, a, (float)bary[0]);
+            deformIndex.set_slot(i, slot++, b, (float)bary[1]);
+            deformIndex.set_slot(i, slot++, c, (float)bary[2]);
+        }
+        if (slot == 0) deformIndex.set_unbound(i);
+    }
+    binding->maxVert = deformIndex.max_vert();
+    build_dependents(deformIndex, (size_t)(binding->maxVert + 1), binding->dependents);
+    return binding;
+}
+
+
 MStatus NormalShrinkWrapDeformer::compute(const MPlug& plug, MDataBlock& block) {
 
     MStatus stat;
-    if (plug == aBvhComputed) {
+    if (plug == aBvhComputed || plug == aBuildTime || plug == aBuildWasRefit || plug == aBuildWasLoaded || plug == aBvhMemory) {
+        std::lock_guard<std::recursive_mutex> lock(bindMutex);
+        MProfilingScope scope(profilerCategory, MProfiler::kColorE_L1, "Build bvh", "Ingest, build, refit or load the target bvh");
         MObject targetStatic = block.inputValue(aTargetStaticMesh, &stat).asMesh();
         if (targetStatic.isNull()) return MStatus::kInvalidParameter;
         MFnMesh fnTargetStatic(targetStatic);
@@ -147,115 +621,444 @@ MStatus NormalShrinkWrapDeformer::compute(const MPlug& plug, MDataBlock& block)
         if (fptr == NULL) {
             return MStatus::kInvalidParameter;
         }
+        int threadCount = block.inputValue(aThreadCount, &stat).asInt();
+        Precision precision = (Precision)block.inputValue(aPrecision, &stat).asShort();
+        bindCache.buildStrategy = (BuildStrategy)block.inputValue(aBuildStrategy, &stat).asShort();
+
+        for (auto& [idx, piece] : pieces) {
+            piece.barys.clear();
+            piece.baryIdxs.clear();
+        }
+
+        MIntArray triCounts, triVertArr;
+        fnTargetStatic.getTriangles(triCounts, triVertArr);
+        if (triVertArr.length() == 0) return MStatus::kInvalidParameter;
+        std::vector<int> triVerts(triVertArr.length());
+        triVertArr.get(triVerts.data());
+
+        MString cachePath = block.inputValue(aCacheFile, &stat).asString();
+        targetKey = target_key(fptr, (size_t)fnTargetStatic.numVertices(), triVerts, precision, bindCache.leafSize, bindCache.buildStrategy);
 
-        bboxes.clear();
-        centers.clear();
-        normals.clear();
-        tris.clear();
-        barys.clear();
-        baryIdxs.clear();
-        triVerts.clear();
-
-        MIntArray triCounts;
-        fnTargetStatic.getTriangles(triCounts, triVerts);
-        for (unsigned int i = 0; i < triVerts.length(); i += 3) {
-            int tv0 = triVerts[i + 0];
-            double v00 = fptr[(tv0 * 3) + 0];
-            double v01 = fptr[(tv0 * 3) + 1];
-            double v02 = fptr[(tv0 * 3) + 2];
-            Vec3 v0(v00, v01, v02);
-
-            int tv1 = triVerts[i + 1];
-            double v10 = fptr[(tv1 * 3) + 0];
-            double v11 = fptr[(tv1 * 3) + 1];
-            double v12 = fptr[(tv1 * 3) + 2];
-            Vec3 v1(v10, v11, v12);
-
-            int tv2 = triVerts[i + 2];
-            double v20 = fptr[(tv2 * 3) + 0];
-            double v21 = fptr[(tv2 * 3) + 1];
-            double v22 = fptr[(tv2 * 3) + 2];
-            Vec3 v2(v20, v21, v22);
-
-            // notice 0 2 1.  This reverses the direction of the normal
-            // Also the order of the barycenters
-            tris.emplace_back(v0, v2, v1);
+        // Only the first build looks at the file.  After that a refit is cheaper
+        // Another node already holding this target beats both of them
+        // The file stays mapped until the bind has had a chance to read it too
+        bool loaded = false;
+        bindFile.close();
+        if (cachePath.length() > 0 && !bindCache.is_valid() && !bindCache.share(targetKey, precision)) {
+            if (bindFile.open(cachePath.asChar()) && bindFile.target_key() == targetKey) {
+                loaded = bindFile.load_accel(bindCache, fptr, triVerts, (size_t)threadCount);
+            }
+            if (loaded) bindCache.publish(targetKey);
+            else bindFile.close();
+        }
+        if (!loaded) {
+            bindCache.update(fptr, triVerts, (size_t)threadCount, precision, targetKey);
+        }
+        {
+            std::lock_guard<std::mutex> statsLock(statsMutex);
+            stats.builds += 1;
+            stats.buildMs += bindCache.timings.ingestMs + bindCache.timings.buildMs;
         }
-        bvh = build_bvh(tris, bboxes, centers, normals);
 
         MDataHandle compH = block.outputValue(aBvhComputed, &stat);
         compH.setBool(true);
         block.setClean(aBvhComputed);
+
+        MDataHandle buildTimeH = block.outputValue(aBuildTime, &stat);
+        buildTimeH.setDouble(bindCache.timings.ingestMs + bindCache.timings.buildMs);
+        block.setClean(aBuildTime);
+        MDataHandle refitH = block.outputValue(aBuildWasRefit, &stat);
+        refitH.setBool(bindCache.timings.refit);
+        block.setClean(aBuildWasRefit);
+        MDataHandle loadedH = block.outputValue(aBuildWasLoaded, &stat);
+        loadedH.setBool(bindCache.timings.loaded);
+        block.setClean(aBuildWasLoaded);
+        MDataHandle memoryH = block.outputValue(aBvhMemory, &stat);
+        memoryH.setDouble((double)bindCache.memory_bytes() / (1024.0 * 1024.0));
+        block.setClean(aBvhMemory);
     }
-    else if (plug == aBaryIndices || plug == aBaryValues) {
+    else if (
+        plug == aBaryIndices || plug == aBaryValues || plug == aBaryCorners || plug == aBaryOffsets ||
+        plug == aBindTime || plug == aRebindCount || plug == aWideSearch || plug == aWideSearchCount ||
+        plug == aBindTier || plug == aFallbackCount
+    ) {
+        std::lock_guard<std::recursive_mutex> lock(bindMutex);
         // force evaluation of the BVH
         MDataHandle compH = block.inputValue(aBvhComputed, &stat);
         bool bvhComputed = compH.asBool();
         if (!bvhComputed) return stat;
 
-        MDataHandle sourceStaticH = block.inputValue(aSourceStaticMesh, &stat);
-        MObject sourceStatic = sourceStaticH.asMesh();
-        if (sourceStatic.isNull()) return MStatus::kInvalidParameter;
-        MFnMesh fnSourceStatic(sourceStatic);
-        const auto fptr = fnSourceStatic.getRawPoints(&stat);
-        if (fptr == NULL) {
-            return MStatus::kInvalidParameter;
-        }
-
         MMatrix tWInv = block.inputValue(aTargetStaticInvWorld, &stat).asMatrix();
-        MMatrix sWInv = block.inputValue(aSourceStaticInvWorld, &stat).asMatrix();
-        MMatrix sWMat = sWInv.inverse();
-        MMatrix tranMatInv = sWMat * tWInv;
-        MMatrix tranMat = tranMatInv.inverse();
 
         MAngle angleTolA = block.inputValue(aAngleTolerance, &stat).asAngle();
         double angleTol = angleTolA.asRadians();
 
 
-        int numVerts = fnSourceStatic.numVertices();
-        MIntArray baryIdxs;
-        MPointArray baryVals;
-        baryIdxs.setLength(numVerts);
-        baryVals.setLength(numVerts);
+        int threadCount = block.inputValue(aThreadCount, &stat).asInt();
 
-        MFloatVectorArray vnorms;
-        MPointArray qpts;
-        fnSourceStatic.getVertexNormals(false, vnorms);
-        fnSourceStatic.getPoints(qpts);
+        double floatTol = block.inputValue(aFloatTolerance, &stat).asDouble();
 
-        for (unsigned int i = 0; i < qpts.length(); ++i) {
+        double rebindTol = block.inputValue(aRebindTolerance, &stat).asDouble();
 
-            MPoint pt = qpts[i];
-            MPoint tpt = pt * tranMatInv; // target space point
-            MVector n = vnorms[i];
+        size_t neighbors = (size_t)std::max(1, block.inputValue(aNeighborCount, &stat).asInt());
+        double radius = (neighbors > 1) ? block.inputValue(aNeighborRadius, &stat).asDouble() : 0.0;
 
-            Vec3 tv(tpt.x, tpt.y, tpt.z);
-            Vec3 tn(n.x, n.y, n.z);
+        double maxDistance = block.inputValue(aMaxDistance, &stat).asDouble();
+        bool progressive = block.inputValue(aSearchMode, &stat).asShort() == 1;
+        short fallbackMode = block.inputValue(aToleranceFallback, &stat).asShort();
 
-            auto [cpom, baryIdx, bary] = get_closest(bvh,
-                tris,
-                bboxes,
-                centers,
-                normals,
-                tv,
-                tn,
-                angleTol
+        BindSettings settings;
+        settings.angleTol = angleTol;
+        settings.floatTol = floatTol;
+        settings.neighbors = neighbors;
+        settings.radius = radius;
+        settings.maxDistance = maxDistance;
+        settings.progressive = progressive;
+        settings.fallbackMode = fallbackMode;
+
+        MString cachePath = block.inputValue(aCacheFile, &stat).asString();
+
+        auto bindStart = std::chrono::steady_clock::now();
+
+        // Gather every connected static source.  The meshes are kept so
+        // their raw points stay valid until the bind is done
+        struct PieceInput {
+            unsigned int idx;
+            MObject mesh;
+            const float* fptr;
+            size_t count;
+            std::vector<float> norms;
+            MMatrix tranMatInv;
+        };
+        std::vector<PieceInput> inputs;
+
+        MArrayDataHandle sourceStaticArrH = block.inputArrayValue(aSourceStaticMesh, &stat);
+        MArrayDataHandle sourceInvArrH = block.inputArrayValue(aSourceStaticInvWorld, &stat);
+        unsigned int sourceCount = sourceStaticArrH.elementCount(&stat);
+        for (unsigned int e = 0; e < sourceCount; ++e, sourceStaticArrH.next()) {
+            PieceInput in;
+            in.idx = sourceStaticArrH.elementIndex(&stat);
+            in.mesh = sourceStaticArrH.inputValue(&stat).asMesh();
+            if (in.mesh.isNull()) continue;
+            MFnMesh fnSourceStatic(in.mesh);
+            in.fptr = fnSourceStatic.getRawPoints(&stat);
+            if (in.fptr == NULL) continue;
+            in.count = (size_t)fnSourceStatic.numVertices();
+
+            MMatrix sWInv;
+            if (sourceInvArrH.jumpToElement(in.idx)) {
+                sWInv = sourceInvArrH.inputValue(&stat).asMatrix();
+            }
+            in.tranMatInv = sWInv.inverse() * tWInv;
+
+            MFloatVectorArray vnorms;
+            fnSourceStatic.getVertexNormals(false, vnorms);
+            in.norms.resize(3 * in.count);
+            for (size_t i = 0; i < in.count; ++i) {
+                const MFloatVector& n = vnorms[(unsigned int)i];
+                in.norms[3 * i + 0] = n.x;
+                in.norms[3 * i + 1] = n.y;
+                in.norms[3 * i + 2] = n.z;
+            }
+            inputs.push_back(std::move(in));
+        }
+        std::sort(inputs.begin(), inputs.end(), [](const PieceInput& a, const PieceInput& b) { return a.idx < b.idx; });
+
+        // Forget the geometries that aren't connected any more
+        for (auto it = pieces.begin(); it != pieces.end();) {
+            bool found = std::any_of(inputs.begin(), inputs.end(), [&](const PieceInput& in) { return in.idx == it->first; });
+            it = found ? std::next(it) : pieces.erase(it);
+        }
+
+        // Everything the binding depends on, for matching it against the cache file
+        // The file holds the pieces back to back, in multiIndex order
+        uint64_t bindKey = 0;
+        size_t totalCount = 0;
+        if (cachePath.length() > 0) {
+            bindKey = bind_key(targetKey, settings);
+            for (const auto& in : inputs) {
+                bindKey = bind_piece_key(bindKey, in.idx, in.fptr, in.count, in.norms, in.tranMatInv.matrix);
+            }
+        }
+        for (const auto& in : inputs) totalCount += in.count;
+
+        // The old binding of a piece is only worth keeping if everything besides
+        // its source points is the same as last time.  A new bvh clears the barys
+        std::vector<bool> reuse(inputs.size());
+        bool anyFull = false;
+        for (size_t p = 0; p < inputs.size(); ++p) {
+            const PieceInput& in = inputs[p];
+            const PieceBinding& piece = pieces[in.idx];
+            reuse[p] = (
+                piece.barys.size() == in.count * neighbors && piece.baryIdxs.size() == in.count * neighbors &&
+                piece.bindPoints.size() == 3 * in.count && piece.bindNormals.size() == 3 * in.count &&
+                piece.bindMatrix == in.tranMatInv && piece.bindAngle == angleTol && piece.bindFloatTol == floatTol &&
+                piece.bindNeighbors == neighbors && piece.bindRadius == radius &&
+                piece.bindMaxDistance == maxDistance && piece.bindProgressive == progressive &&
+                piece.bindFallback == fallbackMode &&
+                piece.widened.size() == in.count && piece.tiers.size() == in.count
             );
+            anyFull = anyFull || !reuse[p];
+        }
+
+        // A cache file that was written from these exact inputs already has the answer
+        std::vector<Index> fileIdxs;
+        std::vector<Vec3> fileBarys;
+        std::vector<int8_t> fileTiers;
+        bool fromFile = (
+            anyFull && bindFile.is_open() && bindFile.bind_key() == bindKey &&
+            bindFile.load_binding(fileIdxs, fileBarys, fileTiers) && fileBarys.size() == totalCount * neighbors &&
+            fileTiers.size() == totalCount
+        );
+        // Everything has been copied out of the file by now
+        bindFile.close();
+
+        std::vector<BindJob> jobs;
+        size_t offset = 0;
+        size_t tierOffset = 0;
+        for (size_t p = 0; p < inputs.size(); ++p) {
+            const PieceInput& in = inputs[p];
+            PieceBinding& piece = pieces[in.idx];
+            BindJob job{in.fptr, in.norms.data(), in.tranMatInv, {}, &piece, reuse[p]};
+
+            if (reuse[p]) {
+                for (unsigned int i = 0; i < (unsigned int)in.count; ++i) {
+                    const float* op = &piece.bindPoints[3 * i];
+                    const float* on = &piece.bindNormals[3 * i];
+                    const float* np = &in.fptr[3 * i];
+                    const float* nn = &in.norms[3 * i];
+                    double diff = std::max({
+                        std::abs(np[0] - op[0]), std::abs(np[1] - op[1]), std::abs(np[2] - op[2]),
+                        std::abs(nn[0] - on[0]), std::abs(nn[1] - on[1]), std::abs(nn[2] - on[2])
+                    });
+                    // Written so a nan always counts as changed
+                    if (!(diff <= rebindTol)) job.verts.push_back(i);
+                }
+            }
+            else {
+                size_t entries = in.count * neighbors;
+                piece.widened.assign(in.count, 0);
+                if (fromFile) {
+                    piece.baryIdxs.assign(fileIdxs.begin() + offset, fileIdxs.begin() + offset + entries);
+                    piece.barys.assign(fileBarys.begin() + offset, fileBarys.begin() + offset + entries);
+                    piece.tiers.assign(fileTiers.begin() + tierOffset, fileTiers.begin() + tierOffset + in.count);
+                }
+                else {
+                    piece.tiers.assign(in.count, int8_t(-1));
+                    piece.barys.assign(entries, Vec3(0.0));
+                    piece.baryIdxs.assign(entries, InvalidIndex);
+                    job.verts.resize(in.count);
+                    std::iota(job.verts.begin(), job.verts.end(), 0u);
+                }
+                piece.bindPoints.assign(in.fptr, in.fptr + 3 * in.count);
+                piece.bindNormals = in.norms;
+            }
+            offset += in.count * neighbors;
+            tierOffset += in.count;
+            piece.bindMatrix = in.tranMatInv;
+            piece.bindAngle = angleTol;
+            piece.bindFloatTol = floatTol;
+            piece.bindNeighbors = neighbors;
+            piece.bindRadius = radius;
+            piece.bindMaxDistance = maxDistance;
+            piece.bindProgressive = progressive;
+            piece.bindFallback = fallbackMode;
+            if (!job.verts.empty()) jobs.push_back(std::move(job));
+        }
+
+        size_t rebindCount = 0;
+        for (const auto& job : jobs) rebindCount += job.verts.size();
+
+        QueryStats queryStats;
+        if (!jobs.empty()) {
+            MProfilingScope bindScope(profilerCategory, MProfiler::kColorE_L2, "Bind", "Find the closest triangles");
+            // Held until the bind is done, even if the thread count changes meanwhile
+            auto pool = bindCache.get_pool((size_t)threadCount);
+            auto& threadPool = *pool;
+            if (bindCache.precision == Precision::Float) {
+                bindSourcePoints<float>(bindCache, threadPool, jobs, settings, &queryStats);
+            }
+            else {
+                bindSourcePoints<double>(bindCache, threadPool, jobs, settings, &queryStats);
+            }
+
+            for (const auto& job : jobs) {
+                if (!job.changedOnly) continue;
+                // Remember what the changed vertices were bound from
+                for (unsigned int i : job.verts) {
+                    std::copy(&job.points[3 * i], &job.points[3 * i + 3], &job.piece->bindPoints[3 * i]);
+                    std::copy(&job.normals[3 * i], &job.normals[3 * i + 3], &job.piece->bindNormals[3 * i]);
+                }
+            }
+
+            if (cachePath.length() > 0) {
+                fileIdxs.clear();
+                fileBarys.clear();
+                fileTiers.clear();
+                for (const auto& in : inputs) {
+                    const PieceBinding& piece = pieces[in.idx];
+                    fileIdxs.insert(fileIdxs.end(), piece.baryIdxs.begin(), piece.baryIdxs.end());
+                    fileBarys.insert(fileBarys.end(), piece.barys.begin(), piece.barys.end());
+                    fileTiers.insert(fileTiers.end(), piece.tiers.begin(), piece.tiers.end());
+                }
+                if (!write_bind_file(cachePath.asChar(), bindCache, targetKey, bindKey, fileIdxs, fileBarys, fileTiers)) {
+                    MGlobal::displayWarning(MString("Could not write the cache file ") + cachePath);
+                }
+            }
+        }
+        bindCache.timings.bindMs = elapsed_ms(bindStart);
+        {
+            std::lock_guard<std::mutex> statsLock(statsMutex);
+            stats.query.merge(queryStats);
+            stats.binds += 1;
+            stats.bindMs += bindCache.timings.bindMs;
+        }
+
+        MArrayDataBuilder bvBuilder(&block, aBaryValues, (unsigned int)inputs.size(), &stat);
+        MArrayDataBuilder biBuilder(&block, aBaryIndices, (unsigned int)inputs.size(), &stat);
+        MArrayDataBuilder bcBuilder(&block, aBaryCorners, (unsigned int)inputs.size(), &stat);
+        MArrayDataBuilder boBuilder(&block, aBaryOffsets, (unsigned int)inputs.size(), &stat);
+        MObject targetStatic = block.inputValue(aTargetStaticMesh, &stat).asMesh();
+        MFnMesh fnTargetStatic(targetStatic);
+        const float* targetPoints = fnTargetStatic.getRawPoints(&stat);
+        int numTargetPoints = (targetPoints == NULL) ? 0 : fnTargetStatic.numVertices();
+        MArrayDataBuilder wsBuilder(&block, aWideSearch, (unsigned int)inputs.size(), &stat);
+        int wideSearchCount = 0;
+        MArrayDataBuilder btBuilder(&block, aBindTier, (unsigned int)inputs.size(), &stat);
+        int fallbackCount = 0;
+        for (const auto& in : inputs) {
+            PieceBinding& piece = pieces[in.idx];
+            MIntArray wideArr((unsigned int)piece.widened.size(), 0);
+            for (unsigned int i = 0; i < wideArr.length(); ++i) {
+                wideArr[i] = piece.widened[i];
+                wideSearchCount += piece.widened[i];
+            }
+            wsBuilder.addElement(in.idx, &stat).set(MFnIntArrayData().create(wideArr));
+            MIntArray tierArr((unsigned int)piece.tiers.size(), -1);
+            for (unsigned int i = 0; i < tierArr.length(); ++i) {
+                tierArr[i] = piece.tiers[i];
+                fallbackCount += (piece.tiers[i] > 0) ? 1 : 0;
+            }
+            btBuilder.addElement(in.idx, &stat).set(MFnIntArrayData().create(tierArr));
+
+            unsigned int numEntries = (unsigned int)piece.barys.size();
+            MIntArray baryIdxArr;
+            MPointArray baryValArr;
+            baryIdxArr.setLength(numEntries);
+            baryValArr.setLength(numEntries);
+            for (unsigned int i = 0; i < numEntries; ++i) {
+                // Notice the 0 2 1.  This fixes the flipped normal thing
+                // from the triangles
+                const Vec3& bary = piece.barys[i];
+                baryValArr[i] = MPoint(bary[0], bary[2], bary[1]);
+                baryIdxArr[i] = (int)piece.baryIdxs[i];
+            }
+
+            MIntArray baryCornerArr;
+            cornersFromIndices(baryIdxArr, bindCache.tri_verts(), baryCornerArr);
 
-            // Notice the 0 2 1.  This fixes the flipped normal thing
-            // from the triangles
-            baryVals[i] = MPoint(bary[0], bary[2], bary[1]);
-            baryIdxs[i] = baryIdx;
+            bvBuilder.addElement(in.idx, &stat).set(MFnPointArrayData().create(baryValArr));
+            biBuilder.addElement(in.idx, &stat).set(MFnIntArrayData().create(baryIdxArr));
+            bcBuilder.addElement(in.idx, &stat).set(MFnIntArrayData().create(baryCornerArr));
+
+            MVectorArray baryOffsetArr;
+            offsetsFromBarys(
+                baryCornerArr, baryValArr, (unsigned int)neighbors, in.fptr, in.tranMatInv,
+                targetPoints, numTargetPoints, baryOffsetArr
+            );
+            boBuilder.addElement(in.idx, &stat).set(MFnVectorArrayData().create(baryOffsetArr));
         }
 
-        MDataHandle bvDataH = block.outputValue(aBaryValues, &stat);
-        MDataHandle biDataH = block.outputValue(aBaryIndices, &stat);
+        MArrayDataHandle bvArrH = block.outputArrayValue(aBaryValues, &stat);
+        MArrayDataHandle biArrH = block.outputArrayValue(aBaryIndices, &stat);
+        MArrayDataHandle bcArrH = block.outputArrayValue(aBaryCorners, &stat);
+        bvArrH.set(bvBuilder);
+        biArrH.set(biBuilder);
+        bcArrH.set(bcBuilder);
+        bvArrH.setAllClean();
+        biArrH.setAllClean();
+        bcArrH.setAllClean();
+        MArrayDataHandle boArrH = block.outputArrayValue(aBaryOffsets, &stat);
+        boArrH.set(boBuilder);
+        boArrH.setAllClean();
+        MArrayDataHandle wsArrH = block.outputArrayValue(aWideSearch, &stat);
+        wsArrH.set(wsBuilder);
+        wsArrH.setAllClean();
+        MArrayDataHandle btArrH = block.outputArrayValue(aBindTier, &stat);
+        btArrH.set(btBuilder);
+        btArrH.setAllClean();
+
+        MDataHandle bindTimeH = block.outputValue(aBindTime, &stat);
+        bindTimeH.setDouble(bindCache.timings.bindMs);
+        block.setClean(aBindTime);
+        MDataHandle rebindCountH = block.outputValue(aRebindCount, &stat);
+        rebindCountH.setInt((int)rebindCount);
+        block.setClean(aRebindCount);
+        MDataHandle wideSearchCountH = block.outputValue(aWideSearchCount, &stat);
+        wideSearchCountH.setInt(wideSearchCount);
+        block.setClean(aWideSearchCount);
+        MDataHandle fallbackCountH = block.outputValue(aFallbackCount, &stat);
+        fallbackCountH.setInt(fallbackCount);
+        block.setClean(aFallbackCount);
+    }
+    else if (plug == aBinding) {
+        std::lock_guard<std::recursive_mutex> lock(bindMutex);
+
+        // The bary data usually comes from a bind, but it can also come
+        // straight from the file.  The saved corners are all this needs, so
+        // there's no bvh build or triangulation on load
+        MArrayDataHandle bvArrH = block.inputArrayValue(aBaryValues, &stat);
+        MArrayDataHandle bcArrH = block.inputArrayValue(aBaryCorners, &stat);
+        bool keepOffset = block.inputValue(aKeepOffset, &stat).asBool();
+
+        MFnPluginData fnData;
+        MObject dataObj = fnData.create(BindingData::id, &stat);
+        CHECKSTAT(stat, "Error creating the binding data");
+        BindingData* bindingData = dynamic_cast<BindingData*>(fnData.data(&stat));
+        if (bindingData == nullptr) return MStatus::kFailure;
+
+        unsigned int neighbors = (unsigned int)std::max(1, block.inputValue(aNeighborCount, &stat).asInt());
 
-        bvDataH.set(MFnPointArrayData().create(baryVals));
-        biDataH.set(MFnIntArrayData().create(baryIdxs));
+        unsigned int pieceCount = bvArrH.elementCount(&stat);
+        for (unsigned int e = 0; e < pieceCount; ++e, bvArrH.next()) {
+            unsigned int idx = bvArrH.elementIndex(&stat);
+            MFnPointArrayData bvDataA(bvArrH.inputValue(&stat).data());
+            MPointArray baryValArr = bvDataA.array();
+            MIntArray baryCornerArr;
+            if (bcArrH.jumpToElement(idx)) {
+                MFnIntArrayData bcDataA(bcArrH.inputValue(&stat).data());
+                baryCornerArr = bcDataA.array();
+            }
+            if (baryCornerArr.length() != 3 * baryValArr.length()) {
+                // Scenes saved before the corners were stored still need the triangles
+                block.inputValue(aBvhComputed, &stat);
+                MArrayDataHandle biArrH = block.inputArrayValue(aBaryIndices, &stat);
+                if (biArrH.jumpToElement(idx)) {
+                    MFnIntArrayData biDataA(biArrH.inputValue(&stat).data());
+                    cornersFromIndices(biDataA.array(), bindCache.tri_verts(), baryCornerArr);
+                }
+            }
+            // Left over from a bind with a different neighbor count
+            if (baryValArr.length() % neighbors != 0) continue;
 
-        block.setClean(aBaryValues);
-        block.setClean(aBaryIndices);
+            MVectorArray baryOffsetArr;
+            bool useOffsets = false;
+            if (keepOffset) {
+                MArrayDataHandle boArrH = block.inputArrayValue(aBaryOffsets, &stat);
+                if (boArrH.jumpToElement(idx)) {
+                    MFnVectorArrayData boDataA(boArrH.inputValue(&stat).data());
+                    baryOffsetArr = boDataA.array();
+                    useOffsets = baryOffsetArr.length() == baryValArr.length();
+                }
+            }
+            bindingData->pieces[idx] = makeDeformBinding(
+                baryCornerArr, baryValArr, useOffsets ? &baryOffsetArr : nullptr, neighbors
+            );
+        }
+
+        MDataHandle bindingH = block.outputValue(aBinding, &stat);
+        bindingH.set(dataObj);
+        block.setClean(aBinding);
     }
     else if (plug == outputGeom) {
         return MPxDeformerNode::compute(plug, block);
@@ -265,6 +1068,29 @@ MStatus NormalShrinkWrapDeformer::compute(const MPlug& plug, MDataBlock& block)
 }
 
 
+
+// Read the painted weights for one geometry into a dense buffer
+// Any index that was never painted has the default weight of 1
+static void getDenseWeights(MDataBlock& block, unsigned int multiIndex, std::vector<float>& weights) {
+    std::fill(weights.begin(), weights.end(), 1.0f);
+
+    MStatus stat;
+    MArrayDataHandle weightListH = block.inputArrayValue(MPxDeformerNode::weightList, &stat);
+    if (!stat) return;
+    stat = weightListH.jumpToElement(multiIndex);
+    if (!stat) return;
+
+    MArrayDataHandle weightsH(weightListH.inputValue(&stat).child(MPxDeformerNode::weights));
+    unsigned int count = weightsH.elementCount(&stat);
+    for (unsigned int i = 0; i < count; ++i, weightsH.next()) {
+        unsigned int idx = weightsH.elementIndex(&stat);
+        if (idx < weights.size()) {
+            weights[idx] = weightsH.inputValue(&stat).asFloat();
+        }
+    }
+}
+
+
 MStatus NormalShrinkWrapDeformer::deform(
         MDataBlock& block, MItGeometry& iter,
         const MMatrix& dMat, unsigned int multiIndex
@@ -283,38 +1109,93 @@ MStatus NormalShrinkWrapDeformer::deform(
 
     MMatrix dMatInv = dMat.inverse();
 
-    // Force the barys to compute if they haven't
-    MDataHandle bvDataH = block.inputValue(aBaryValues, &stat);
-    MFnPointArrayData bvDataA(bvDataH.data());
-    MPointArray baryValues = bvDataA.array();
+    // Everything deform needs from the bind comes through the data block as
+    // one shared, read-only snapshot.  Holding it keeps it alive even if a
+    // rebind replaces it while this evaluation is still running
+    MDataHandle bindingH = block.inputValue(aBinding, &stat);
+    const BindingData* bindingData = dynamic_cast<const BindingData*>(bindingH.asPluginData());
+    if (bindingData == nullptr) return stat;
+    std::shared_ptr<const DeformBinding> binding = bindingData->find(multiIndex);
+    if (!binding) return stat;
+    const DeformIndex& deformIndex = binding->index;
+    if (deformIndex.size() == 0) return stat;
 
-    MDataHandle biDataH = block.inputValue(aBaryIndices, &stat);
-    MFnIntArrayData biDataA(biDataH.data());
-    MIntArray baryIdxs = biDataA.array();
+    const float* tpts = nullptr;
+    MPointArray pts;
+    {
+        MProfilingScope scope(profilerCategory, MProfiler::kColorE_L2, "Fetch points", "Read the target and deformed points");
+        tpts = fnTarget.getRawPoints(&stat);
+        if (tpts == NULL) return MStatus::kInvalidParameter;
+        if (binding->maxVert >= fnTarget.numVertices()) {
+            MGlobal::displayError("The target mesh doesn't match the topology of the static target");
+            return MStatus::kInvalidParameter;
+        }
+        iter.allPositions(pts);
+    }
 
-    for (; !iter.isDone(); iter.next()) {
-        unsigned int i = (unsigned int)iter.index();
-        if (i >= baryIdxs.length()) continue;
+    int threadCount = block.inputValue(aThreadCount, &stat).asInt();
 
-        float w = weightValue(block, multiIndex, i);
-        if (w == 0.0f) continue;
+    unsigned int count = pts.length();
+    if (count == 0) return stat;
 
-        int qIdx = baryIdxs[i];
-        if (qIdx < 0) continue;
+    // target space -> world -> deformed object space
+    MMatrix xform = tMat * dMatInv;
 
-        MPoint bary = baryValues[i];
+    std::vector<float> weights(deformIndex.size());
+    getDenseWeights(block, multiIndex, weights);
 
-        MPoint A, B, C;
-        fnTarget.getPoint(triVerts[3 * qIdx + 0], A);
-        fnTarget.getPoint(triVerts[3 * qIdx + 1], B);
-        fnTarget.getPoint(triVerts[3 * qIdx + 2], C);
-        MPoint P = (MVector)A * bary[0] + (MVector)B * bary[1] + (MVector)C * bary[2];
-        P *= tMat;
-        P *= dMatInv;
+    // MPointArray keeps its MPoints packed, so it can be handed
+    // to the kernel as xyzw doubles
+    double* ptData = &pts[0].x;
 
-        MPoint Po = iter.position();
-        iter.setPosition(((P - Po) * (env * w)) + Po);
+    // Each geometry keeps its own dirty tracking state and pool
+    DeformCache* deformCache;
+    {
+        std::lock_guard<std::mutex> lock(deformMutex);
+        deformCache = &deformCaches[multiIndex];
+    }
 
+    auto deformStart = std::chrono::steady_clock::now();
+    size_t evaluated = count;
+    {
+        MProfilingScope evalScope(profilerCategory, MProfiler::kColorE_L3, "Evaluate", "Move the points onto the target");
+        if (count == deformIndex.size()) {
+            // Usually only part of the target moves from one frame to the next
+            evaluated = evaluate_binding(
+                *deformCache, (size_t)threadCount, binding, tpts, weights.data(), xform.matrix, env, ptData, count
+            );
+        }
+        else {
+            // Only some of the points are in the deformer set, so build
+            // an index for just those points
+            DeformIndex subIndex;
+            std::vector<float> subWeights(count, 0.0f);
+            subIndex.resize(count, deformIndex.slots, deformIndex.has_offsets());
+            unsigned int j = 0;
+            for (iter.reset(); !iter.isDone() && j < count; iter.next(), ++j) {
+                unsigned int i = (unsigned int)iter.index();
+                if (i >= deformIndex.size()) continue;
+                subIndex.copy_point(j, deformIndex, i);
+                subWeights[j] = weights[i];
+            }
+            std::unique_lock<std::mutex> lock(deformCache->mutex, std::try_to_lock);
+            if (lock.owns_lock()) {
+                evaluate_deform(deformCache->get_pool((size_t)threadCount), subIndex, tpts, subWeights.data(), xform.matrix, env, ptData, count);
+            }
+            else {
+                evaluate_deform(subIndex, tpts, subWeights.data(), xform.matrix, env, ptData, count);
+            }
+        }
+    }
+    double deformMs = elapsed_ms(deformStart);
+    {
+        std::lock_guard<std::mutex> statsLock(statsMutex);
+        stats.deforms += 1;
+        stats.deformPoints += evaluated;
+        stats.deformMs += deformMs;
     }
+
+    MProfilingScope writeScope(profilerCategory, MProfiler::kColorE_L2, "Write points", "Set the deformed positions");
+    iter.setAllPositions(pts);
     return stat;
 }
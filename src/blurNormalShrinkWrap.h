@@ -11,13 +11,60 @@
 #include <maya/MGPUDeformerRegistry.h>
 #include <maya/MOpenCLInfo.h>
 #include <maya/MFnNumericAttribute.h>
+#include <maya/MIntArray.h>
+#include <maya/MPointArray.h>
 #include <vector>
+#include <map>
+#include <mutex>
 
 #include "cpom_types.h"
 #include "cpom_normal.h"
+#include "bind_cache.h"
+#include "bind_file.h"
+#include "deform_kernel.h"
 #define DEFORMER_NAME "blurNormalShrinkWrap"
 
 
+// The binding of one deformed geometry
+// With more than one neighbor, each vertex has that many entries in a row,
+// and the barys are already scaled by the entry's share of the blend
+struct PieceBinding {
+    std::vector<Vec3> barys;
+    std::vector<Index> baryIdxs;
+    // 1 for each vertex that missed everything short of the full search
+    std::vector<unsigned char> widened;
+    // The tolerance tier each vertex was bound at: 0 for the angle tolerance,
+    // k for the k-th fallback, and -1 for unbound
+    std::vector<int8_t> tiers;
+
+    // What the current binding was computed from, so an edit to the
+    // source only has to rebind the vertices that actually changed
+    std::vector<float> bindPoints;
+    std::vector<float> bindNormals;
+    MMatrix bindMatrix;
+    double bindAngle = -1.0;
+    double bindFloatTol = -1.0;
+    size_t bindNeighbors = 0;
+    double bindRadius = -1.0;
+    double bindMaxDistance = -1.0;
+    bool bindProgressive = false;
+    short bindFallback = -1;
+};
+
+
+// Counters summed over everything the node did since they were last reset
+struct NodeStats {
+    QueryStats query;          // Every query of every bind
+    size_t builds = 0;         // Bvh builds, refits and loads
+    double buildMs = 0.0;
+    size_t binds = 0;
+    double bindMs = 0.0;
+    size_t deforms = 0;        // One per geometry per evaluation
+    size_t deformPoints = 0;   // Points actually evaluated, after the dirty tracking
+    double deformMs = 0.0;
+};
+
+
 class NormalShrinkWrapDeformer : public MPxDeformerNode {
 public:
     NormalShrinkWrapDeformer() {};
@@ -30,14 +77,50 @@ public:
 
     virtual MStatus compute(const MPlug& plug, MDataBlock& block);
 
+    // deform only reads the binding snapshot out of the data block, and keeps
+    // its own per-geometry state behind deformMutex.  The rest of the node
+    // state is behind bindMutex
+    virtual SchedulingType schedulingType() const { return kParallel; }
+
+    NodeStats getStats();
+    void resetStats();
+
     static MTypeId id;
+    // Everything the node does shows up under this in the Maya profiler
+    static int profilerCategory;
     
     static MObject aBvhComputed;
 
     static MObject aBaryIndices;
     static MObject aBaryValues;
+    static MObject aBaryCorners;
+    static MObject aBaryOffsets;
+    static MObject aBinding;
 
     static MObject aAngleTolerance;
+    static MObject aThreadCount;
+    static MObject aPrecision;
+    static MObject aBuildStrategy;
+    static MObject aFloatTolerance;
+    static MObject aRebindTolerance;
+    static MObject aNeighborCount;
+    static MObject aNeighborRadius;
+    static MObject aKeepOffset;
+    static MObject aMaxDistance;
+    static MObject aSearchMode;
+    static MObject aToleranceFallback;
+    static MObject aCacheFile;
+
+    static MObject aBuildTime;
+    static MObject aBuildWasRefit;
+    static MObject aBuildWasLoaded;
+    static MObject aBvhMemory;
+    static MObject aBindTime;
+    static MObject aRebindCount;
+    static MObject aWideSearch;
+    static MObject aWideSearchCount;
+    static MObject aBindTier;
+    static MObject aFallbackCount;
 
     static MObject aTargetStaticMesh;
     static MObject aTargetStaticInvWorld;
@@ -49,13 +132,24 @@ public:
     static MObject aTargetInvWorld;
 
 private:
+    // Held while computing the bvh, the binding or its snapshot.  Those
+    // computes pull each other, so it has to be recursive
+    std::recursive_mutex bindMutex;
 
-    Bvh bvh;
-    std::vector<Tri> tris;
-    std::vector<BBox> bboxes;
-    std::vector<Vec3> centers;
-    std::vector<Vec3> normals;
-    std::vector<Vec3> barys;
-    std::vector<Index> baryIdxs;
-    MIntArray triVerts;
+    // One bvh of the static target is shared by every deformed geometry
+    BindCache bindCache;
+    BindFile bindFile;
+    uint64_t targetKey = 0;
+
+    // Keyed by the deformer's multiIndex
+    std::map<unsigned int, PieceBinding> pieces;
+
+    // What each geometry's deform keeps between evaluations, keyed by the
+    // deformer's multiIndex.  The lock only covers finding the entry
+    std::mutex deformMutex;
+    std::map<unsigned int, DeformCache> deformCaches;
+
+    // deform runs for several geometries at once, so this has its own lock
+    std::mutex statsMutex;
+    NodeStats stats;
 };
@@ -1,13 +1,21 @@
-#ifndef CPOM_NORMAL_H
-#define CPOM_NORMAL_H
-
 #include <vector>
 #include <cmath>
 #include <numbers>
 #include <tuple>
+#include <mutex>
+#include <type_traits>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <utility>
+#include <array>
+#include <cstring>
+#include <bit>
+#include "cpu_features.h"
 #include "cpom_types.h"
 #include "cpom_normal.h"
 #include "dist_point_triangle.h"
+#include "leaf_kernel.h"
 
 #include "bvh/v2/bvh.h"
 #include "bvh/v2/node.h"
@@ -20,107 +28,1246 @@
 #include "bvh/v2/tri.h"
 
 
-BVH_ALWAYS_INLINE Vec3 get_normal(const Tri &tri) {
+template <typename T>
+BVH_ALWAYS_INLINE Vec3T<T> get_normal(const TriT<T> &tri) {
     return bvh::v2::normalize(bvh::v2::cross(tri.p0 - tri.p1, tri.p2 - tri.p0));
 }
 
-template <typename T, size_t N>
-BVH_ALWAYS_INLINE bvh::v2::Vec<T, N> vec_to_closest(const BBox& bbox, const bvh::v2::Vec<T, N>& p) {
-    bvh::v2::Vec<T, N> ret;
-    bvh::v2::static_for<0, N>([&] (size_t i) {
-        ret[i] = bvh::v2::robust_max<T>(bvh::v2::robust_max<T>(bbox.min[i] - p[i], p[i] - bbox.max[i]), 0);
+template <typename C, typename T>
+BVH_ALWAYS_INLINE Vec3T<C> vec_cast(const Vec3T<T>& v) {
+    return Vec3T<C>(static_cast<C>(v[0]), static_cast<C>(v[1]), static_cast<C>(v[2]));
+}
+
+template <typename T>
+void quantize_node(WideNode& node, const BBoxT<T>* boxes, size_t count) {
+    node.childCount = (uint8_t)count;
+    for (int a = 0; a < 3; ++a) {
+        double lo = std::numeric_limits<double>::max();
+        double hi = std::numeric_limits<double>::lowest();
+        for (size_t c = 0; c < count; ++c) {
+            lo = std::min(lo, (double)boxes[c].min[a]);
+            hi = std::max(hi, (double)boxes[c].max[a]);
+        }
+        if (!(lo <= hi)) lo = hi = 0.0;
+
+        float origin = static_cast<float>(lo);
+        if ((double)origin > lo) origin = std::nextafter(origin, -std::numeric_limits<float>::infinity());
+        double extent = hi - (double)origin;
+        int e = (extent > 0.0) ? (int)std::ceil(std::log2(extent / 255.0)) : -126;
+        e = std::clamp(e, -126, 127);
+        while (e < 127 && (double)origin + 255.0 * pow2<double>(e) < hi) ++e;
+        double scale = pow2<double>(e);
+        node.origin[a] = origin;
+        node.exponent[a] = (int8_t)e;
+
+        for (size_t c = 0; c < kWideArity; ++c) {
+            if (c >= count) {
+                node.lo[a][c] = 0;
+                node.hi[a][c] = 0;
+                continue;
+            }
+            double cmin = (double)boxes[c].min[a], cmax = (double)boxes[c].max[a];
+            double qlo = std::clamp(std::floor((cmin - (double)origin) / scale), 0.0, 255.0);
+            double qhi = std::clamp(std::ceil((cmax - (double)origin) / scale), 0.0, 255.0);
+            // Nan bounds end up covering the whole node
+            if (!(qlo == qlo)) qlo = 0.0;
+            if (!(qhi == qhi)) qhi = 255.0;
+            while (qlo > 0.0 && (double)origin + qlo * scale > cmin) qlo -= 1.0;
+            while (qhi < 255.0 && (double)origin + qhi * scale < cmax) qhi += 1.0;
+            node.lo[a][c] = (uint8_t)qlo;
+            node.hi[a][c] = (uint8_t)qhi;
+        }
+    }
+}
+
+// Collapse the builder's binary tree into wide nodes.  Each wide node takes
+// its binary node's children, and keeps opening up the inner one with the
+// biggest surface until it has kWideArity of them or only leaves are left
+template <typename T>
+WideBvhT<T> collapse_bvh(BvhT<T>& binary) {
+    WideBvhT<T> wide;
+    wide.prim_ids.assign(binary.prim_ids.begin(), binary.prim_ids.end());
+    if (binary.nodes.empty()) return wide;
+
+    std::vector<std::pair<uint32_t, size_t>> todo;  // Wide node to fill, and the binary node it stands for
+    wide.nodes.emplace_back();
+    todo.emplace_back(0, 0);
+    while (!todo.empty()) {
+        auto [wideIdx, binIdx] = todo.back();
+        todo.pop_back();
+
+        size_t kids[kWideArity];
+        size_t count = 0;
+        const auto& root = binary.nodes[binIdx];
+        if (root.is_leaf()) {
+            // Only happens when the whole tree is one leaf
+            kids[count++] = binIdx;
+        }
+        else {
+            kids[count++] = root.index.first_id();
+            kids[count++] = root.index.first_id() + 1;
+        }
+        while (count < kWideArity) {
+            size_t open = count;
+            T bestArea = T(-1);
+            for (size_t c = 0; c < count; ++c) {
+                const auto& n = binary.nodes[kids[c]];
+                if (!n.is_leaf() && n.get_bbox().get_half_area() > bestArea) {
+                    bestArea = n.get_bbox().get_half_area();
+                    open = c;
+                }
+            }
+            if (open == count) break;
+            size_t first = binary.nodes[kids[open]].index.first_id();
+            kids[open] = first;
+            kids[count++] = first + 1;
+        }
+
+        BBoxT<T> boxes[kWideArity];
+        WideNode node = {};
+        for (size_t c = 0; c < count; ++c) {
+            const auto& n = binary.nodes[kids[c]];
+            boxes[c] = n.get_bbox();
+            if (n.is_leaf()) {
+                node.child[c] = (uint32_t)n.index.first_id();
+                node.primCount[c] = (uint8_t)n.index.prim_count();
+            }
+            else {
+                node.child[c] = (uint32_t)wide.nodes.size();
+                wide.nodes.emplace_back();
+                todo.emplace_back(node.child[c], kids[c]);
+            }
+        }
+        quantize_node(node, boxes, count);
+        wide.nodes[wideIdx] = node;
+    }
+    return wide;
+}
+
+// Spread the low 21 bits out to every third bit
+BVH_ALWAYS_INLINE uint64_t expand_bits(uint64_t v) {
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x1f00000000ffff;
+    v = (v | v << 16) & 0x1f0000ff0000ff;
+    v = (v | v << 8) & 0x100f00f00f00f00f;
+    v = (v | v << 4) & 0x10c30c30c30c30c3;
+    v = (v | v << 2) & 0x1249249249249249;
+    return v;
+}
+
+// Sort in parallel: every chunk gets sorted on its own, then neighbouring
+// runs are merged pairwise until there's one left.  The keys are unique,
+// so the result doesn't depend on how many chunks there were
+template <typename K>
+void parallel_sort(bvh::v2::ThreadPool& thread_pool, std::vector<K>& keys) {
+    size_t chunks = std::max<size_t>(1, thread_pool.get_thread_count());
+    size_t chunkSize = (keys.size() + chunks - 1) / chunks;
+    if (chunks == 1 || chunkSize < 4096) {
+        std::sort(keys.begin(), keys.end());
+        return;
+    }
+    bvh::v2::ParallelExecutor executor(thread_pool, 1);
+    executor.for_each(0, chunks, [&] (size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            size_t lo = std::min(keys.size(), c * chunkSize);
+            size_t hi = std::min(keys.size(), lo + chunkSize);
+            std::sort(keys.begin() + lo, keys.begin() + hi);
+        }
+    });
+    for (size_t run = chunkSize; run < keys.size(); run *= 2) {
+        size_t pairs = (keys.size() + 2 * run - 1) / (2 * run);
+        executor.for_each(0, pairs, [&] (size_t begin, size_t end) {
+            for (size_t p = begin; p < end; ++p) {
+                size_t lo = p * 2 * run;
+                size_t mid = std::min(keys.size(), lo + run);
+                size_t hi = std::min(keys.size(), lo + 2 * run);
+                std::inplace_merge(keys.begin() + lo, keys.begin() + mid, keys.begin() + hi);
+            }
+        });
+    }
+}
+
+// 63 bit Morton codes of the points within their bounding box, paired with
+// the point index and sorted
+template <typename T>
+void morton_codes(
+    bvh::v2::ThreadPool& thread_pool,
+    const std::vector<Vec3T<T>>& pts,
+    std::vector<std::pair<uint64_t, uint32_t>>& keyed
+) {
+    bvh::v2::ParallelExecutor executor(thread_pool);
+    auto bbox = executor.reduce(0, pts.size(), BBoxT<T>::make_empty(),
+        [&] (BBoxT<T>& box, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) box.extend(pts[i]);
+        },
+        [] (BBoxT<T>& box, const BBoxT<T>& other) { box.extend(other); }
+    );
+    auto extent = bbox.get_diagonal();
+
+    keyed.resize(pts.size());
+    executor.for_each(0, pts.size(), [&] (size_t begin, size_t end) {
+        static constexpr T cells = T((1 << 21) - 1);
+        for (size_t i = begin; i < end; ++i) {
+            uint64_t code = 0;
+            for (int a = 0; a < 3; ++a) {
+                T t = (extent[a] > 0) ? (pts[i][a] - bbox.min[a]) / extent[a] : T(0);
+                // Written so a nan lands in cell 0 instead of being undefined
+                t = (t > T(0)) ? std::min(t, T(1)) : T(0);
+                code |= expand_bits(static_cast<uint64_t>(t * cells)) << a;
+            }
+            keyed[i] = {code, (uint32_t)i};
+        }
     });
-    return ret;
+    parallel_sort(thread_pool, keyed);
+}
+
+// Where to split a run of sorted codes: the first one with the highest
+// differing bit set.  Identical codes have no bit to go on, so they're halved
+BVH_ALWAYS_INLINE size_t morton_split(const std::pair<uint64_t, uint32_t>* keyed, size_t begin, size_t end) {
+    uint64_t diff = keyed[begin].first ^ keyed[end - 1].first;
+    if (diff == 0) return (begin + end) / 2;
+    uint64_t bit = uint64_t(1) << (63 - std::countl_zero(diff));
+    auto split = std::partition_point(keyed + begin, keyed + end, [bit] (const auto& k) { return (k.first & bit) == 0; });
+    return (size_t)(split - keyed);
+}
+
+// Linear bvh: sort the triangle centers along a Morton curve, and split every
+// run at its highest differing bit until it fits in a leaf.  The tree is built
+// a level at a time, with the nodes on each level split in parallel.  Children
+// get allocated in pairs like the sah builder's, so it collapses the same way
+template <typename T>
+BvhT<T> build_lbvh(bvh::v2::ThreadPool& thread_pool, const std::vector<TriT<T>>& tris, size_t maxLeafSize) {
+    using NodeType = NodeT<T>;
+    bvh::v2::ParallelExecutor executor(thread_pool, 256);
+
+    std::vector<std::pair<uint64_t, uint32_t>> keyed;
+    {
+        std::vector<Vec3T<T>> centers(tris.size());
+        executor.for_each(0, tris.size(), [&] (size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) centers[i] = tris[i].get_center();
+        });
+        morton_codes(thread_pool, centers, keyed);
+    }
+
+    BvhT<T> bvh;
+    if (tris.empty()) return bvh;
+    std::vector<std::pair<size_t, size_t>> ranges;  // Sorted triangles under each node
+    std::vector<size_t> splits;
+    std::vector<size_t> levels;  // The first node of every level
+    bvh.nodes.emplace_back();
+    ranges.emplace_back(0, tris.size());
+    size_t levelBegin = 0;
+    while (levelBegin < bvh.nodes.size()) {
+        size_t levelEnd = bvh.nodes.size();
+        levels.push_back(levelBegin);
+        splits.resize(levelEnd);
+        executor.for_each(levelBegin, levelEnd, [&] (size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                auto [lo, hi] = ranges[i];
+                splits[i] = (hi - lo <= maxLeafSize) ? 0 : morton_split(keyed.data(), lo, hi);
+            }
+        });
+        // Handing out the child slots in order keeps the layout deterministic
+        for (size_t i = levelBegin; i < levelEnd; ++i) {
+            auto [lo, hi] = ranges[i];
+            if (splits[i] == 0) {
+                bvh.nodes[i].index = NodeType::Index::make_leaf(lo, hi - lo);
+                continue;
+            }
+            bvh.nodes[i].index = NodeType::Index::make_inner(bvh.nodes.size());
+            bvh.nodes.emplace_back();
+            bvh.nodes.emplace_back();
+            ranges.emplace_back(lo, splits[i]);
+            ranges.emplace_back(splits[i], hi);
+        }
+        levelBegin = levelEnd;
+    }
+
+    // Bounds from the bottom level up, so the children are always done first
+    levels.push_back(bvh.nodes.size());
+    for (size_t l = levels.size() - 1; l-- > 0;) {
+        executor.for_each(levels[l], levels[l + 1], [&] (size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                auto& node = bvh.nodes[i];
+                auto bbox = BBoxT<T>::make_empty();
+                if (node.is_leaf()) {
+                    for (size_t s = ranges[i].first; s < ranges[i].second; ++s) {
+                        bbox.extend(tris[keyed[s].second].get_bbox());
+                    }
+                }
+                else {
+                    bbox = bvh.nodes[node.index.first_id()].get_bbox();
+                    bbox.extend(bvh.nodes[node.index.first_id() + 1].get_bbox());
+                }
+                node.set_bbox(bbox);
+            }
+        });
+    }
+
+    bvh.prim_ids.resize(keyed.size());
+    for (size_t i = 0; i < keyed.size(); ++i) bvh.prim_ids[i] = keyed[i].second;
+    return bvh;
 }
 
-Bvh build_bvh(
-    const std::vector<Tri>& tris,
-    std::vector<BBox>& bboxes,
-    std::vector<Vec3>& centers,
-    std::vector<Vec3>& normals
+BuildStrategy resolve_build_strategy(BuildStrategy strategy, size_t triCount) {
+    if (strategy != BuildStrategy::Auto) return strategy;
+    return (triCount > kLbvhAutoTris) ? BuildStrategy::Lbvh : BuildStrategy::Sah;
+}
+
+template <typename T>
+WideBvhT<T> build_bvh(
+    bvh::v2::ThreadPool& thread_pool,
+    const std::vector<TriT<T>>& tris,
+    PackedTrisT<T>& packed,
+    std::vector<NormalConeT<T>>& cones,
+    size_t maxLeafSize,
+    BuildStrategy strategy
 ) {
-    bvh::v2::ThreadPool thread_pool;
+    using NodeType = NodeT<T>;
     bvh::v2::ParallelExecutor executor(thread_pool);
 
+    if (resolve_build_strategy(strategy, tris.size()) == BuildStrategy::Lbvh) {
+        // A wide node keeps leaf sizes in a byte, and the binary node in fewer bits
+        size_t leafCap = std::min<size_t>(255, NodeType::Index::max_prim_count);
+        auto binary = build_lbvh(thread_pool, tris, std::clamp<size_t>(maxLeafSize, 1, leafCap));
+        auto bvh = collapse_bvh(binary);
+        binary = BvhT<T>();
+        pack_tris(thread_pool, bvh.prim_ids, tris, packed);
+        build_cones(bvh, packed, cones);
+        return bvh;
+    }
+
     // Get triangle centers and bounding boxes (required for BVH builder)
-    bboxes.resize(tris.size());
-    centers.resize(tris.size());
-    normals.resize(tris.size());
+    std::vector<BBoxT<T>> bboxes(tris.size());
+    std::vector<Vec3T<T>> centers(tris.size());
     executor.for_each(0, tris.size(), [&] (size_t begin, size_t end) {
         for (size_t i = begin; i < end; ++i) {
             bboxes[i]  = tris[i].get_bbox();
             centers[i] = tris[i].get_center();
-            normals[i] = get_normal(tris[i]);
         }
     });
 
-    typename bvh::v2::DefaultBuilder<Node>::Config config;
-    config.quality = bvh::v2::DefaultBuilder<Node>::Quality::High;
-    return bvh::v2::DefaultBuilder<Node>::build(thread_pool, bboxes, centers, config);
+    typename bvh::v2::DefaultBuilder<NodeType>::Config config;
+    config.quality = bvh::v2::DefaultBuilder<NodeType>::Quality::High;
+    // A wide node keeps leaf sizes in a byte
+    config.max_leaf_size = std::clamp<size_t>(maxLeafSize, 1, 255);
+    auto binary = bvh::v2::DefaultBuilder<NodeType>::build(thread_pool, bboxes, centers, config);
+    // The builder's arrays go away here, only the wide tree is kept
+    bboxes = std::vector<BBoxT<T>>();
+    centers = std::vector<Vec3T<T>>();
+
+    auto bvh = collapse_bvh(binary);
+    binary = BvhT<T>();
+    pack_tris(thread_pool, bvh.prim_ids, tris, packed);
+    build_cones(bvh, packed, cones);
+    return bvh;
+}
+
+template <typename T>
+void refit_bvh(
+    bvh::v2::ThreadPool& thread_pool,
+    WideBvhT<T>& bvh,
+    const std::vector<TriT<T>>& tris,
+    PackedTrisT<T>& packed,
+    std::vector<NormalConeT<T>>& cones
+) {
+    // Children always come after their parent, so going backwards every inner
+    // child's bounds are ready by the time its parent needs them
+    std::vector<BBoxT<T>> nodeBounds(bvh.nodes.size());
+    for (size_t i = bvh.nodes.size(); i-- > 0;) {
+        auto& node = bvh.nodes[i];
+        BBoxT<T> boxes[kWideArity];
+        auto bounds = BBoxT<T>::make_empty();
+        for (size_t c = 0; c < node.childCount; ++c) {
+            if (node.primCount[c] == 0) {
+                boxes[c] = nodeBounds[node.child[c]];
+            }
+            else {
+                boxes[c] = BBoxT<T>::make_empty();
+                for (size_t s = node.child[c]; s < node.child[c] + node.primCount[c]; ++s) {
+                    boxes[c].extend(tris[bvh.prim_ids[s]].get_bbox());
+                }
+            }
+            bounds.extend(boxes[c]);
+        }
+        quantize_node(node, boxes, node.childCount);
+        nodeBounds[i] = bounds;
+    }
+    pack_tris(thread_pool, bvh.prim_ids, tris, packed);
+    build_cones(bvh, packed, cones);
+}
+
+template <typename T, typename I>
+void pack_tris(
+    bvh::v2::ThreadPool& thread_pool,
+    const std::vector<I>& primIds,
+    const std::vector<TriT<T>>& tris,
+    PackedTrisT<T>& packed
+) {
+    bvh::v2::ParallelExecutor executor(thread_pool);
+    packed.resize(primIds.size());
+    executor.for_each(0, packed.size(), [&] (size_t begin, size_t end) {
+        using P = PackedTrisT<T>;
+        for (size_t i = begin; i < end; ++i) {
+            const auto& tri = tris[primIds[i]];
+            packed.set(P::P0X, i, tri.p0);
+            packed.set(P::E1X, i, tri.p1 - tri.p0);
+            packed.set(P::E2X, i, tri.p2 - tri.p0);
+            packed.set(P::NX, i, get_normal(tri));
+        }
+    });
+}
+
+template <typename T>
+BVH_ALWAYS_INLINE T unit_angle(const Vec3T<T>& a, const Vec3T<T>& b) {
+    if (bvh::v2::dot(a, b) < 0) {
+        return std::numbers::pi_v<T> - 2 * std::asin(std::min(T(1), bvh::v2::length(a + b) / 2));
+    }
+    return 2 * std::asin(std::min(T(1), bvh::v2::length(a - b) / 2));
+}
+
+template <typename T>
+BVH_ALWAYS_INLINE NormalConeT<T> make_cone(const Vec3T<T>& axis, T angle) {
+    NormalConeT<T> cone;
+    if (!(angle < std::numbers::pi_v<T>)) return cone;
+    // Pad for rounding so the cone never ends up tighter than its normals
+    static constexpr T eps = std::numeric_limits<T>::epsilon() * 64;
+    angle = std::min(angle * (1 + eps) + eps, std::numbers::pi_v<T>);
+    cone.axis = axis;
+    cone.cosAngle = std::cos(angle);
+    cone.sinAngle = std::sin(angle);
+    return cone;
+}
+
+// Smallest cone around both of the given cones.  Same approach as the
+// DirectionCone union from pbrt-v4
+template <typename T>
+NormalConeT<T> merge_cones(const NormalConeT<T>& a, const NormalConeT<T>& b) {
+    static constexpr T pi = std::numbers::pi_v<T>;
+    if (a.cosAngle <= T(-1) || b.cosAngle <= T(-1)) return NormalConeT<T>();
+
+    T angleA = std::atan2(a.sinAngle, a.cosAngle);
+    T angleB = std::atan2(b.sinAngle, b.cosAngle);
+    T angleD = unit_angle(a.axis, b.axis);
+    if (std::min(angleD + angleB, pi) <= angleA) return a;
+    if (std::min(angleD + angleA, pi) <= angleB) return b;
+
+    T angleO = (angleA + angleD + angleB) / 2;
+    if (angleO >= pi) return NormalConeT<T>();
+
+    // Rotate a's axis towards b's so the new cone just touches both
+    auto rotAxis = bvh::v2::cross(a.axis, b.axis);
+    T rotLen = bvh::v2::length(rotAxis);
+    if (!(rotLen > 0)) return NormalConeT<T>();
+    rotAxis = rotAxis * (T(1) / rotLen);
+    T rot = angleO - angleA;
+    auto axis = a.axis * std::cos(rot) + bvh::v2::cross(rotAxis, a.axis) * std::sin(rot);
+    return make_cone(bvh::v2::normalize(axis), angleO);
+}
+
+// The cone around the normals of the packed triangles [begin, end)
+template <typename T>
+NormalConeT<T> leaf_cone(const PackedTrisT<T>& packed, size_t begin, size_t end) {
+    Vec3T<T> sum(0);
+    for (size_t i = begin; i < end; ++i) {
+        auto n = packed.get(PackedTrisT<T>::NX, i);
+        T len2 = bvh::v2::dot(n, n);
+        // Zero area triangles have garbage normals that pass any angle test
+        if (!(std::abs(len2 - 1) < T(1e-2))) return NormalConeT<T>();
+        sum = sum + n;
+    }
+    T sumLen = bvh::v2::length(sum);
+    if (!(sumLen > 0)) return NormalConeT<T>();
+
+    auto axis = sum * (T(1) / sumLen);
+    T angle = 0;
+    for (size_t i = begin; i < end; ++i) {
+        angle = std::max(angle, unit_angle(axis, packed.get(PackedTrisT<T>::NX, i)));
+    }
+    return make_cone(axis, angle);
+}
+
+template <typename T>
+void build_cones(
+    const WideBvhT<T>& bvh,
+    const PackedTrisT<T>& packed,
+    std::vector<NormalConeT<T>>& cones
+) {
+    cones.assign(bvh.nodes.size() * kWideArity, NormalConeT<T>());
+
+    // Children always come after their parent, so going over the nodes
+    // in reverse builds every cone from the bottom up
+    for (size_t i = bvh.nodes.size(); i-- > 0;) {
+        const auto& node = bvh.nodes[i];
+        for (size_t c = 0; c < node.childCount; ++c) {
+            auto& cone = cones[i * kWideArity + c];
+            if (node.primCount[c] != 0) {
+                cone = leaf_cone(packed, node.child[c], node.child[c] + node.primCount[c]);
+                continue;
+            }
+            const auto& kid = bvh.nodes[node.child[c]];
+            const auto* kidCones = &cones[node.child[c] * kWideArity];
+            cone = kidCones[0];
+            for (size_t k = 1; k < kid.childCount; ++k) cone = merge_cones(cone, kidCones[k]);
+        }
+    }
+}
+
+// Squared distance from the query to each child box of a wide node.  Every
+// lane is computed whether the child is in use or not.  The simd versions do
+// exactly the same operations in the same order as the scalar one, so they
+// agree bit for bit
+template <typename C>
+BVH_ALWAYS_INLINE void child_dist2(const WideNode& node, const Vec3T<C>& qp, C* out) {
+#if CPOM_X86
+    if constexpr (std::is_same_v<C, float>) {
+        const __m128i zero = _mm_setzero_si128();
+        auto bytes = [&](const uint8_t* q) {
+            uint32_t packed;
+            std::memcpy(&packed, q, sizeof(packed));
+            __m128i v = _mm_cvtsi32_si128((int)packed);
+            v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+            return _mm_cvtepi32_ps(v);
+        };
+        __m128 d2 = _mm_setzero_ps();
+        for (int a = 0; a < 3; ++a) {
+            __m128 origin = _mm_set1_ps(node.origin[a]);
+            __m128 scale = _mm_set1_ps(pow2<float>(node.exponent[a]));
+            __m128 p = _mm_set1_ps(qp[a]);
+            __m128 lo = _mm_add_ps(origin, _mm_mul_ps(bytes(node.lo[a]), scale));
+            __m128 hi = _mm_add_ps(origin, _mm_mul_ps(bytes(node.hi[a]), scale));
+            __m128 d = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lo, p), _mm_sub_ps(p, hi)), _mm_setzero_ps());
+            d2 = _mm_add_ps(d2, _mm_mul_ps(d, d));
+        }
+        _mm_storeu_ps(out, d2);
+        return;
+    }
+    else if constexpr (std::is_same_v<C, double>) {
+        const __m128i zero = _mm_setzero_si128();
+        auto bytes = [&](const uint8_t* q, __m128d& first, __m128d& second) {
+            uint32_t packed;
+            std::memcpy(&packed, q, sizeof(packed));
+            __m128i v = _mm_cvtsi32_si128((int)packed);
+            v = _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+            first = _mm_cvtepi32_pd(v);
+            second = _mm_cvtepi32_pd(_mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+        };
+        __m128d d2a = _mm_setzero_pd(), d2b = _mm_setzero_pd();
+        for (int a = 0; a < 3; ++a) {
+            __m128d origin = _mm_set1_pd((double)node.origin[a]);
+            __m128d scale = _mm_set1_pd(pow2<double>(node.exponent[a]));
+            __m128d p = _mm_set1_pd(qp[a]);
+            __m128d loA, loB, hiA, hiB;
+            bytes(node.lo[a], loA, loB);
+            bytes(node.hi[a], hiA, hiB);
+            loA = _mm_add_pd(origin, _mm_mul_pd(loA, scale));
+            loB = _mm_add_pd(origin, _mm_mul_pd(loB, scale));
+            hiA = _mm_add_pd(origin, _mm_mul_pd(hiA, scale));
+            hiB = _mm_add_pd(origin, _mm_mul_pd(hiB, scale));
+            __m128d dA = _mm_max_pd(_mm_max_pd(_mm_sub_pd(loA, p), _mm_sub_pd(p, hiA)), _mm_setzero_pd());
+            __m128d dB = _mm_max_pd(_mm_max_pd(_mm_sub_pd(loB, p), _mm_sub_pd(p, hiB)), _mm_setzero_pd());
+            d2a = _mm_add_pd(d2a, _mm_mul_pd(dA, dA));
+            d2b = _mm_add_pd(d2b, _mm_mul_pd(dB, dB));
+        }
+        _mm_storeu_pd(out, d2a);
+        _mm_storeu_pd(out + 2, d2b);
+        return;
+    }
+#endif
+    C origin[3], scale[3];
+    for (int a = 0; a < 3; ++a) {
+        origin[a] = static_cast<C>(node.origin[a]);
+        scale[a] = pow2<C>(node.exponent[a]);
+    }
+    for (size_t c = 0; c < kWideArity; ++c) {
+        C d2 = 0;
+        for (int a = 0; a < 3; ++a) {
+            C lo = origin[a] + static_cast<C>(node.lo[a][c]) * scale[a];
+            C hi = origin[a] + static_cast<C>(node.hi[a][c]) * scale[a];
+            C d = std::max(std::max(lo - qp[a], qp[a] - hi), C(0));
+            d2 += d * d;
+        }
+        out[c] = d2;
+    }
+}
+
+// Walk the wide bvh nearest first.  A child is only entered while its box is
+// closer than prune_dist2, which the leaf function is free to tighten as it
+// goes, and when skip(slot) is false for its cone slot.  Boxes are checked
+// again when they come off the stack, since the bound may have shrunk since
+// leafFunc gets runs of packed slots [begin, end)
+template <typename T, typename C, typename Skip, typename Leaf>
+BVH_ALWAYS_INLINE void traverse_nearest(
+    const WideBvhT<T>& bvh,
+    const Vec3T<C>& qp,
+    const C& prune_dist2,
+    QueryStats& stats,
+    Skip&& skip,
+    Leaf&& leafFunc
+) {
+    // Every level pushes at most one less than the arity, so this covers 64
+    // levels.  Neither builder promises that (an lbvh over many duplicate
+    // Morton codes can go deeper), so past it the stack moves to the heap
+    static constexpr size_t stack_size = 64 * (kWideArity - 1) + 1;
+    struct Entry {
+        C dist2;
+        uint32_t index;  // Wide node, or the first packed slot of a leaf
+        uint32_t count;  // Triangles in a leaf, 0 for a node
+    };
+    if (bvh.nodes.empty()) return;
+
+    Entry local[stack_size];
+    std::vector<Entry> spill;
+    Entry* stack = local;
+    size_t capacity = stack_size;
+    size_t top = 0;
+    Entry entry{C(0), 0, 0};
+    for (;;) {
+        bool descend = false;
+        if (entry.count != 0) {
+            stats.leavesVisited++;
+            leafFunc((size_t)entry.index, (size_t)entry.index + entry.count);
+        }
+        else {
+            const WideNode& node = bvh.nodes[entry.index];
+            C dist2[kWideArity];
+            child_dist2(node, qp, dist2);
+
+            // Sort the hits farthest first.  The nearest one is entered right
+            // away and the rest go on the stack behind it
+            size_t order[kWideArity];
+            size_t hits = 0;
+            stats.nodesVisited += node.childCount;
+            for (size_t c = 0; c < node.childCount; ++c) {
+                if (!(dist2[c] < prune_dist2)) continue;
+                if (skip(entry.index * kWideArity + c)) {
+                    stats.coneRejects++;
+                    continue;
+                }
+                size_t k = hits++;
+                while (k > 0 && dist2[order[k - 1]] < dist2[c]) {
+                    order[k] = order[k - 1];
+                    --k;
+                }
+                order[k] = c;
+            }
+            if (top + hits > capacity) {
+                if (stack == local) spill.assign(local, local + top);
+                capacity *= 2;
+                spill.resize(capacity);
+                stack = spill.data();
+            }
+            for (size_t k = 0; k + 1 < hits; ++k) {
+                size_t c = order[k];
+                stack[top++] = Entry{dist2[c], node.child[c], node.primCount[c]};
+            }
+            if (hits > 0) {
+                size_t c = order[hits - 1];
+                entry = Entry{dist2[c], node.child[c], node.primCount[c]};
+                descend = true;
+            }
+        }
+        if (descend) continue;
+
+        // Next off the stack, skipping anything the bound has since passed
+        do {
+            if (top == 0) return;
+            entry = stack[--top];
+        } while (!(entry.dist2 < prune_dist2));
+    }
 }
 
-Location get_closest(
-    const Bvh& bvh,
-    const std::vector<Tri>& tris,
-    const std::vector<BBox>& bboxes,
-    const std::vector<Vec3>& centers,
-    const std::vector<Vec3>& normals,
+template <typename T, typename C>
+LocationT<C> get_closest(
+    const WideBvhT<T>& bvh,
+    const std::vector<TriT<T>>& tris,
+    const PackedTrisT<T>& packed,
+    const std::vector<NormalConeT<T>>& cones,
 
-    Vec3 qp,
-    Vec3 norm,
-    Scalar angle
+    Vec3T<C> qp,
+    Vec3T<C> norm,
+    C angle,
+    const QueryOptions& options,
+    QueryStats* stats,
+    bool* ambiguous,
+    Index* hitSlot
 ){
-    static constexpr size_t invalid_id = std::numeric_limits<size_t>::max();
-    static constexpr size_t stack_size = 64;
+    static constexpr size_t invalid_id = InvalidIndex;
+    C ambiguityTol = static_cast<C>(options.refineTol);
+    C maxDist = static_cast<C>(options.maxDistance);
+    Index seedSlot = options.seedSlot;
+
+    // When computing in a wider type than the storage, the triangles
+    // and their normals are promoted before doing any math with them
+    static constexpr bool promote = !std::is_same_v<T, C>;
 
-    Scalar cosTol = (angle >= std::numbers::pi) ? -2.0 : cos(angle);
+    C cosTol = (angle >= std::numbers::pi) ? C(-2.0) : std::cos(angle);
 
-    Scalar best_dist2 = std::numeric_limits<Scalar>::max();
+    // Without a cap a query that finds nothing nearby walks the whole tree
+    C best_dist2 = (maxDist > 0) ? maxDist * maxDist : std::numeric_limits<C>::max();
     auto best_prim_idx = invalid_id;
-    Vec3 best_point(0), best_bary(0);
+    Vec3T<C> best_point(0), best_bary(0);
+
+    // Ambiguity tracking.  While it's on, the traversal keeps anything within
+    // the slack of the best distance so no close competitor gets pruned
+    bool checkAmbiguity = (ambiguous != nullptr) && ambiguityTol > 0;
+    C qpMag = std::max({std::abs(qp[0]), std::abs(qp[1]), std::abs(qp[2])});
+    C prune_dist2 = best_dist2;
+    C rival_dist2 = std::numeric_limits<C>::max();
+    Vec3T<C> rival_point(0);
+    bool bestOnAngleEdge = false;
+    bool nearAngleReject = false;
+    C near_reject_dist2 = std::numeric_limits<C>::max();
 
+    auto slack = [&](C dist2) {
+        return ambiguityTol * (qpMag + std::sqrt(dist2));
+    };
+    auto far_apart = [&](const Vec3T<C>& a, const Vec3T<C>& b) {
+        auto d = a - b;
+        C s = slack(best_dist2);
+        return bvh::v2::dot(d, d) > s * s;
+    };
 
-    auto innerFunc = [&](const Node& leftNode, const Node& rightNode) {
-        auto left_vec = vec_to_closest(leftNode.get_bbox(), qp);
-        auto left_dist2 = bvh::v2::dot(left_vec, left_vec);
+    QueryStats localStats;
+    LeafKernelFn<T> leafKernel = get_leaf_kernel<T>();
+    LeafLanes<T> lanes;
 
-        auto right_vec = vec_to_closest(rightNode.get_bbox(), qp);
-        auto right_dist2 = bvh::v2::dot(right_vec, right_vec);
+    // A node can only hold a triangle within the angle tolerance if the query
+    // normal is within the tolerance plus the cone's half angle of its axis.
+    // The cone tolerance is widened when the near misses are being tracked,
+    // and again when the cones were computed at a lower precision
+    C coneCos = cosTol;
+    if (checkAmbiguity) coneCos -= ambiguityTol;
+    bool useCones = !cones.empty() && coneCos > C(-1);
+    C coneTol = useCones ? std::acos(coneCos) : C(0);
+    if constexpr (promote) coneTol += std::sqrt(std::numeric_limits<T>::epsilon());
+    useCones = useCones && coneTol < std::numbers::pi_v<C>;
+    C coneTolCos = std::cos(coneTol);
+    C coneTolSin = std::sin(coneTol);
 
-        return std::make_tuple(
-            left_dist2 < best_dist2,
-            right_dist2 < best_dist2,
-            left_dist2 < right_dist2
-        );
+    auto cone_reject = [&](size_t slot) {
+        if (!useCones) return false;
+        const auto& cone = cones[slot];
+        C cosAngle = static_cast<C>(cone.cosAngle);
+        C sinAngle = static_cast<C>(cone.sinAngle);
+        // cos and sin of (tolerance + half angle).  Once that reaches pi
+        // every direction is in range
+        C sinSum = coneTolSin * cosAngle + coneTolCos * sinAngle;
+        if (sinSum <= 0) return false;
+        C cosSum = coneTolCos * cosAngle - coneTolSin * sinAngle;
+        return bvh::v2::dot(norm, vec_cast<C>(cone.axis)) < cosSum;
+    };
+
+    // Book-keeping for one triangle that has already been tested
+    auto consider = [&](Index slot, C ndot, const Vec3T<C>& prim_point, const Vec3T<C>& prim_bary, C prim_dist2) {
+        // check if the normal angle is outside of tolerance
+        if (ndot < cosTol) {
+            localStats.angleRejects++;
+            if (checkAmbiguity && ndot >= cosTol - ambiguityTol) {
+                // This one could have passed with a little more precision
+                near_reject_dist2 = std::min(near_reject_dist2, prim_dist2);
+            }
+            return;
+        }
+
+        localStats.triTests++;
+        if (prim_dist2 < best_dist2) {
+            // Triangles sharing the closest edge or vertex all land on the same
+            // point, and that tie doesn't matter.  A rival is somewhere else
+            if (checkAmbiguity && best_prim_idx != invalid_id && far_apart(best_point, prim_point)) {
+                rival_dist2 = best_dist2;
+                rival_point = best_point;
+            }
+            best_prim_idx = slot;
+            best_point = prim_point;
+            best_bary = prim_bary;
+            best_dist2 = prim_dist2;
+            bestOnAngleEdge = ndot < cosTol + ambiguityTol;
+            prune_dist2 = best_dist2;
+            if (checkAmbiguity) {
+                C reach = std::sqrt(best_dist2) + slack(best_dist2);
+                prune_dist2 = reach * reach;
+            }
+        }
+        else if (checkAmbiguity && prim_dist2 < rival_dist2 && far_apart(best_point, prim_point)) {
+            rival_dist2 = prim_dist2;
+            rival_point = prim_point;
+        }
     };
 
     auto leafFunc = [&](size_t begin, size_t end) {
-        for (Index i = begin; i < end; ++i) {
-            auto triIdx = bvh.prim_ids[i];
+        if constexpr (promote) {
+            for (Index i = begin; i < end; ++i) {
+                // Start from the original points so this matches a double build exactly
+                const auto& src = tris[bvh.prim_ids[i]];
+                TriT<C> tri(vec_cast<C>(src.p0), vec_cast<C>(src.p1), vec_cast<C>(src.p2));
+                C ndot = bvh::v2::dot(norm, get_normal(tri));
+                if (ndot < cosTol && !(checkAmbiguity && ndot >= cosTol - ambiguityTol)) {
+                    localStats.angleRejects++;
+                    continue;
+                }
+                auto [prim_point, prim_bary] = closest_point_tri(qp, tri);
+                auto prim_vec = prim_point - qp;
+                consider(i, ndot, prim_point, prim_bary, bvh::v2::dot(prim_vec, prim_vec));
+            }
+        }
+        else {
+            // The kernel tests a whole run of the leaf at once
+            for (Index chunk = begin; chunk < end; chunk += kLeafLanes) {
+                size_t count = std::min<size_t>(kLeafLanes, end - chunk);
+                int lane = leafKernel(packed, chunk, count, qp, norm, cosTol, lanes);
 
-            // check if the normal angle is outside of tolerance
-            if (bvh::v2::dot(norm, normals[triIdx]) < cosTol) continue;
+                if (!checkAmbiguity) {
+                    // Only the closest one matters
+                    size_t rejects = 0;
+                    for (size_t i = 0; i < count; ++i) {
+                        rejects += (lanes.ndot[i] < cosTol) ? 1 : 0;
+                    }
+                    localStats.angleRejects += rejects;
+                    localStats.triTests += count - rejects;
+                    if (lane >= 0 && lanes.dist2[lane] < best_dist2) {
+                        best_prim_idx = chunk + lane;
+                        best_point = Vec3T<C>(lanes.px[lane], lanes.py[lane], lanes.pz[lane]);
+                        best_bary = Vec3T<C>(lanes.b0[lane], lanes.b1[lane], lanes.b2[lane]);
+                        best_dist2 = lanes.dist2[lane];
+                        prune_dist2 = best_dist2;
+                    }
+                    continue;
+                }
 
-            auto [prim_point, prim_bary] = closest_point_tri(qp, tris[triIdx]);
-            auto prim_vec = prim_point - qp;
-            auto prim_dist2 = bvh::v2::dot(prim_vec, prim_vec);
-            if (prim_dist2 < best_dist2) {
-                best_prim_idx = triIdx;
-                best_point = prim_point;
-                best_bary = prim_bary;
-                best_dist2 = prim_dist2;
+                for (size_t i = 0; i < count; ++i) {
+                    consider(
+                        chunk + i, lanes.ndot[i],
+                        Vec3T<C>(lanes.px[i], lanes.py[i], lanes.pz[i]),
+                        Vec3T<C>(lanes.b0[i], lanes.b1[i], lanes.b2[i]),
+                        lanes.dist2[i]
+                    );
+                }
             }
         }
-	return true;
     };
 
-    bvh::v2::SmallStack<Bvh::Index, stack_size> nodeStack;
-    bvh.traverse_top_down<false>(bvh.get_root().index, nodeStack, leafFunc, innerFunc);
+    // Start out with the seed so the traversal prunes against it from the
+    // beginning.  It gets tested again in its own leaf, but that can't change anything
+    if constexpr (!promote) {
+        if (seedSlot < packed.size()) {
+            leafKernel(packed, seedSlot, 1, qp, norm, cosTol, lanes);
+            if (!(lanes.ndot[0] < cosTol) && lanes.dist2[0] < best_dist2) {
+                best_prim_idx = seedSlot;
+                best_point = Vec3T<C>(lanes.px[0], lanes.py[0], lanes.pz[0]);
+                best_bary = Vec3T<C>(lanes.b0[0], lanes.b1[0], lanes.b2[0]);
+                best_dist2 = lanes.dist2[0];
+                bestOnAngleEdge = lanes.ndot[0] < cosTol + ambiguityTol;
+                prune_dist2 = best_dist2;
+                if (checkAmbiguity) {
+                    C reach = std::sqrt(best_dist2) + slack(best_dist2);
+                    prune_dist2 = reach * reach;
+                }
+            }
+        }
+    }
+
+    traverse_nearest(bvh, qp, prune_dist2, localStats, cone_reject, leafFunc);
+
+    if (checkAmbiguity) {
+        C reach = std::sqrt(best_dist2) + slack(best_dist2);
+        nearAngleReject = near_reject_dist2 <= reach * reach;
+        *ambiguous = (best_prim_idx != invalid_id) && (
+            (rival_dist2 <= reach * reach && far_apart(rival_point, best_point)) ||
+            bestOnAngleEdge || nearAngleReject
+        );
+    }
+
+    // The search works in leaf order, so map back to the original triangle
+    if (hitSlot != nullptr) *hitSlot = best_prim_idx;
+    if (best_prim_idx != invalid_id) best_prim_idx = bvh.prim_ids[best_prim_idx];
+
+    if (stats != nullptr) {
+        localStats.queries = 1;
+        localStats.misses = (best_prim_idx == invalid_id) ? 1 : 0;
+        stats->merge(localStats);
+    }
 
-    //std::cout << "Closest TriIdx " << best_prim_idx << std::endl;
-    //std::cout << "Closest Bary" << best_bary[0] << ", " << best_bary[1] << ", " << best_bary[2] << std::endl;
-    //std::cout << "Closest Point" << best_point[0] << ", " << best_point[1] << ", " << best_point[2] << std::endl;
     return std::make_tuple(best_point, best_prim_idx, best_bary);
 }
 
-#endif
+// The query indices sorted along a Morton curve through their bounding box
+template <typename T>
+void morton_order(bvh::v2::ThreadPool& thread_pool, const std::vector<Vec3T<T>>& pts, std::vector<Index>& order) {
+    std::vector<std::pair<uint64_t, uint32_t>> keyed;
+    morton_codes(thread_pool, pts, keyed);
+    order.resize(pts.size());
+    for (size_t i = 0; i < keyed.size(); ++i) order[i] = keyed[i].second;
+}
+
+// Answer the queries listed in order at one angle tolerance, in fixed size
+// packets of that order.  Each query is seeded with the answer of the one
+// before it in its packet
+template <typename T>
+static void closest_pass(
+    bvh::v2::ThreadPool& thread_pool,
+    const WideBvhT<T>& bvh,
+    const std::vector<TriT<T>>& tris,
+    const PackedTrisT<T>& packed,
+    const std::vector<NormalConeT<T>>& cones,
+
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& norms,
+    double angle,
+    const std::vector<Index>& order,
+    const QueryOptions& options,
+    QueryResult& result
+){
+    static constexpr bool isFloat = std::is_same_v<T, float>;
+    // Queries per packet.  Small enough that the neighbors are still close
+    // by, and big enough to amortize walking into a new part of the tree
+    static constexpr size_t packetSize = 32;
+    // How much a progressive search widens after each miss
+    static constexpr T widenStep = T(4);
+    bool refine = isFloat && options.refineTol > 0.0;
+
+    // A progressive search starts from the distance the last query in the
+    // packet found, but never below a small fraction of the whole target
+    // Past the size of the whole target there's nothing left to narrow, so
+    // it goes straight to the full search.  A max distance already bounds
+    // the search, and widening up to it only costs more, so that turns it off
+    T limit = static_cast<T>(std::max(options.maxDistance, 0.0));
+    T startRadius = T(0), cap = T(0);
+    bool progressive = options.progressive && limit == T(0);
+    if (progressive && !bvh.nodes.empty()) {
+        T diag = bvh::v2::length(bvh.get_bbox().get_diagonal());
+        startRadius = diag / T(256);
+        cap = diag;
+        progressive = startRadius > T(0) && std::isfinite(diag);
+    }
+
+    // The double re-run of an ambiguous query has nothing to refine
+    QueryOptions refineOptions;
+    refineOptions.maxDistance = options.maxDistance;
+
+    std::mutex statsMutex;
+    size_t numPackets = (order.size() + packetSize - 1) / packetSize;
+    bvh::v2::ParallelExecutor executor(thread_pool);
+    executor.for_each(0, numPackets, [&] (size_t packetBegin, size_t packetEnd) {
+        QueryStats chunkStats;
+        for (size_t packet = packetBegin; packet < packetEnd; ++packet) {
+            size_t begin = packet * packetSize;
+            size_t end = std::min(begin + packetSize, order.size());
+            QueryOptions queryOptions = options;
+            queryOptions.seedSlot = InvalidIndex;
+            T lastDist = T(0);
+            for (size_t k = begin; k < end; ++k) {
+                size_t i = order[k];
+                bool ambiguous = false;
+                Index hit = InvalidIndex;
+                auto query = [&](T radius, QueryStats* queryStats) {
+                    queryOptions.maxDistance = radius;
+                    return get_closest<T, T>(
+                        bvh, tris, packed, cones,
+                        qps[i], norms[i], static_cast<T>(angle), queryOptions, queryStats,
+                        refine ? &ambiguous : nullptr, &hit
+                    );
+                };
+
+                LocationT<T> found;
+                if (progressive) {
+                    // Anything found within a radius is the closest there is,
+                    // so a narrow search that hits is already the answer
+                    QueryStats queryStats;
+                    T radius = std::max(startRadius, lastDist * T(2));
+                    bool missed = false;
+                    for (; radius < cap; radius *= widenStep) {
+                        found = query(radius, &queryStats);
+                        if (std::get<1>(found) != InvalidIndex) break;
+                        missed = true;
+                    }
+                    if (!(radius < cap)) {
+                        found = query(limit, &queryStats);
+                        if (missed) {
+                            result.widened[i] = 1;
+                            queryStats.widened = 1;
+                        }
+                    }
+                    // Every narrower attempt counted itself as a query and a miss
+                    queryStats.queries = 1;
+                    queryStats.misses = (std::get<1>(found) == InvalidIndex) ? 1 : 0;
+                    chunkStats.merge(queryStats);
+                }
+                else {
+                    found = query(limit, &chunkStats);
+                }
+                auto [cpom, triIdx, bary] = found;
+                if (hit != InvalidIndex) {
+                    if (options.coherent) queryOptions.seedSlot = hit;
+                    lastDist = bvh::v2::length(cpom - qps[i]);
+                }
+
+                if (ambiguous) {
+                    // Too close to call in float, so ask again in double
+                    auto [dcpom, dtriIdx, dbary] = get_closest<T, double>(
+                        bvh, tris, packed, cones,
+                        vec_cast<double>(qps[i]), vec_cast<double>(norms[i]), angle, refineOptions
+                    );
+                    result.triIdxs[i] = dtriIdx;
+                    result.barys[i] = dbary;
+                    chunkStats.refined++;
+                    continue;
+                }
+                result.triIdxs[i] = triIdx;
+                result.barys[i] = vec_cast<double>(bary);
+            }
+        }
+        std::lock_guard<std::mutex> lock(statsMutex);
+        result.stats.merge(chunkStats);
+    });
+}
+
+template <typename T>
+void get_closest_batch(
+    bvh::v2::ThreadPool& thread_pool,
+    const WideBvhT<T>& bvh,
+    const std::vector<TriT<T>>& tris,
+    const PackedTrisT<T>& packed,
+    const std::vector<NormalConeT<T>>& cones,
+
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& norms,
+    double angle,
+    QueryResult& result,
+    const QueryOptions& options
+){
+    result.triIdxs.resize(qps.size());
+    result.barys.resize(qps.size());
+    result.widened.assign(qps.size(), 0);
+    result.stats = QueryStats();
+
+    std::vector<Index> order;
+    if (options.coherent) {
+        morton_order(thread_pool, qps, order);
+    }
+    else {
+        order.resize(qps.size());
+        std::iota(order.begin(), order.end(), Index(0));
+    }
+
+    closest_pass(thread_pool, bvh, tris, packed, cones, qps, norms, angle, order, options, result);
+
+    result.tiers.resize(qps.size());
+    for (size_t i = 0; i < qps.size(); ++i) {
+        result.tiers[i] = (result.triIdxs[i] != InvalidIndex) ? int8_t(0) : int8_t(-1);
+    }
+    const FallbackTolerances* fallbacks = options.fallbacks;
+    if (fallbacks == nullptr) return;
+
+    // Usually only a few queries miss, so each looser tolerance just asks
+    // again for the ones still missing.  They stay in the order they were
+    // in, so the packets are still coherent
+    std::vector<Index> missed;
+    for (Index i : order) {
+        if (result.triIdxs[i] == InvalidIndex) missed.push_back(i);
+    }
+    QueryStats stats = result.stats;
+    size_t rescued = 0;
+    for (size_t k = 0; k < std::min(fallbacks->count, kMaxFallbacks) && !missed.empty(); ++k) {
+        // The extra walks count, but these are still the same queries
+        result.stats = QueryStats();
+        closest_pass(thread_pool, bvh, tris, packed, cones, qps, norms, fallbacks->angles[k], missed, options, result);
+        result.stats.queries = 0;
+        result.stats.misses = 0;
+        result.stats.widened = 0;
+        stats.merge(result.stats);
+
+        size_t kept = 0;
+        for (Index i : missed) {
+            if (result.triIdxs[i] == InvalidIndex) {
+                missed[kept++] = i;
+                continue;
+            }
+            result.tiers[i] = static_cast<int8_t>(k + 1);
+            ++rescued;
+        }
+        missed.resize(kept);
+    }
+    stats.misses -= rescued;
+    stats.fallbacks += rescued;
+    result.stats = stats;
+}
+
+
+template <typename T>
+size_t get_closest_k(
+    const WideBvhT<T>& bvh,
+    const PackedTrisT<T>& packed,
+    const std::vector<NormalConeT<T>>& cones,
+
+    Vec3T<T> qp,
+    Vec3T<T> norm,
+    T angle,
+    size_t count,
+    T radius,
+    NeighborT<T>* out,
+    QueryStats* stats
+){
+    count = std::min(count, kMaxNeighbors);
+    if (count == 0 || packed.empty()) return 0;
+
+    T cosTol = (angle >= std::numbers::pi) ? T(-2.0) : std::cos(angle);
+    T limit2 = (radius > 0) ? radius * radius : std::numeric_limits<T>::max();
+
+    // A max-heap on distance, so the farthest one kept is always on top
+    struct Candidate {
+        T dist2;
+        Index slot;
+        Vec3T<T> bary;
+        bool operator<(const Candidate& o) const { return dist2 < o.dist2; }
+    };
+    std::array<Candidate, kMaxNeighbors> heap;
+    size_t heapSize = 0;
+    T prune_dist2 = limit2;
+
+    QueryStats localStats;
+    LeafKernelFn<T> leafKernel = get_leaf_kernel<T>();
+    LeafLanes<T> lanes;
+
+    // The same cone test as get_closest, without the ambiguity slack
+    bool useCones = !cones.empty() && cosTol > T(-1);
+    T coneTol = useCones ? std::acos(cosTol) : T(0);
+    T coneTolCos = std::cos(coneTol);
+    T coneTolSin = std::sin(coneTol);
+    auto cone_reject = [&](size_t slot) {
+        if (!useCones) return false;
+        const auto& cone = cones[slot];
+        T sinSum = coneTolSin * cone.cosAngle + coneTolCos * cone.sinAngle;
+        if (sinSum <= 0) return false;
+        T cosSum = coneTolCos * cone.cosAngle - coneTolSin * cone.sinAngle;
+        return bvh::v2::dot(norm, cone.axis) < cosSum;
+    };
+
+    auto leafFunc = [&](size_t begin, size_t end) {
+        for (Index chunk = begin; chunk < end; chunk += kLeafLanes) {
+            size_t lanesUsed = std::min<size_t>(kLeafLanes, end - chunk);
+            leafKernel(packed, chunk, lanesUsed, qp, norm, cosTol, lanes);
+            for (size_t i = 0; i < lanesUsed; ++i) {
+                if (lanes.ndot[i] < cosTol) {
+                    localStats.angleRejects++;
+                    continue;
+                }
+                localStats.triTests++;
+                T dist2 = lanes.dist2[i];
+                if (!(dist2 < prune_dist2)) continue;
+
+                if (heapSize == count) {
+                    std::pop_heap(heap.begin(), heap.begin() + heapSize);
+                    --heapSize;
+                }
+                heap[heapSize++] = Candidate{dist2, chunk + i, Vec3T<T>(lanes.b0[i], lanes.b1[i], lanes.b2[i])};
+                std::push_heap(heap.begin(), heap.begin() + heapSize);
+                if (heapSize == count) prune_dist2 = heap[0].dist2;
+            }
+        }
+    };
+
+    traverse_nearest(bvh, qp, prune_dist2, localStats, cone_reject, leafFunc);
+
+    std::sort_heap(heap.begin(), heap.begin() + heapSize);
+    for (size_t i = 0; i < heapSize; ++i) {
+        out[i].triIdx = bvh.prim_ids[heap[i].slot];
+        out[i].bary = heap[i].bary;
+        out[i].dist2 = heap[i].dist2;
+    }
+
+    if (stats != nullptr) {
+        localStats.queries = 1;
+        localStats.misses = (heapSize == 0) ? 1 : 0;
+        stats->merge(localStats);
+    }
+    return heapSize;
+}
+
+template <typename T>
+void get_closest_k_batch(
+    bvh::v2::ThreadPool& thread_pool,
+    const WideBvhT<T>& bvh,
+    const PackedTrisT<T>& packed,
+    const std::vector<NormalConeT<T>>& cones,
+
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& norms,
+    double angle,
+    size_t k,
+    double radius,
+
+    std::vector<Index>& triIdxs,
+    std::vector<Vec3>& barys,
+    std::vector<double>& weights,
+    QueryStats* stats
+){
+    static constexpr size_t packetSize = 32;
+    k = std::clamp<size_t>(k, 1, kMaxNeighbors - 1);
+
+    triIdxs.assign(qps.size() * k, InvalidIndex);
+    barys.assign(qps.size() * k, Vec3(0.0));
+    weights.assign(qps.size() * k, 0.0);
+
+    // Walk the queries in Morton order so neighboring ones share a path down the tree
+    std::vector<Index> order;
+    morton_order(thread_pool, qps, order);
+
+    std::mutex statsMutex;
+    size_t numPackets = (qps.size() + packetSize - 1) / packetSize;
+    bvh::v2::ParallelExecutor executor(thread_pool);
+    executor.for_each(0, numPackets, [&] (size_t packetBegin, size_t packetEnd) {
+        QueryStats chunkStats;
+        QueryStats* chunkStatsPtr = (stats != nullptr) ? &chunkStats : nullptr;
+        std::array<NeighborT<T>, kMaxNeighbors> found;
+        for (size_t q = packetBegin * packetSize; q < std::min(packetEnd * packetSize, qps.size()); ++q) {
+            size_t i = order[q];
+            // One more than is kept, to know where the weights fall off to zero
+            size_t n = get_closest_k(
+                bvh, packed, cones, qps[i], norms[i], static_cast<T>(angle), k + 1, static_cast<T>(radius),
+                found.data(), chunkStatsPtr
+            );
+            if (n == 0) continue;
+
+            size_t kept = std::min(n, k);
+            double falloff;
+            if (n > k) falloff = std::sqrt((double)found[k].dist2);
+            else if (radius > 0.0) falloff = radius;
+            else falloff = 2.0 * std::sqrt((double)found[kept - 1].dist2);
+
+            double total = 0.0;
+            double w[kMaxNeighbors];
+            for (size_t j = 0; j < kept; ++j) {
+                double d = std::sqrt((double)found[j].dist2);
+                double t = (falloff > 0.0) ? std::max(0.0, 1.0 - d / falloff) : 0.0;
+                w[j] = t * t;
+                total += w[j];
+            }
+            for (size_t j = 0; j < kept; ++j) {
+                // Everything tied with the next one gets an even share
+                double weight = (total > 0.0) ? w[j] / total : 1.0 / (double)kept;
+                triIdxs[i * k + j] = found[j].triIdx;
+                barys[i * k + j] = vec_cast<double>(found[j].bary);
+                weights[i * k + j] = weight;
+            }
+        }
+        if (stats != nullptr) {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            stats->merge(chunkStats);
+        }
+    });
+}
+
+#define CPOM_INSTANTIATE(T) \
+    template WideBvhT<T> build_bvh<T>(bvh::v2::ThreadPool&, const std::vector<TriT<T>>&, PackedTrisT<T>&, std::vector<NormalConeT<T>>&, size_t, BuildStrategy); \
+    template void refit_bvh<T>(bvh::v2::ThreadPool&, WideBvhT<T>&, const std::vector<TriT<T>>&, PackedTrisT<T>&, std::vector<NormalConeT<T>>&); \
+    template void pack_tris<T, uint32_t>(bvh::v2::ThreadPool&, const std::vector<uint32_t>&, const std::vector<TriT<T>>&, PackedTrisT<T>&); \
+    template void build_cones<T>(const WideBvhT<T>&, const PackedTrisT<T>&, std::vector<NormalConeT<T>>&); \
+    template LocationT<T> get_closest<T, T>(const WideBvhT<T>&, const std::vector<TriT<T>>&, const PackedTrisT<T>&, const std::vector<NormalConeT<T>>&, Vec3T<T>, Vec3T<T>, T, const QueryOptions&, QueryStats*, bool*, Index*); \
+    template void get_closest_batch<T>(bvh::v2::ThreadPool&, const WideBvhT<T>&, const std::vector<TriT<T>>&, const PackedTrisT<T>&, const std::vector<NormalConeT<T>>&, const std::vector<Vec3T<T>>&, const std::vector<Vec3T<T>>&, double, QueryResult&, const QueryOptions&); \
+    template size_t get_closest_k<T>(const WideBvhT<T>&, const PackedTrisT<T>&, const std::vector<NormalConeT<T>>&, Vec3T<T>, Vec3T<T>, T, size_t, T, NeighborT<T>*, QueryStats*); \
+    template void get_closest_k_batch<T>(bvh::v2::ThreadPool&, const WideBvhT<T>&, const PackedTrisT<T>&, const std::vector<NormalConeT<T>>&, const std::vector<Vec3T<T>>&, const std::vector<Vec3T<T>>&, double, size_t, double, std::vector<Index>&, std::vector<Vec3>&, std::vector<double>&, QueryStats*);
+
+CPOM_INSTANTIATE(float)
+CPOM_INSTANTIATE(double)
+template LocationT<double> get_closest<float, double>(const WideBvhT<float>&, const std::vector<TriT<float>>&, const PackedTrisT<float>&, const std::vector<NormalConeT<float>>&, Vec3T<double>, Vec3T<double>, double, const QueryOptions&, QueryStats*, bool*, Index*);
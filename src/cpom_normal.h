@@ -10,32 +10,212 @@
 #include "bvh/v2/vec.h"
 #include "bvh/v2/tri.h"
 #include "bvh/v2/bbox.h"
+#include "bvh/v2/thread_pool.h"
 
 #include "cpom_types.h"
 #include "dist_point_triangle.h"
+#include "leaf_kernel.h"
 
-BVH_ALWAYS_INLINE Vec3 get_normal(const Tri &tri);
+// These are explicitly instantiated for float and double in cpom_normal.cpp
 
-template <typename T, int N>
-BVH_ALWAYS_INLINE bvh::v2::Vec<T, N> vec_to_closest(const BBox& bbox, const bvh::v2::Vec<T, N>& p);
+// Build the wide bvh, along with the triangles packed into leaf order and a
+// normal cone for each child of its nodes.  The boxes and centers the builder
+// needs only live until the tree is collapsed
+// Leaves hold at most maxLeafSize triangles (and never more than 255).
+// The default matches the leaf kernel width
+template <typename T>
+WideBvhT<T> build_bvh(
+    bvh::v2::ThreadPool& thread_pool,
+    const std::vector<TriT<T>>& tris,
+    PackedTrisT<T>& packed,
+    std::vector<NormalConeT<T>>& cones,
+    size_t maxLeafSize = kLeafLanes,
+    BuildStrategy strategy = BuildStrategy::Sah
+);
+
+// Auto builds targets with more triangles than this with the Lbvh builder.
+// Below it a Sah build is quick enough to redo on every edit
+static constexpr size_t kLbvhAutoTris = 200000;
+
+// The builder a strategy ends up using for this many triangles
+BuildStrategy resolve_build_strategy(BuildStrategy strategy, size_t triCount);
+
+// Update the bounds of an existing bvh in place after the triangles moved
+// The triangle count and order must match what the bvh was built from
+template <typename T>
+void refit_bvh(
+    bvh::v2::ThreadPool& thread_pool,
+    WideBvhT<T>& bvh,
+    const std::vector<TriT<T>>& tris,
+    PackedTrisT<T>& packed,
+    std::vector<NormalConeT<T>>& cones
+);
+
+// Copy the triangles into bvh leaf order with their edges and normals
+// Slot i of packed is the triangle tris[primIds[i]]
+template <typename T, typename I>
+void pack_tris(
+    bvh::v2::ThreadPool& thread_pool,
+    const std::vector<I>& primIds,
+    const std::vector<TriT<T>>& tris,
+    PackedTrisT<T>& packed
+);
 
-Bvh build_bvh(
-    const std::vector<Tri>& tris,
-    std::vector<BBox>& bboxes,
-    std::vector<Vec3>& centers,
-    std::vector<Vec3>& normals
+// Fill one normal cone per child of every bvh node, at node * kWideArity + child
+template <typename T>
+void build_cones(
+    const WideBvhT<T>& bvh,
+    const PackedTrisT<T>& packed,
+    std::vector<NormalConeT<T>>& cones
 );
 
-Location get_closest(
-    const Bvh& bvh,
-    const std::vector<Tri>& tris,
-    const std::vector<BBox>& bboxes,
-    const std::vector<Vec3>& centers,
-    const std::vector<Vec3>& normals,
+// The most looser tolerances a query can fall back on
+static constexpr size_t kMaxFallbacks = 3;
+
+// Looser angle tolerances (radians, loosest last) for a query that finds
+// nothing facing within its own.  Pi or more takes any triangle at all
+struct FallbackTolerances {
+    double angles[kMaxFallbacks] = {};
+    size_t count = 0;
+};
+
+// How a query searches, besides its point, normal and angle tolerance.
+// get_closest reads maxDistance, refineTol and seedSlot, and get_closest_batch
+// reads everything but seedSlot, which it fills in itself
+struct QueryOptions {
+    // Above zero, nothing farther away than this is looked at, and nothing
+    // within it is a miss
+    double maxDistance = 0.0;
+    // For float structures, how close (relative) another triangle can come to
+    // the answer before it's too close to call, and worth asking again in double
+    double refineTol = 0.0;
+    // A packed slot to test before anything else (like the answer for a nearby
+    // query), so the traversal starts out with a tight bound
+    Index seedSlot = InvalidIndex;
+    // Walk the queries in Morton order, in packets seeded from within
+    bool coherent = true;
+    // Search a small radius first and only widen on a miss.  Ignored with a
+    // max distance, which bounds the search better on its own
+    bool progressive = false;
+    // Looser tolerances for the queries that miss, or null
+    const FallbackTolerances* fallbacks = nullptr;
+};
+
+// What get_closest_batch found, with one entry per query in each array
+struct QueryResult {
+    std::vector<Index> triIdxs;  // InvalidIndex for a miss
+    std::vector<Vec3> barys;
+    // 1 for each progressive query that missed everything short of the full search
+    std::vector<unsigned char> widened;
+    // 0 for a hit at the angle, k for one at the k-th fallback, and -1 for a miss
+    std::vector<int8_t> tiers;
+    QueryStats stats;  // Every query counts once, whatever it took
+};
+
+// T is the type the structure is stored in, and C is the type the query is
+// computed in.  Querying a float structure with C = double gives the same
+// answer as a double structure built from the same float points.
+// That reads the original tris, and otherwise only the packed ones are touched.
+// If ambiguous is given, a float query sets it when the result is too close
+// to call at that precision: another triangle is within options.refineTol
+// (relative) of the best distance, or a nearby triangle is right on the angle
+// tolerance
+// Any node whose normal cone can't come within the angle of the query normal
+// gets skipped entirely.  Pass empty cones to test only at the triangles
+// The seed slot only speeds things up.  hitSlot gets the packed slot of the answer
+template <typename T, typename C = T>
+LocationT<C> get_closest(
+    const WideBvhT<T>& bvh,
+    const std::vector<TriT<T>>& tris,
+    const PackedTrisT<T>& packed,
+    const std::vector<NormalConeT<T>>& cones,
+
+    Vec3T<C> qp,
+    Vec3T<C> norm,
+    C angle,
+    const QueryOptions& options = QueryOptions(),
+    QueryStats* stats = nullptr,
+    bool* ambiguous = nullptr,
+    Index* hitSlot = nullptr
+);
+
+// Run get_closest for every query point, splitting the queries across the pool
+// With coherent on, the queries are walked in Morton order in fixed size packets,
+// and each one is seeded with the answer of the one before it in its packet.
+// The packets don't depend on the thread count, and the results are written back
+// in the original order, so the output is the same however the work gets chunked
+// For float structures, a refineTol above zero re-runs the ambiguous queries in double
+// The answers are the same with progressive on or off, and with fallbacks,
+// the queries that miss are asked again at each looser tolerance in turn
+template <typename T>
+void get_closest_batch(
+    bvh::v2::ThreadPool& thread_pool,
+    const WideBvhT<T>& bvh,
+    const std::vector<TriT<T>>& tris,
+    const PackedTrisT<T>& packed,
+    const std::vector<NormalConeT<T>>& cones,
+
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& norms,
+    double angle,
+    QueryResult& result,
+    const QueryOptions& options = QueryOptions()
+);
+
+// The most triangles one get_closest_k query keeps
+static constexpr size_t kMaxNeighbors = 9;
+
+// One of the triangles found by get_closest_k
+template <typename T>
+struct NeighborT {
+    Index triIdx = InvalidIndex;
+    Vec3T<T> bary;
+    T dist2 = 0;
+};
+
+// Like get_closest, but keeps up to count of the nearest triangles facing
+// within the angle instead of only the closest one.  The candidates are held
+// in a bounded max-heap, so the traversal prunes against the farthest one kept
+// once it's full.  A radius above zero also drops anything farther than that
+// radius.  out is filled nearest first, and the number found is returned
+template <typename T>
+size_t get_closest_k(
+    const WideBvhT<T>& bvh,
+    const PackedTrisT<T>& packed,
+    const std::vector<NormalConeT<T>>& cones,
+
+    Vec3T<T> qp,
+    Vec3T<T> norm,
+    T angle,
+    size_t count,
+    T radius,
+    NeighborT<T>* out,
+    QueryStats* stats = nullptr
+);
+
+// Bind every query point to its k nearest triangles for a smoothed wrap.
+// Each query gets k entries in a row of triIdxs, barys and weights, nearest
+// first, with InvalidIndex and a zero weight filling any that weren't found
+// The weights sum to 1 and fall off to zero at the next nearest triangle (or
+// the radius), so a triangle enters or leaves the blend with no weight at all
+// k is at most kMaxNeighbors - 1.  Float structures are not refined in double
+template <typename T>
+void get_closest_k_batch(
+    bvh::v2::ThreadPool& thread_pool,
+    const WideBvhT<T>& bvh,
+    const PackedTrisT<T>& packed,
+    const std::vector<NormalConeT<T>>& cones,
+
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& norms,
+    double angle,
+    size_t k,
+    double radius,
 
-    Vec3 qp,
-    Vec3 norm,
-    Scalar angle
+    std::vector<Index>& triIdxs,
+    std::vector<Vec3>& barys,
+    std::vector<double>& weights,
+    QueryStats* stats = nullptr
 );
 
 #endif
@@ -2,6 +2,10 @@
 #define CPOM_TYPES_H
 
 #include <tuple>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <cstring>
 
 #include "bvh/v2/vec.h"
 #include "bvh/v2/tri.h"
@@ -9,14 +13,178 @@
 #include "bvh/v2/node.h"
 #include "bvh/v2/bvh.h"
 
+// Everything is templated on the scalar type so the engine can run in float
+// straight off of Maya's raw points, or in double.
+template <typename T> using Vec3T     = bvh::v2::Vec<T, 3>;
+template <typename T> using TriT      = bvh::v2::Tri<T, 3>;
+template <typename T> using BBoxT     = bvh::v2::BBox<T, 3>;
+template <typename T> using NodeT     = bvh::v2::Node<T, 3>;
+template <typename T> using BvhT      = bvh::v2::Bvh<NodeT<T>>;
+template <typename T> using LocationT = std::tuple<Vec3T<T>, size_t, Vec3T<T>>;
+
 using Scalar   = double;
 using Index    = size_t;
-using Vec3     = bvh::v2::Vec<Scalar, 3>;
-using Tri      = bvh::v2::Tri<Scalar, 3>;
-using BBox     = bvh::v2::BBox<Scalar, 3>;
-using Node     = bvh::v2::Node<Scalar, 3>;
-using Bvh      = bvh::v2::Bvh<Node>;
-using Location = std::tuple<Vec3, Index, Vec3>;
+inline constexpr Index InvalidIndex = std::numeric_limits<Index>::max();
+using Vec3     = Vec3T<Scalar>;
+using Tri      = TriT<Scalar>;
+using BBox     = BBoxT<Scalar>;
+using Node     = NodeT<Scalar>;
+using Bvh      = BvhT<Scalar>;
+using Location = LocationT<Scalar>;
 
-#endif
+// The bvh as it's kept for queries.  The binary tree from the builder is
+// collapsed into 4-wide nodes, and each child's bounds are stored as 8 bit
+// offsets from the node's origin in steps of a power of two per axis.  Those
+// are always rounded outward, so a child's box holds everything its exact box
+// does, and the queries find exactly the same triangles.  One node fills
+// one cache line, where the same children took three 56 byte binary nodes
+static constexpr size_t kWideArity = 4;
+
+struct alignas(64) WideNode {
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t childCount;               // Children in use, always the first ones
+    uint8_t lo[3][kWideArity];        // Child bounds per axis: origin + q * 2^exponent
+    uint8_t hi[3][kWideArity];
+    uint32_t child[kWideArity];       // Node index of an inner child, or the first packed slot of a leaf
+    uint8_t primCount[kWideArity];    // Triangles in a leaf child, 0 for an inner child
+};
+static_assert(sizeof(WideNode) == 64);
+
+// 2^e in T, put together from the bits since ldexp is slow
+template <typename T>
+inline T pow2(int e) {
+    if constexpr (sizeof(T) == 4) {
+        uint32_t bits = (uint32_t)(e + 127) << 23;
+        T ret;
+        std::memcpy(&ret, &bits, sizeof(T));
+        return ret;
+    }
+    else {
+        uint64_t bits = (uint64_t)(e + 1023) << 52;
+        T ret;
+        std::memcpy(&ret, &bits, sizeof(T));
+        return ret;
+    }
+}
+
+template <typename T>
+struct WideBvhT {
+    std::vector<WideNode> nodes;      // The root is nodes[0], and children come after their parents
+    std::vector<uint32_t> prim_ids;   // Packed slot to original triangle
+
+    bool empty() const { return nodes.empty(); }
+
+    // The conservative box of one child, in any precision
+    template <typename C = T>
+    BBoxT<C> child_bbox(const WideNode& node, size_t c) const {
+        BBoxT<C> ret;
+        for (int a = 0; a < 3; ++a) {
+            C scale = pow2<C>(node.exponent[a]);
+            ret.min[a] = static_cast<C>(node.origin[a]) + static_cast<C>(node.lo[a][c]) * scale;
+            ret.max[a] = static_cast<C>(node.origin[a]) + static_cast<C>(node.hi[a][c]) * scale;
+        }
+        return ret;
+    }
+
+    // Bounds around everything in the tree
+    BBoxT<T> get_bbox() const {
+        auto ret = BBoxT<T>::make_empty();
+        if (nodes.empty()) return ret;
+        for (size_t c = 0; c < nodes[0].childCount; ++c) ret.extend(child_bbox(nodes[0], c));
+        return ret;
+    }
+};
+
+// The triangles as the closest point query wants them: a corner, the two
+// edges off of it, and the unit face normal.  They're kept in bvh leaf order
+// so a leaf's triangles sit next to each other, with one plane per component
+// so the leaf kernel can load several triangles at once.  Every plane has
+// some zeroed padding at the end so a full width load never reads past it
+template <typename T>
+struct PackedTrisT {
+    enum Plane { P0X, P0Y, P0Z, E1X, E1Y, E1Z, E2X, E2Y, E2Z, NX, NY, NZ, PlaneCount };
+    static constexpr size_t pad = 8;
+
+    size_t count = 0;
+    size_t stride = 0;
+    std::vector<T> data;
 
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    void resize(size_t n) {
+        if (n + pad != stride) data.assign((n + pad) * PlaneCount, T(0));
+        count = n;
+        stride = n + pad;
+    }
+    void clear() {
+        count = 0;
+        stride = 0;
+        data.clear();
+    }
+
+    T* plane(int p) { return data.data() + p * stride; }
+    const T* plane(int p) const { return data.data() + p * stride; }
+
+    // Read or write the 3 planes starting at p as a vector
+    Vec3T<T> get(int p, size_t i) const {
+        return Vec3T<T>(plane(p)[i], plane(p + 1)[i], plane(p + 2)[i]);
+    }
+    void set(int p, size_t i, const Vec3T<T>& v) {
+        plane(p)[i] = v[0];
+        plane(p + 1)[i] = v[1];
+        plane(p + 2)[i] = v[2];
+    }
+};
+
+// Bounds the face normals under a bvh node: every normal is within
+// the half angle of the axis.  A half angle of pi bounds everything
+template <typename T>
+struct NormalConeT {
+    Vec3T<T> axis;
+    T cosAngle = T(-1);
+    T sinAngle = T(0);
+};
+
+enum class Precision {
+    Double = 0,
+    Float = 1,
+};
+
+// How the bvh gets built.  Sah sweeps for the best split at every node, and
+// Lbvh just sorts the triangles along a Morton curve and splits on the bits,
+// which builds much faster for somewhat slower queries
+enum class BuildStrategy {
+    Auto = 0,  // Picked by triangle count
+    Sah = 1,
+    Lbvh = 2,
+};
+
+// Traversal counters, summed over however many queries were run
+struct QueryStats {
+    size_t queries = 0;
+    size_t nodesVisited = 0;   // Nodes whose bounds were checked against the query
+    size_t leavesVisited = 0;
+    size_t triTests = 0;       // Closest point to triangle computations
+    size_t angleRejects = 0;   // Triangles skipped for facing outside the tolerance
+    size_t coneRejects = 0;    // Nodes skipped because none of their triangles face the right way
+    size_t misses = 0;         // Queries that found no triangle at all
+    size_t refined = 0;        // Float queries that were re-run in double
+    size_t widened = 0;        // Progressive queries that fell through to the full search
+    size_t fallbacks = 0;      // Queries answered by a looser fallback tolerance
+
+    void merge(const QueryStats& o) {
+        queries += o.queries;
+        nodesVisited += o.nodesVisited;
+        leavesVisited += o.leavesVisited;
+        triTests += o.triTests;
+        angleRejects += o.angleRejects;
+        coneRejects += o.coneRejects;
+        misses += o.misses;
+        refined += o.refined;
+        widened += o.widened;
+        fallbacks += o.fallbacks;
+    }
+};
+
+#endif
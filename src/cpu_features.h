@@ -0,0 +1,63 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+// The SIMD kernels are only compiled for x86.  Everything else
+// (like the arm half of the mac universal build) uses the scalar paths
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CPOM_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#else
+#define CPOM_X86 0
+#endif
+
+// Lets a single function use AVX2 without building the whole plugin for it
+// MSVC allows the intrinsics anywhere, so it doesn't need the attribute
+#if CPOM_X86 && (defined(__GNUC__) || defined(__clang__))
+#define CPOM_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define CPOM_TARGET_AVX2
+#endif
+
+// The same thing for a whole block of code, templates included.  Only AVX
+// is turned on here (no FMA), so nothing in the block can get contracted
+// into a fused multiply-add and round differently than the scalar code
+#if CPOM_X86 && defined(__clang__)
+#define CPOM_BEGIN_AVX2_BLOCK _Pragma("clang attribute push (__attribute__((target(\"avx2\"))), apply_to = function)")
+#define CPOM_END_AVX2_BLOCK _Pragma("clang attribute pop")
+#elif CPOM_X86 && defined(__GNUC__)
+#define CPOM_BEGIN_AVX2_BLOCK _Pragma("GCC push_options") _Pragma("GCC target(\"avx2\")")
+#define CPOM_END_AVX2_BLOCK _Pragma("GCC pop_options")
+#else
+#define CPOM_BEGIN_AVX2_BLOCK
+#define CPOM_END_AVX2_BLOCK
+#endif
+
+// Runtime check for AVX2 support.  The result is computed once
+inline bool cpu_has_avx2() {
+#if !CPOM_X86
+    return false;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    static const bool has = [] {
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        bool fma = (info[2] & (1 << 12)) != 0;
+        // The OS has to save the ymm registers too
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        if (!fma) return false;
+        if (!osxsave || (_xgetbv(0) & 0x6) != 0x6) return false;
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    }();
+    return has;
+#else
+    static const bool has = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return has;
+#endif
+}
+
+#endif
@@ -0,0 +1,580 @@
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+#include "bvh/v2/thread_pool.h"
+#include "bvh/v2/executor.h"
+
+#include "cpu_features.h"
+#include "deform_kernel.h"
+
+
+void DeformIndex::resize(size_t newCount, size_t newSlots, bool withOffsets) {
+    count = newCount;
+    slots = newSlots;
+    size_t blocks = (count + kBlock - 1) / kBlock;
+    verts.assign(blocks * slots * kBlock, -1);
+    weights.assign(blocks * slots * kBlock, 0.0f);
+    offsets.assign(withOffsets ? blocks * slots * kBlock : 0, 0.0f);
+}
+
+void DeformIndex::clear() {
+    count = 0;
+    verts.clear();
+    weights.clear();
+    offsets.clear();
+}
+
+int DeformIndex::max_vert() const {
+    int ret = -1;
+    for (int v : verts) ret = std::max(ret, v);
+    return ret;
+}
+
+void DeformState::clear() {
+    lastTarget.clear();
+    lastInput.clear();
+    lastOutput.clear();
+    lastWeights.clear();
+    inputFree = false;
+    valid = false;
+}
+
+
+void build_dependents(const DeformIndex& index, size_t numTargetPoints, DeformDependents& dependents) {
+    dependents.numTargetPoints = numTargetPoints;
+    std::vector<int>& depStart = dependents.depStart;
+    std::vector<int>& deps = dependents.deps;
+
+    // Counting sort of (target point, deformed point) pairs by target point
+    // A point that uses the same target point twice just gets listed twice
+    depStart.assign(numTargetPoints + 1, 0);
+    for (size_t i = 0; i < index.size(); ++i) {
+        for (size_t s = 0; s < index.slots; ++s) {
+            int v = index.vert(i, s);
+            if (v >= 0) ++depStart[(size_t)v + 1];
+        }
+    }
+    for (size_t t = 0; t < numTargetPoints; ++t) {
+        depStart[t + 1] += depStart[t];
+    }
+
+    deps.resize(depStart[numTargetPoints]);
+    std::vector<int> fill(depStart.begin(), depStart.end() - 1);
+    for (size_t i = 0; i < index.size(); ++i) {
+        for (size_t s = 0; s < index.slots; ++s) {
+            int v = index.vert(i, s);
+            if (v >= 0) deps[fill[v]++] = (int)i;
+        }
+    }
+
+    dependents.unboundChunks.assign((index.size() + kDirtySourceChunk - 1) / kDirtySourceChunk, 0);
+    for (size_t i = 0; i < index.size(); ++i) {
+        if (!index.is_bound(i)) dependents.unboundChunks[i / kDirtySourceChunk] = 1;
+    }
+}
+
+
+static void deform_scalar(
+    const DeformIndex& index,
+    const float* tp,
+    const float* weights,
+    const double m[4][4],
+    float envelope,
+    double* positions,
+    size_t begin,
+    size_t end
+) {
+    for (size_t i = begin; i < end; ++i) {
+        if (!index.is_bound(i)) continue;
+        double s = (weights == nullptr) ? envelope : weights[i] * envelope;
+        if (s == 0.0) continue;
+
+        double px = 0.0, py = 0.0, pz = 0.0;
+        for (size_t k = 0; k < index.slots; ++k) {
+            int v = index.vert(i, k);
+            if (v < 0) continue;
+            const float* T = &tp[3 * v];
+            double w = index.weight(i, k);
+            px += (double)T[0] * w;
+            py += (double)T[1] * w;
+            pz += (double)T[2] * w;
+        }
+
+        // Put the offsets back in the frames of the triangles as they are now
+        if (index.has_offsets()) {
+            for (size_t k = 0; k + 2 < index.slots; k += 3) {
+                if (index.vert(i, k) < 0) continue;
+                double c[3][3], t[3], b[3], n[3];
+                for (size_t j = 0; j < 3; ++j) {
+                    const float* T = &tp[3 * index.vert(i, k + j)];
+                    c[j][0] = T[0];
+                    c[j][1] = T[1];
+                    c[j][2] = T[2];
+                }
+                triangle_frame(c[0], c[1], c[2], t, b, n);
+                double ot = index.offsets[index.at(i, k + 0)];
+                double ob = index.offsets[index.at(i, k + 1)];
+                double on = index.offsets[index.at(i, k + 2)];
+                px += t[0] * ot + b[0] * ob + n[0] * on;
+                py += t[1] * ot + b[1] * ob + n[1] * on;
+                pz += t[2] * ot + b[2] * ob + n[2] * on;
+            }
+        }
+
+        double x = px * m[0][0] + py * m[1][0] + pz * m[2][0] + m[3][0];
+        double y = px * m[0][1] + py * m[1][1] + pz * m[2][1] + m[3][1];
+        double z = px * m[0][2] + py * m[1][2] + pz * m[2][2] + m[3][2];
+
+        // A full weight lands exactly on the target, whatever the input was
+        double* P = &positions[4 * i];
+        if (s == 1.0) {
+            P[0] = x;
+            P[1] = y;
+            P[2] = z;
+            continue;
+        }
+        P[0] += (x - P[0]) * s;
+        P[1] += (y - P[1]) * s;
+        P[2] += (z - P[2]) * s;
+    }
+}
+
+
+#if CPOM_X86
+// One point at a time, with exactly the operations of one lane of the kernel
+// below, for the points before and after its whole blocks.  That way a point
+// gets the same result however the work was split up
+CPOM_TARGET_AVX2 static void deform_fused(
+    const DeformIndex& index,
+    const float* tp,
+    const float* weights,
+    const double m[4][4],
+    float envelope,
+    double* positions,
+    size_t begin,
+    size_t end
+) {
+    const double sliver2 = kSliverSin * kSliverSin;
+    for (size_t i = begin; i < end; ++i) {
+        if (!index.is_bound(i)) continue;
+        double s = (weights == nullptr) ? envelope : weights[i] * envelope;
+
+        double px = 0.0, py = 0.0, pz = 0.0;
+        double qx = 0.0, qy = 0.0, qz = 0.0;
+        for (size_t k = 0; k < index.slots; k += 3) {
+            double c[3][3];
+            for (size_t j = 0; j < 3; ++j) {
+                int v = std::max(index.vert(i, k + j), 0);
+                const float* T = &tp[3 * v];
+                c[j][0] = T[0];
+                c[j][1] = T[1];
+                c[j][2] = T[2];
+                double w = index.weight(i, k + j);
+                px = std::fma(c[j][0], w, px);
+                py = std::fma(c[j][1], w, py);
+                pz = std::fma(c[j][2], w, pz);
+            }
+            if (!index.has_offsets()) continue;
+
+            double ex = c[1][0] - c[0][0], ey = c[1][1] - c[0][1], ez = c[1][2] - c[0][2];
+            double fx = c[2][0] - c[0][0], fy = c[2][1] - c[0][1], fz = c[2][2] - c[0][2];
+            double nx = std::fma(fy, ez, -(fz * ey));
+            double ny = std::fma(fz, ex, -(fx * ez));
+            double nz = std::fma(fx, ey, -(fy * ex));
+            double elen2 = std::fma(ex, ex, std::fma(ey, ey, ez * ez));
+            double flen2 = std::fma(fx, fx, std::fma(fy, fy, fz * fz));
+            double nlen2 = std::fma(nx, nx, std::fma(ny, ny, nz * nz));
+            double einv = (elen2 > 0.0) ? 1.0 / std::sqrt(elen2) : 0.0;
+            double ninv = (nlen2 > sliver2 * elen2 * flen2) ? 1.0 / std::sqrt(nlen2) : 0.0;
+            double tx = ex * einv, ty = ey * einv, tz = ez * einv;
+            nx *= ninv;
+            ny *= ninv;
+            nz *= ninv;
+            double bx = std::fma(ny, tz, -(nz * ty));
+            double by = std::fma(nz, tx, -(nx * tz));
+            double bz = std::fma(nx, ty, -(ny * tx));
+            double ot = index.offsets[index.at(i, k + 0)];
+            double ob = index.offsets[index.at(i, k + 1)];
+            double on = index.offsets[index.at(i, k + 2)];
+            qx = std::fma(tx, ot, std::fma(bx, ob, std::fma(nx, on, qx)));
+            qy = std::fma(ty, ot, std::fma(by, ob, std::fma(ny, on, qy)));
+            qz = std::fma(tz, ot, std::fma(bz, ob, std::fma(nz, on, qz)));
+        }
+        px += qx;
+        py += qy;
+        pz += qz;
+
+        double x = std::fma(px, m[0][0], std::fma(py, m[1][0], std::fma(pz, m[2][0], m[3][0])));
+        double y = std::fma(px, m[0][1], std::fma(py, m[1][1], std::fma(pz, m[2][1], m[3][1])));
+        double z = std::fma(px, m[0][2], std::fma(py, m[1][2], std::fma(pz, m[2][2], m[3][2])));
+
+        double* P = &positions[4 * i];
+        if (s == 1.0) {
+            P[0] = x;
+            P[1] = y;
+            P[2] = z;
+            continue;
+        }
+        P[0] = std::fma(x - P[0], s, P[0]);
+        P[1] = std::fma(y - P[1], s, P[1]);
+        P[2] = std::fma(z - P[2], s, P[2]);
+    }
+}
+
+// Four points per iteration.  The gathers pull the corners straight out of the
+// raw target buffer, and the xyzw positions get transposed in and out of SoA
+CPOM_TARGET_AVX2 static void deform_avx2(
+    const DeformIndex& index,
+    const float* tp,
+    const float* weights,
+    const double m[4][4],
+    float envelope,
+    double* positions,
+    size_t begin,
+    size_t end
+) {
+    const __m256d m00 = _mm256_set1_pd(m[0][0]), m01 = _mm256_set1_pd(m[0][1]), m02 = _mm256_set1_pd(m[0][2]);
+    const __m256d m10 = _mm256_set1_pd(m[1][0]), m11 = _mm256_set1_pd(m[1][1]), m12 = _mm256_set1_pd(m[1][2]);
+    const __m256d m20 = _mm256_set1_pd(m[2][0]), m21 = _mm256_set1_pd(m[2][1]), m22 = _mm256_set1_pd(m[2][2]);
+    const __m256d m30 = _mm256_set1_pd(m[3][0]), m31 = _mm256_set1_pd(m[3][1]), m32 = _mm256_set1_pd(m[3][2]);
+    const __m128 env = _mm_set1_ps(envelope);
+    const __m128i neg = _mm_set1_epi32(-1);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d sliver2 = _mm256_set1_pd(kSliverSin * kSliverSin);
+
+    // Run up to the start of a block, then a whole block at a time
+    size_t i = std::min(end, (begin + DeformIndex::kBlock - 1) / DeformIndex::kBlock * DeformIndex::kBlock);
+    deform_fused(index, tp, weights, m, envelope, positions, begin, i);
+    static_assert(DeformIndex::kBlock == 4);
+    for (; i + 4 <= end; i += 4) {
+        const int* blockVerts = &index.verts[index.at(i, 0)];
+        const float* blockWeights = &index.weights[index.at(i, 0)];
+        const float* blockOffsets = index.has_offsets() ? &index.offsets[index.at(i, 0)] : nullptr;
+
+        // A point is bound when its first slot is used
+        __m128i valid = _mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)blockVerts), neg);
+
+        __m256d px = _mm256_setzero_pd();
+        __m256d py = _mm256_setzero_pd();
+        __m256d pz = _mm256_setzero_pd();
+        __m256d qx = _mm256_setzero_pd();
+        __m256d qy = _mm256_setzero_pd();
+        __m256d qz = _mm256_setzero_pd();
+        for (size_t k = 0; k < index.slots; k += 3) {
+            __m256d cx[3], cy[3], cz[3];
+            for (size_t j = 0; j < 3; ++j) {
+                // Unused slots read point 0 with their zero weight
+                __m128i iv = _mm_loadu_si128((const __m128i*)(blockVerts + 4 * (k + j)));
+                iv = _mm_and_si128(iv, _mm_cmpgt_epi32(iv, neg));
+                iv = _mm_add_epi32(iv, _mm_add_epi32(iv, iv));
+                __m256d w = _mm256_cvtps_pd(_mm_loadu_ps(blockWeights + 4 * (k + j)));
+                cx[j] = _mm256_cvtps_pd(_mm_i32gather_ps(tp + 0, iv, 4));
+                cy[j] = _mm256_cvtps_pd(_mm_i32gather_ps(tp + 1, iv, 4));
+                cz[j] = _mm256_cvtps_pd(_mm_i32gather_ps(tp + 2, iv, 4));
+                px = _mm256_fmadd_pd(cx[j], w, px);
+                py = _mm256_fmadd_pd(cy[j], w, py);
+                pz = _mm256_fmadd_pd(cz[j], w, pz);
+            }
+            if (blockOffsets == nullptr) continue;
+
+            // The triangle's frame from the corners just gathered
+            __m256d ex = _mm256_sub_pd(cx[1], cx[0]), ey = _mm256_sub_pd(cy[1], cy[0]), ez = _mm256_sub_pd(cz[1], cz[0]);
+            __m256d fx = _mm256_sub_pd(cx[2], cx[0]), fy = _mm256_sub_pd(cy[2], cy[0]), fz = _mm256_sub_pd(cz[2], cz[0]);
+            __m256d nx = _mm256_fmsub_pd(fy, ez, _mm256_mul_pd(fz, ey));
+            __m256d ny = _mm256_fmsub_pd(fz, ex, _mm256_mul_pd(fx, ez));
+            __m256d nz = _mm256_fmsub_pd(fx, ey, _mm256_mul_pd(fy, ex));
+            __m256d elen2 = _mm256_fmadd_pd(ex, ex, _mm256_fmadd_pd(ey, ey, _mm256_mul_pd(ez, ez)));
+            __m256d flen2 = _mm256_fmadd_pd(fx, fx, _mm256_fmadd_pd(fy, fy, _mm256_mul_pd(fz, fz)));
+            __m256d nlen2 = _mm256_fmadd_pd(nx, nx, _mm256_fmadd_pd(ny, ny, _mm256_mul_pd(nz, nz)));
+            __m256d nmin2 = _mm256_mul_pd(_mm256_mul_pd(sliver2, elen2), flen2);
+            __m256d einv = _mm256_and_pd(_mm256_div_pd(one, _mm256_sqrt_pd(elen2)), _mm256_cmp_pd(elen2, zero, _CMP_GT_OQ));
+            __m256d ninv = _mm256_and_pd(_mm256_div_pd(one, _mm256_sqrt_pd(nlen2)), _mm256_cmp_pd(nlen2, nmin2, _CMP_GT_OQ));
+            __m256d tx = _mm256_mul_pd(ex, einv), ty = _mm256_mul_pd(ey, einv), tz = _mm256_mul_pd(ez, einv);
+            nx = _mm256_mul_pd(nx, ninv);
+            ny = _mm256_mul_pd(ny, ninv);
+            nz = _mm256_mul_pd(nz, ninv);
+            __m256d bx = _mm256_fmsub_pd(ny, tz, _mm256_mul_pd(nz, ty));
+            __m256d by = _mm256_fmsub_pd(nz, tx, _mm256_mul_pd(nx, tz));
+            __m256d bz = _mm256_fmsub_pd(nx, ty, _mm256_mul_pd(ny, tx));
+            __m256d ot = _mm256_cvtps_pd(_mm_loadu_ps(blockOffsets + 4 * (k + 0)));
+            __m256d ob = _mm256_cvtps_pd(_mm_loadu_ps(blockOffsets + 4 * (k + 1)));
+            __m256d on = _mm256_cvtps_pd(_mm_loadu_ps(blockOffsets + 4 * (k + 2)));
+            qx = _mm256_fmadd_pd(tx, ot, _mm256_fmadd_pd(bx, ob, _mm256_fmadd_pd(nx, on, qx)));
+            qy = _mm256_fmadd_pd(ty, ot, _mm256_fmadd_pd(by, ob, _mm256_fmadd_pd(ny, on, qy)));
+            qz = _mm256_fmadd_pd(tz, ot, _mm256_fmadd_pd(bz, ob, _mm256_fmadd_pd(nz, on, qz)));
+        }
+        px = _mm256_add_pd(px, qx);
+        py = _mm256_add_pd(py, qy);
+        pz = _mm256_add_pd(pz, qz);
+
+        __m256d x = _mm256_fmadd_pd(px, m00, _mm256_fmadd_pd(py, m10, _mm256_fmadd_pd(pz, m20, m30)));
+        __m256d y = _mm256_fmadd_pd(px, m01, _mm256_fmadd_pd(py, m11, _mm256_fmadd_pd(pz, m21, m31)));
+        __m256d z = _mm256_fmadd_pd(px, m02, _mm256_fmadd_pd(py, m12, _mm256_fmadd_pd(pz, m22, m32)));
+
+        __m128 wf = (weights == nullptr) ? env : _mm_mul_ps(_mm_loadu_ps(&weights[i]), env);
+        __m256d s = _mm256_cvtps_pd(_mm_and_ps(wf, _mm_castsi128_ps(valid)));
+
+        double* P = &positions[4 * i];
+        __m256d r0 = _mm256_loadu_pd(P + 0);
+        __m256d r1 = _mm256_loadu_pd(P + 4);
+        __m256d r2 = _mm256_loadu_pd(P + 8);
+        __m256d r3 = _mm256_loadu_pd(P + 12);
+
+        __m256d t0 = _mm256_unpacklo_pd(r0, r1);
+        __m256d t1 = _mm256_unpackhi_pd(r0, r1);
+        __m256d t2 = _mm256_unpacklo_pd(r2, r3);
+        __m256d t3 = _mm256_unpackhi_pd(r2, r3);
+        __m256d ox = _mm256_permute2f128_pd(t0, t2, 0x20);
+        __m256d oy = _mm256_permute2f128_pd(t1, t3, 0x20);
+        __m256d oz = _mm256_permute2f128_pd(t0, t2, 0x31);
+        __m256d ow = _mm256_permute2f128_pd(t1, t3, 0x31);
+
+        __m256d exact = _mm256_cmp_pd(s, one, _CMP_EQ_OQ);
+        ox = _mm256_blendv_pd(_mm256_fmadd_pd(_mm256_sub_pd(x, ox), s, ox), x, exact);
+        oy = _mm256_blendv_pd(_mm256_fmadd_pd(_mm256_sub_pd(y, oy), s, oy), y, exact);
+        oz = _mm256_blendv_pd(_mm256_fmadd_pd(_mm256_sub_pd(z, oz), s, oz), z, exact);
+
+        t0 = _mm256_unpacklo_pd(ox, oy);
+        t1 = _mm256_unpackhi_pd(ox, oy);
+        t2 = _mm256_unpacklo_pd(oz, ow);
+        t3 = _mm256_unpackhi_pd(oz, ow);
+        _mm256_storeu_pd(P + 0, _mm256_permute2f128_pd(t0, t2, 0x20));
+        _mm256_storeu_pd(P + 4, _mm256_permute2f128_pd(t1, t3, 0x20));
+        _mm256_storeu_pd(P + 8, _mm256_permute2f128_pd(t0, t2, 0x31));
+        _mm256_storeu_pd(P + 12, _mm256_permute2f128_pd(t1, t3, 0x31));
+    }
+    deform_fused(index, tp, weights, m, envelope, positions, i, end);
+}
+#endif
+
+
+static void deform_range(
+    bool useAvx,
+    const DeformIndex& index,
+    const float* tp,
+    const float* weights,
+    const double m[4][4],
+    float envelope,
+    double* positions,
+    size_t begin,
+    size_t end
+) {
+#if CPOM_X86
+    if (useAvx) {
+        deform_avx2(index, tp, weights, m, envelope, positions, begin, end);
+        return;
+    }
+#endif
+    deform_scalar(index, tp, weights, m, envelope, positions, begin, end);
+}
+
+
+void evaluate_deform(
+    bvh::v2::ThreadPool& thread_pool,
+    const DeformIndex& index,
+    const float* targetPoints,
+    const float* weights,
+    const double mat[4][4],
+    float envelope,
+    double* positions,
+    size_t count
+) {
+    if (count > index.size()) count = index.size();
+
+    bool useAvx = cpu_has_avx2();
+    bvh::v2::ParallelExecutor executor(thread_pool);
+    executor.for_each(0, count, [&] (size_t begin, size_t end) {
+        deform_range(useAvx, index, targetPoints, weights, mat, envelope, positions, begin, end);
+    });
+}
+
+
+void evaluate_deform(
+    const DeformIndex& index,
+    const float* targetPoints,
+    const float* weights,
+    const double mat[4][4],
+    float envelope,
+    double* positions,
+    size_t count
+) {
+    if (count > index.size()) count = index.size();
+    deform_range(cpu_has_avx2(), index, targetPoints, weights, mat, envelope, positions, 0, count);
+}
+
+
+size_t evaluate_deform_dirty(
+    bvh::v2::ThreadPool& thread_pool,
+    const DeformIndex& index,
+    const DeformDependents& dependents,
+    DeformState& state,
+    const float* targetPoints,
+    const float* weights,
+    const double mat[4][4],
+    float envelope,
+    double* positions,
+    size_t count,
+    DirtyStats* stats
+) {
+    if (count > index.size()) count = index.size();
+    size_t numTarget = dependents.numTargetPoints;
+    size_t targetChunks = (numTarget + kDirtyTargetChunk - 1) / kDirtyTargetChunk;
+    size_t sourceChunks = (count + kDirtySourceChunk - 1) / kDirtySourceChunk;
+    bvh::v2::ParallelExecutor executor(thread_pool);
+
+    bool full = (
+        !state.valid ||
+        state.lastOutput.size() != 4 * count ||
+        state.lastEnvelope != envelope ||
+        std::memcmp(state.lastMat, mat, sizeof(state.lastMat)) != 0 ||
+        state.lastWeights.size() != ((weights == nullptr) ? 0 : count) ||
+        (weights != nullptr && std::memcmp(state.lastWeights.data(), weights, count * sizeof(float)) != 0)
+    );
+
+    // Find the target chunks that moved, and keep their new values for next time
+    std::vector<uint8_t> targetDirty(targetChunks, 0);
+    size_t dirtyTargetChunks = targetChunks;
+    if (!full) {
+        executor.for_each(0, targetChunks, [&] (size_t begin, size_t end) {
+            for (size_t c = begin; c < end; ++c) {
+                size_t first = 3 * c * kDirtyTargetChunk;
+                size_t floats = 3 * std::min(kDirtyTargetChunk, numTarget - c * kDirtyTargetChunk);
+                if (std::memcmp(&state.lastTarget[first], &targetPoints[first], floats * sizeof(float)) != 0) {
+                    std::memcpy(&state.lastTarget[first], &targetPoints[first], floats * sizeof(float));
+                    targetDirty[c] = 1;
+                }
+            }
+        });
+        dirtyTargetChunks = 0;
+        for (uint8_t d : targetDirty) dirtyTargetChunks += d;
+        // Walking the reverse index for most of the target costs more than it saves
+        full = 2 * dirtyTargetChunks > targetChunks;
+    }
+
+    if (full) {
+        state.inputFree = envelope == 1.0f && (
+            weights == nullptr || std::all_of(weights, weights + count, [] (float w) { return w == 1.0f; })
+        );
+        state.lastTarget.assign(targetPoints, targetPoints + 3 * numTarget);
+        state.lastInput.assign(positions, positions + 4 * count);
+        evaluate_deform(thread_pool, index, targetPoints, weights, mat, envelope, positions, count);
+        state.lastOutput.assign(positions, positions + 4 * count);
+        if (weights == nullptr) state.lastWeights.clear();
+        else state.lastWeights.assign(weights, weights + count);
+        std::memcpy(state.lastMat, mat, sizeof(state.lastMat));
+        state.lastEnvelope = envelope;
+        state.valid = true;
+        if (stats) {
+            *stats = DirtyStats();
+            stats->targetChunks = targetChunks;
+            stats->dirtyTargetChunks = dirtyTargetChunks;
+            stats->sourceChunks = sourceChunks;
+            stats->dirtySourceChunks = sourceChunks;
+            stats->full = true;
+        }
+        return count;
+    }
+
+    // Every deformed point bound to a moved target point is dirty
+    std::vector<uint8_t> sourceDirty(sourceChunks, 0);
+    for (size_t c = 0; c < targetChunks; ++c) {
+        if (!targetDirty[c]) continue;
+        size_t end = std::min(numTarget, (c + 1) * kDirtyTargetChunk);
+        for (size_t t = c * kDirtyTargetChunk; t < end; ++t) {
+            for (int k = dependents.depStart[t]; k < dependents.depStart[t + 1]; ++k) {
+                sourceDirty[(size_t)dependents.deps[k] / kDirtySourceChunk] = 1;
+            }
+        }
+    }
+
+    // Then each chunk whose input positions changed is dirty too.  Clean chunks
+    // get the last output, and dirty ones run through the kernel as usual
+    // With every weight at 1 only the unbound points pass their input through,
+    // so the chunks without any aren't even read
+    bool useAvx = cpu_has_avx2();
+    executor.for_each(0, sourceChunks, [&] (size_t begin, size_t end) {
+        for (size_t c = begin; c < end; ++c) {
+            size_t first = c * kDirtySourceChunk;
+            size_t last = std::min(count, first + kDirtySourceChunk);
+            size_t bytes = 4 * (last - first) * sizeof(double);
+            double* P = &positions[4 * first];
+            bool readInput = !state.inputFree || dependents.unboundChunks[c];
+            if (readInput && std::memcmp(&state.lastInput[4 * first], P, bytes) != 0) {
+                std::memcpy(&state.lastInput[4 * first], P, bytes);
+                sourceDirty[c] = 1;
+            }
+            if (sourceDirty[c]) {
+                deform_range(useAvx, index, targetPoints, weights, mat, envelope, positions, first, last);
+                std::memcpy(&state.lastOutput[4 * first], P, bytes);
+            }
+            else {
+                std::memcpy(P, &state.lastOutput[4 * first], bytes);
+            }
+        }
+    });
+
+    size_t dirtySourceChunks = 0;
+    size_t evaluated = 0;
+    for (size_t c = 0; c < sourceChunks; ++c) {
+        if (!sourceDirty[c]) continue;
+        ++dirtySourceChunks;
+        evaluated += std::min(count, (c + 1) * kDirtySourceChunk) - c * kDirtySourceChunk;
+    }
+    if (stats) {
+        stats->targetChunks = targetChunks;
+        stats->dirtyTargetChunks = dirtyTargetChunks;
+        stats->sourceChunks = sourceChunks;
+        stats->dirtySourceChunks = dirtySourceChunks;
+        stats->full = false;
+    }
+    return evaluated;
+}
+
+
+bvh::v2::ThreadPool& DeformCache::get_pool(size_t threadCount) {
+    if (!pool || poolThreadCount != threadCount) {
+        pool = std::make_shared<bvh::v2::ThreadPool>(threadCount);
+        poolThreadCount = threadCount;
+    }
+    return *pool;
+}
+
+
+size_t evaluate_binding(
+    DeformCache& cache,
+    size_t threadCount,
+    const std::shared_ptr<const DeformBinding>& binding,
+    const float* targetPoints,
+    const float* weights,
+    const double mat[4][4],
+    float envelope,
+    double* positions,
+    size_t count,
+    DirtyStats* stats
+) {
+    const DeformIndex& index = binding->index;
+    std::unique_lock<std::mutex> lock(cache.mutex, std::try_to_lock);
+    if (lock.owns_lock()) {
+        if (cache.binding != binding) {
+            cache.binding = binding;
+            cache.state.clear();
+        }
+        return evaluate_deform_dirty(
+            cache.get_pool(threadCount), index, binding->dependents, cache.state, targetPoints, weights, mat, envelope, positions, count, stats
+        );
+    }
+
+    if (count > index.size()) count = index.size();
+    evaluate_deform(index, targetPoints, weights, mat, envelope, positions, count);
+    if (stats) {
+        *stats = DirtyStats();
+        stats->full = true;
+    }
+    return count;
+}
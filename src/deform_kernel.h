@@ -0,0 +1,238 @@
+#ifndef DEFORM_KERNEL_H
+#define DEFORM_KERNEL_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <cmath>
+#include <memory>
+
+#include "bvh/v2/thread_pool.h"
+
+// The binding flattened into a fixed number of weighted target points per
+// deformed point, so deform never has to go back through the triangle list
+// or the mesh function set.  A plain binding uses 3 slots for the corners of
+// one triangle and its barycentric weights, and blending k triangles uses 3k.
+// The points are interleaved in blocks of kBlock, slot by slot, so the
+// kernel can load one slot of a whole block at once.  Unused slots have a
+// point index of -1 and a weight of 0, and unbound points use none at all
+// Offsets are optional.  Each triangle (slots 3j to 3j + 2) can carry a
+// weighted offset in its own frame (see triangle_frame), laid out the same
+// way as the weights with one component per slot
+struct DeformIndex {
+    static constexpr size_t kBlock = 4;
+
+    size_t count = 0;
+    size_t slots = 3;
+    std::vector<int> verts;
+    std::vector<float> weights;
+    std::vector<float> offsets;
+
+    size_t size() const { return count; }
+    void resize(size_t newCount, size_t newSlots = 3, bool withOffsets = false);
+    void clear();
+    bool has_offsets() const { return !offsets.empty(); }
+
+    size_t at(size_t i, size_t s) const { return ((i / kBlock) * slots + s) * kBlock + i % kBlock; }
+    int vert(size_t i, size_t s) const { return verts[at(i, s)]; }
+    float weight(size_t i, size_t s) const { return weights[at(i, s)]; }
+    bool is_bound(size_t i) const { return vert(i, 0) >= 0; }
+
+    // Bound points always fill their slots from the front
+    void set_slot(size_t i, size_t s, int v, float w) {
+        size_t k = at(i, s);
+        verts[k] = v;
+        weights[k] = w;
+    }
+    void set(size_t i, int a, int b, int c, float wa, float wb, float wc) {
+        set_slot(i, 0, a, wa);
+        set_slot(i, 1, b, wb);
+        set_slot(i, 2, c, wc);
+    }
+    // The offset of the triangle starting at slot s, along its edge,
+    // across it and along its normal
+    void set_offset(size_t i, size_t s, float t, float b, float n) {
+        offsets[at(i, s + 0)] = t;
+        offsets[at(i, s + 1)] = b;
+        offsets[at(i, s + 2)] = n;
+    }
+    void set_unbound(size_t i) {
+        for (size_t s = 0; s < slots; ++s) set_slot(i, s, -1, 0.0f);
+        if (has_offsets()) {
+            for (size_t s = 0; s < slots; ++s) offsets[at(i, s)] = 0.0f;
+        }
+    }
+    // Copy point j of another index with the same layout into point i
+    void copy_point(size_t i, const DeformIndex& src, size_t j) {
+        for (size_t s = 0; s < slots; ++s) set_slot(i, s, src.vert(j, s), src.weight(j, s));
+        if (has_offsets()) {
+            for (size_t s = 0; s < slots; ++s) offsets[at(i, s)] = src.has_offsets() ? src.offsets[src.at(j, s)] : 0.0f;
+        }
+    }
+    // The highest target point index used, or -1
+    int max_vert() const;
+};
+
+// The frame a triangle's offsets are kept in, from its corners a, b and c in
+// the order they're bound: the unit edge from a to b, the unit normal (facing
+// opposite the mesh's winding normal, and so opposite the bvh triangles'),
+// and the direction across the triangle that completes them.  Bind and
+// deform both build this same frame, so the flip cancels out.  A degenerate
+// triangle gets zero axes instead of nans, and so does the normal of a
+// sliver thinner than kSliverSin, since float corners can't pin down which
+// way that one faces
+// The deform kernels build exactly this from the animated corners
+static constexpr double kSliverSin = 1.0e-5;
+
+inline void triangle_frame(const double a[3], const double b[3], const double c[3], double t[3], double bt[3], double n[3]) {
+    double e[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    double f[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    n[0] = f[1] * e[2] - f[2] * e[1];
+    n[1] = f[2] * e[0] - f[0] * e[2];
+    n[2] = f[0] * e[1] - f[1] * e[0];
+    double elen2 = e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+    double flen2 = f[0] * f[0] + f[1] * f[1] + f[2] * f[2];
+    double nlen2 = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+    double einv = (elen2 > 0.0) ? 1.0 / std::sqrt(elen2) : 0.0;
+    double ninv = (nlen2 > kSliverSin * kSliverSin * elen2 * flen2) ? 1.0 / std::sqrt(nlen2) : 0.0;
+    for (int k = 0; k < 3; ++k) {
+        t[k] = e[k] * einv;
+        n[k] *= ninv;
+    }
+    bt[0] = n[1] * t[2] - n[2] * t[1];
+    bt[1] = n[2] * t[0] - n[0] * t[2];
+    bt[2] = n[0] * t[1] - n[1] * t[0];
+}
+
+// Target points compared per chunk when looking for what moved
+static constexpr size_t kDirtyTargetChunk = 256;
+// Deformed points re-evaluated together when any of them is dirty
+static constexpr size_t kDirtySourceChunk = 64;
+
+// A reverse index from target point to the deformed points bound to it:
+// the points for target point t are deps[depStart[t]] to deps[depStart[t + 1]]
+// unboundChunks marks the source chunks holding a point that isn't bound,
+// which keeps its input position whatever the weights are
+struct DeformDependents {
+    std::vector<int> depStart, deps;
+    std::vector<uint8_t> unboundChunks;
+    size_t numTargetPoints = 0;
+};
+
+// What the last evaluation of one geometry saw and wrote, so the next one
+// only has to redo the points whose inputs or target corners changed
+struct DeformState {
+    std::vector<float> lastTarget;
+    std::vector<double> lastInput, lastOutput;
+    std::vector<float> lastWeights;
+    double lastMat[4][4] = {};
+    float lastEnvelope = 0.0f;
+    bool inputFree = false;  // Every weight was 1, so only unbound points keep their input
+    bool valid = false;
+
+    void clear();
+};
+
+struct DirtyStats {
+    size_t targetChunks = 0;
+    size_t dirtyTargetChunks = 0;
+    size_t sourceChunks = 0;
+    size_t dirtySourceChunks = 0;
+    bool full = false;  // Everything was evaluated
+};
+
+// A finished binding for one geometry.  Once built it is never changed, so
+// any number of evaluations can share it
+struct DeformBinding {
+    DeformIndex index;
+    int maxVert = -1;  // Highest target point index used
+    DeformDependents dependents;
+};
+
+// Everything one geometry keeps from one evaluation to the next: the dirty
+// tracking state, the binding it belongs to, and a pool only this geometry
+// uses, so its evaluation never waits on another geometry's tasks
+struct DeformCache {
+    std::mutex mutex;
+    std::shared_ptr<const DeformBinding> binding;
+    DeformState state;
+    std::shared_ptr<bvh::v2::ThreadPool> pool;
+    size_t poolThreadCount = 0;
+
+    // The pool, re-created if the thread count changes.  Only for whoever holds the mutex
+    bvh::v2::ThreadPool& get_pool(size_t threadCount);
+};
+
+// Build the reverse index for the binding
+void build_dependents(const DeformIndex& index, size_t numTargetPoints, DeformDependents& dependents);
+
+// Move every point toward its bound spot on the target, plus its offset in
+// the frames of its triangles if the index has them.  A point with a total
+// weight of 1 gets exactly that spot
+//   targetPoints: the raw xyz floats of the target mesh
+//   weights: one per point, or null for all ones
+//   mat: row-major matrix taking target space into the deformed object's space
+//   positions: xyzw doubles per point (the MPoint layout), updated in place
+// The points are split across the pool, and each chunk runs through the
+// AVX2 kernel when the cpu supports it
+void evaluate_deform(
+    bvh::v2::ThreadPool& thread_pool,
+    const DeformIndex& index,
+    const float* targetPoints,
+    const float* weights,
+    const double mat[4][4],
+    float envelope,
+    double* positions,
+    size_t count
+);
+
+// The same, all on the calling thread
+void evaluate_deform(
+    const DeformIndex& index,
+    const float* targetPoints,
+    const float* weights,
+    const double mat[4][4],
+    float envelope,
+    double* positions,
+    size_t count
+);
+
+// The same as evaluate_deform, but compares the target points and the input
+// positions to the last call a chunk at a time, and only re-evaluates the
+// points depending on something that changed.  The rest get the last output
+// A change to the weights, matrix, envelope or point count evaluates everything,
+// as does a target where most of the chunks moved.  Returns the points evaluated
+size_t evaluate_deform_dirty(
+    bvh::v2::ThreadPool& thread_pool,
+    const DeformIndex& index,
+    const DeformDependents& dependents,
+    DeformState& state,
+    const float* targetPoints,
+    const float* weights,
+    const double mat[4][4],
+    float envelope,
+    double* positions,
+    size_t count,
+    DirtyStats* stats = nullptr
+);
+
+// Evaluate a shared binding with the geometry's dirty tracking, on its pool
+// of threadCount threads.  The state starts over whenever the binding isn't
+// the one it was last used with.  A call that finds the cache in use just
+// does a full evaluation on its own thread, so overlapping calls for
+// different frames never wait on each other
+size_t evaluate_binding(
+    DeformCache& cache,
+    size_t threadCount,
+    const std::shared_ptr<const DeformBinding>& binding,
+    const float* targetPoints,
+    const float* weights,
+    const double mat[4][4],
+    float envelope,
+    double* positions,
+    size_t count,
+    DirtyStats* stats = nullptr
+);
+
+#endif
@@ -13,39 +13,60 @@
 // I don't actually know if this works in anything other than 3d
 // but I'm templating it that way becuase that's MY only usecase
 // If anybody else needs something fancier ... sorry, that's on you :-D
+
+// Which feature of the triangle the closest point landed on
+enum class TriRegion : int {
+    Vert0 = 0,
+    Vert1,
+    Vert2,
+    Edge01,
+    Edge02,
+    Edge12,
+    Face,
+};
+
+// This version takes the triangle as a corner and its two edges (p1 - p0 and p2 - p0)
+// so they can be computed once up front instead of on every query
 template <typename T, size_t N>
-::std::tuple<bvh::v2::Vec<T, N>, bvh::v2::Vec<T, 3>> closest_point_tri(bvh::v2::Vec<T, N> const& p, bvh::v2::Tri<T, N> const& tri)
+::std::tuple<bvh::v2::Vec<T, N>, bvh::v2::Vec<T, 3>> closest_point_tri(
+    bvh::v2::Vec<T, N> const& p,
+    bvh::v2::Vec<T, N> const& p0,
+    bvh::v2::Vec<T, N> const& ab,
+    bvh::v2::Vec<T, N> const& ac,
+    TriRegion* region = nullptr
+)
 {
     const T zero = static_cast<T>(0);
     const T one = static_cast<T>(1);
 
     bvh::v2::Vec<T, 3> bary(zero);
 
-    const bvh::v2::Vec<T, N> ab = tri.p1 - tri.p0;
-    const bvh::v2::Vec<T, N> ac = tri.p2 - tri.p0;
-    const bvh::v2::Vec<T, N> ap = p - tri.p0;
+    const bvh::v2::Vec<T, N> ap = p - p0;
 
     const T d1 = dot(ab, ap);
     const T d2 = dot(ac, ap);
     if (d1 <= zero && d2 <= zero) {
         bary[0] = one;
-        return ::std::make_tuple(tri.p0, bary);
+        if (region) *region = TriRegion::Vert0;
+        return ::std::make_tuple(p0, bary);
     }
 
-    const bvh::v2::Vec<T, N> bp = p - tri.p1;
+    const bvh::v2::Vec<T, N> bp = ap - ab;
     const T d3 = dot(ab, bp);
     const T d4 = dot(ac, bp);
     if (d3 >= zero && d4 <= d3) {
         bary[1] = one;
-        return ::std::make_tuple(tri.p1, bary);
+        if (region) *region = TriRegion::Vert1;
+        return ::std::make_tuple(p0 + ab, bary);
     }
 
-    const bvh::v2::Vec<T, N> cp = p - tri.p2;
+    const bvh::v2::Vec<T, N> cp = ap - ac;
     const T d5 = dot(ab, cp);
     const T d6 = dot(ac, cp);
     if (d6 >= zero && d5 <= d6) {
         bary[2] = one;
-        return ::std::make_tuple(tri.p2, bary);
+        if (region) *region = TriRegion::Vert2;
+        return ::std::make_tuple(p0 + ac, bary);
     }
 
     const T vc = d1 * d4 - d3 * d2;
@@ -54,7 +75,8 @@ template <typename T, size_t N>
         const T v = d1 / (d1 - d3);
         bary[1] = v;
         bary[0] = one - v;
-        return ::std::make_tuple(tri.p0 + v * ab, bary);
+        if (region) *region = TriRegion::Edge01;
+        return ::std::make_tuple(p0 + v * ab, bary);
     }
 
     const T vb = d5 * d2 - d1 * d6;
@@ -63,7 +85,8 @@ template <typename T, size_t N>
         const T v = d2 / (d2 - d6);
         bary[2] = v;
         bary[0] = one - v;
-        return ::std::make_tuple(tri.p0 + v * ac, bary);
+        if (region) *region = TriRegion::Edge02;
+        return ::std::make_tuple(p0 + v * ac, bary);
     }
 
     const T va = d3 * d6 - d5 * d4;
@@ -72,7 +95,8 @@ template <typename T, size_t N>
         const T v = (d4 - d3) / ((d4 - d3) + (d5 - d6));
         bary[2] = v;
         bary[1] = one - v;
-        return ::std::make_tuple(tri.p1 + v * (tri.p2 - tri.p1), bary);
+        if (region) *region = TriRegion::Edge12;
+        return ::std::make_tuple(p0 + ab + v * (ac - ab), bary);
     }
 
     const T denom = one / (va + vb + vc);
@@ -83,7 +107,14 @@ template <typename T, size_t N>
     bary[0] = one - v - w;
     bary[1] = v;
     bary[2] = w;
-    return ::std::make_tuple(tri.p0 + v * ab + w * ac, bary);
+    if (region) *region = TriRegion::Face;
+    return ::std::make_tuple(p0 + v * ab + w * ac, bary);
+}
+
+template <typename T, size_t N>
+::std::tuple<bvh::v2::Vec<T, N>, bvh::v2::Vec<T, 3>> closest_point_tri(bvh::v2::Vec<T, N> const& p, bvh::v2::Tri<T, N> const& tri)
+{
+    return closest_point_tri(p, tri.p0, tri.p1 - tri.p0, tri.p2 - tri.p0);
 }
 
 #endif
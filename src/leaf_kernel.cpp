@@ -0,0 +1,195 @@
+#include <cstddef>
+#include <atomic>
+#include <algorithm>
+#include <type_traits>
+
+#include "cpu_features.h"
+#include "cpom_types.h"
+#include "dist_point_triangle.h"
+#include "leaf_kernel.h"
+
+
+// The lowest lane with the smallest distance that faces within tolerance
+// A nan normal passes, just like it does in the scalar angle test.  A nan
+// distance (from a degenerate triangle) can't be closest, so it's skipped
+// rather than taken first and left there, hiding the rest of the lanes
+template <typename T>
+inline int pick_lane(const LeafLanes<T>& out, size_t count, T cosTol) {
+    int best = -1;
+    T bestDist2 = T(0);
+    for (size_t i = 0; i < count; ++i) {
+        if (out.ndot[i] < cosTol || !(out.dist2[i] == out.dist2[i])) continue;
+        if (best < 0 || out.dist2[i] < bestDist2) {
+            best = static_cast<int>(i);
+            bestDist2 = out.dist2[i];
+        }
+    }
+    return best;
+}
+
+// Reference version that just runs closest_point_tri on each triangle
+template <typename T>
+static int closest_scalar(
+    const PackedTrisT<T>& packed,
+    size_t begin,
+    size_t count,
+    const Vec3T<T>& qp,
+    const Vec3T<T>& norm,
+    T cosTol,
+    LeafLanes<T>& out
+) {
+    using P = PackedTrisT<T>;
+    for (size_t i = 0; i < count; ++i) {
+        size_t at = begin + i;
+        TriRegion region;
+        auto [point, bary] = closest_point_tri(
+            qp, packed.get(P::P0X, at), packed.get(P::E1X, at), packed.get(P::E2X, at), &region
+        );
+        auto vec = point - qp;
+        out.px[i] = point[0];
+        out.py[i] = point[1];
+        out.pz[i] = point[2];
+        out.b0[i] = bary[0];
+        out.b1[i] = bary[1];
+        out.b2[i] = bary[2];
+        out.dist2[i] = bvh::v2::dot(vec, vec);
+        out.ndot[i] = bvh::v2::dot(norm, packed.get(P::NX, at));
+        out.region[i] = T(region);
+    }
+    return pick_lane(out, count, cosTol);
+}
+
+
+#if CPOM_X86
+// SSE2 is part of x86-64, so this one doesn't need a target block
+namespace leaf_sse {
+
+struct F32 {
+    using T = float;
+    using V = __m128;
+    static constexpr size_t W = 4;
+    static V set1(T x) { return _mm_set1_ps(x); }
+    static V load(const T* p) { return _mm_loadu_ps(p); }
+    static void store(T* p, V a) { _mm_storeu_ps(p, a); }
+    static V add(V a, V b) { return _mm_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm_div_ps(a, b); }
+    static V le(V a, V b) { return _mm_cmple_ps(a, b); }
+    static V ge(V a, V b) { return _mm_cmpge_ps(a, b); }
+    static V eq(V a, V b) { return _mm_cmpeq_ps(a, b); }
+    static V and_(V a, V b) { return _mm_and_ps(a, b); }
+    static V select(V m, V a, V b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+};
+
+struct F64 {
+    using T = double;
+    using V = __m128d;
+    static constexpr size_t W = 2;
+    static V set1(T x) { return _mm_set1_pd(x); }
+    static V load(const T* p) { return _mm_loadu_pd(p); }
+    static void store(T* p, V a) { _mm_storeu_pd(p, a); }
+    static V add(V a, V b) { return _mm_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm_mul_pd(a, b); }
+    static V div(V a, V b) { return _mm_div_pd(a, b); }
+    static V le(V a, V b) { return _mm_cmple_pd(a, b); }
+    static V ge(V a, V b) { return _mm_cmpge_pd(a, b); }
+    static V eq(V a, V b) { return _mm_cmpeq_pd(a, b); }
+    static V and_(V a, V b) { return _mm_and_pd(a, b); }
+    static V select(V m, V a, V b) { return _mm_or_pd(_mm_and_pd(m, a), _mm_andnot_pd(m, b)); }
+};
+
+#include "leaf_kernel_body.h"
+
+} // namespace leaf_sse
+
+
+CPOM_BEGIN_AVX2_BLOCK
+namespace leaf_avx2 {
+
+struct F32 {
+    using T = float;
+    using V = __m256;
+    static constexpr size_t W = 8;
+    static V set1(T x) { return _mm256_set1_ps(x); }
+    static V load(const T* p) { return _mm256_loadu_ps(p); }
+    static void store(T* p, V a) { _mm256_storeu_ps(p, a); }
+    static V add(V a, V b) { return _mm256_add_ps(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_ps(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_ps(a, b); }
+    static V div(V a, V b) { return _mm256_div_ps(a, b); }
+    static V le(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_LE_OQ); }
+    static V ge(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+    static V eq(V a, V b) { return _mm256_cmp_ps(a, b, _CMP_EQ_OQ); }
+    static V and_(V a, V b) { return _mm256_and_ps(a, b); }
+    static V select(V m, V a, V b) { return _mm256_blendv_ps(b, a, m); }
+};
+
+struct F64 {
+    using T = double;
+    using V = __m256d;
+    static constexpr size_t W = 4;
+    static V set1(T x) { return _mm256_set1_pd(x); }
+    static V load(const T* p) { return _mm256_loadu_pd(p); }
+    static void store(T* p, V a) { _mm256_storeu_pd(p, a); }
+    static V add(V a, V b) { return _mm256_add_pd(a, b); }
+    static V sub(V a, V b) { return _mm256_sub_pd(a, b); }
+    static V mul(V a, V b) { return _mm256_mul_pd(a, b); }
+    static V div(V a, V b) { return _mm256_div_pd(a, b); }
+    static V le(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+    static V ge(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_GE_OQ); }
+    static V eq(V a, V b) { return _mm256_cmp_pd(a, b, _CMP_EQ_OQ); }
+    static V and_(V a, V b) { return _mm256_and_pd(a, b); }
+    static V select(V m, V a, V b) { return _mm256_blendv_pd(b, a, m); }
+};
+
+#include "leaf_kernel_body.h"
+
+} // namespace leaf_avx2
+CPOM_END_AVX2_BLOCK
+#endif
+
+
+static std::atomic<int> simdLimit{static_cast<int>(SimdIsa::AVX2)};
+
+void limit_simd_isa(SimdIsa isa) {
+    simdLimit = static_cast<int>(isa);
+}
+
+SimdIsa best_simd_isa() {
+#if CPOM_X86
+    SimdIsa isa = cpu_has_avx2() ? SimdIsa::AVX2 : SimdIsa::SSE;
+#else
+    SimdIsa isa = SimdIsa::Scalar;
+#endif
+    return static_cast<SimdIsa>(std::min(static_cast<int>(isa), simdLimit.load(std::memory_order_relaxed)));
+}
+
+const char* simd_isa_name(SimdIsa isa) {
+    switch (isa) {
+        case SimdIsa::AVX2: return "avx2";
+        case SimdIsa::SSE: return "sse";
+        default: return "scalar";
+    }
+}
+
+template <typename T>
+LeafKernelFn<T> get_leaf_kernel(SimdIsa isa) {
+#if CPOM_X86
+    using SseS = std::conditional_t<std::is_same_v<T, float>, leaf_sse::F32, leaf_sse::F64>;
+    using AvxS = std::conditional_t<std::is_same_v<T, float>, leaf_avx2::F32, leaf_avx2::F64>;
+    if (isa == SimdIsa::AVX2) {
+        return cpu_has_avx2() ? &leaf_avx2::closest_wide<AvxS> : nullptr;
+    }
+    if (isa == SimdIsa::SSE) {
+        return &leaf_sse::closest_wide<SseS>;
+    }
+#else
+    if (isa != SimdIsa::Scalar) return nullptr;
+#endif
+    return &closest_scalar<T>;
+}
+
+template LeafKernelFn<float> get_leaf_kernel<float>(SimdIsa);
+template LeafKernelFn<double> get_leaf_kernel<double>(SimdIsa);
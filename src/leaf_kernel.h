@@ -0,0 +1,64 @@
+#ifndef LEAF_KERNEL_H
+#define LEAF_KERNEL_H
+
+#include <cstddef>
+
+#include "cpom_types.h"
+
+// The most triangles one leaf kernel call handles.  The builder makes
+// leaves this size by default, and bigger leaves take more than one call
+static constexpr size_t kLeafLanes = 8;
+
+// Per triangle results from one leaf kernel call, in the same order as
+// the packed triangles that were passed in
+template <typename T>
+struct LeafLanes {
+    alignas(32) T px[kLeafLanes];  // Closest point
+    alignas(32) T py[kLeafLanes];
+    alignas(32) T pz[kLeafLanes];
+    alignas(32) T b0[kLeafLanes];  // Barycentric coords of the closest point
+    alignas(32) T b1[kLeafLanes];
+    alignas(32) T b2[kLeafLanes];
+    alignas(32) T dist2[kLeafLanes];
+    alignas(32) T ndot[kLeafLanes];    // Query normal dotted with the face normal
+    alignas(32) T region[kLeafLanes];  // The TriRegion, as a number
+};
+
+enum class SimdIsa {
+    Scalar = 0,
+    SSE = 1,
+    AVX2 = 2,
+};
+
+// Test one query against the packed triangles [begin, begin + count)
+// where count is at most kLeafLanes.  Fills out for each of them, and returns
+// the lane of the closest one facing within cosTol, or -1 if none do.
+// Ties go to the lowest lane, same as looping over them one at a time
+template <typename T>
+using LeafKernelFn = int (*)(
+    const PackedTrisT<T>& packed,
+    size_t begin,
+    size_t count,
+    const Vec3T<T>& qp,
+    const Vec3T<T>& norm,
+    T cosTol,
+    LeafLanes<T>& out
+);
+
+// The widest instruction set this cpu can run, up to the limit
+SimdIsa best_simd_isa();
+// Cap what best_simd_isa() picks, so the kernels can be compared
+void limit_simd_isa(SimdIsa isa);
+const char* simd_isa_name(SimdIsa isa);
+
+// The kernel for the given instruction set, or null if the cpu can't run it
+// Every kernel classifies the triangle regions exactly like closest_point_tri
+template <typename T>
+LeafKernelFn<T> get_leaf_kernel(SimdIsa isa);
+
+template <typename T>
+LeafKernelFn<T> get_leaf_kernel() {
+    return get_leaf_kernel<T>(best_simd_isa());
+}
+
+#endif
@@ -0,0 +1,155 @@
+// The branch-free leaf kernel, written once against a small wrapper S around
+// one instruction set's registers.  leaf_kernel.cpp includes this once per
+// instruction set, inside that set's namespace and target block, so there is
+// no include guard on purpose.
+//
+// Every region test is done for every lane, in the same order and with the
+// same operations as closest_point_tri, and the first region that matches
+// wins.  That keeps the classification identical to the scalar code.
+
+template <typename S>
+inline typename S::V dot3(
+    typename S::V ax, typename S::V ay, typename S::V az,
+    typename S::V bx, typename S::V by, typename S::V bz
+) {
+    return S::add(S::add(S::mul(ax, bx), S::mul(ay, by)), S::mul(az, bz));
+}
+
+template <typename S>
+inline typename S::V both(typename S::V a, typename S::V b) {
+    return S::and_(a, b);
+}
+
+template <typename S>
+int closest_wide(
+    const PackedTrisT<typename S::T>& packed,
+    size_t begin,
+    size_t count,
+    const Vec3T<typename S::T>& qp,
+    const Vec3T<typename S::T>& norm,
+    typename S::T cosTol,
+    LeafLanes<typename S::T>& out
+) {
+    using T = typename S::T;
+    using V = typename S::V;
+    using P = PackedTrisT<T>;
+
+    const V zero = S::set1(T(0));
+    const V one = S::set1(T(1));
+    const V qx = S::set1(qp[0]), qy = S::set1(qp[1]), qz = S::set1(qp[2]);
+    const V nqx = S::set1(norm[0]), nqy = S::set1(norm[1]), nqz = S::set1(norm[2]);
+
+    for (size_t off = 0; off < count; off += S::W) {
+        size_t at = begin + off;
+        V p0x = S::load(packed.plane(P::P0X) + at);
+        V p0y = S::load(packed.plane(P::P0Y) + at);
+        V p0z = S::load(packed.plane(P::P0Z) + at);
+        V abx = S::load(packed.plane(P::E1X) + at);
+        V aby = S::load(packed.plane(P::E1Y) + at);
+        V abz = S::load(packed.plane(P::E1Z) + at);
+        V acx = S::load(packed.plane(P::E2X) + at);
+        V acy = S::load(packed.plane(P::E2Y) + at);
+        V acz = S::load(packed.plane(P::E2Z) + at);
+
+        V apx = S::sub(qx, p0x), apy = S::sub(qy, p0y), apz = S::sub(qz, p0z);
+        V d1 = dot3<S>(abx, aby, abz, apx, apy, apz);
+        V d2 = dot3<S>(acx, acy, acz, apx, apy, apz);
+        V inA = both<S>(S::le(d1, zero), S::le(d2, zero));
+
+        V bpx = S::sub(apx, abx), bpy = S::sub(apy, aby), bpz = S::sub(apz, abz);
+        V d3 = dot3<S>(abx, aby, abz, bpx, bpy, bpz);
+        V d4 = dot3<S>(acx, acy, acz, bpx, bpy, bpz);
+        V inB = both<S>(S::ge(d3, zero), S::le(d4, d3));
+
+        V cpx = S::sub(apx, acx), cpy = S::sub(apy, acy), cpz = S::sub(apz, acz);
+        V d5 = dot3<S>(abx, aby, abz, cpx, cpy, cpz);
+        V d6 = dot3<S>(acx, acy, acz, cpx, cpy, cpz);
+        V inC = both<S>(S::ge(d6, zero), S::le(d5, d6));
+
+        V vc = S::sub(S::mul(d1, d4), S::mul(d3, d2));
+        V inAB = both<S>(S::le(vc, zero), both<S>(S::ge(d1, zero), S::le(d3, zero)));
+        V vAB = S::div(d1, S::sub(d1, d3));
+
+        V vb = S::sub(S::mul(d5, d2), S::mul(d1, d6));
+        V inAC = both<S>(S::le(vb, zero), both<S>(S::ge(d2, zero), S::le(d6, zero)));
+        V vAC = S::div(d2, S::sub(d2, d6));
+
+        V va = S::sub(S::mul(d3, d6), S::mul(d5, d4));
+        V d43 = S::sub(d4, d3);
+        V d56 = S::sub(d5, d6);
+        V inBC = both<S>(S::le(va, zero), both<S>(S::ge(d43, zero), S::ge(d56, zero)));
+        V vBC = S::div(d43, S::add(d43, d56));
+
+        V denom = S::div(one, S::add(S::add(va, vb), vc));
+        V v = S::mul(vb, denom);
+        V w = S::mul(vc, denom);
+
+        // Start from the face, and let each earlier region override
+        V b0 = S::sub(S::sub(one, v), w);
+        V b1 = v;
+        V b2 = w;
+        V region = S::set1(T(TriRegion::Face));
+
+        b0 = S::select(inBC, zero, b0);
+        b1 = S::select(inBC, S::sub(one, vBC), b1);
+        b2 = S::select(inBC, vBC, b2);
+        region = S::select(inBC, S::set1(T(TriRegion::Edge12)), region);
+
+        b0 = S::select(inAC, S::sub(one, vAC), b0);
+        b1 = S::select(inAC, zero, b1);
+        b2 = S::select(inAC, vAC, b2);
+        region = S::select(inAC, S::set1(T(TriRegion::Edge02)), region);
+
+        b0 = S::select(inAB, S::sub(one, vAB), b0);
+        b1 = S::select(inAB, vAB, b1);
+        b2 = S::select(inAB, zero, b2);
+        region = S::select(inAB, S::set1(T(TriRegion::Edge01)), region);
+
+        b0 = S::select(inC, zero, b0);
+        b1 = S::select(inC, zero, b1);
+        b2 = S::select(inC, one, b2);
+        region = S::select(inC, S::set1(T(TriRegion::Vert2)), region);
+
+        b0 = S::select(inB, zero, b0);
+        b1 = S::select(inB, one, b1);
+        b2 = S::select(inB, zero, b2);
+        region = S::select(inB, S::set1(T(TriRegion::Vert1)), region);
+
+        b0 = S::select(inA, one, b0);
+        b1 = S::select(inA, zero, b1);
+        b2 = S::select(inA, zero, b2);
+        region = S::select(inA, S::set1(T(TriRegion::Vert0)), region);
+
+        // p0 + b1 * ab + b2 * ac, except the 1-2 edge which the scalar
+        // code walks from p1 instead
+        V onBC = S::eq(region, S::set1(T(TriRegion::Edge12)));
+        V t1x = S::select(onBC, abx, S::mul(b1, abx));
+        V t1y = S::select(onBC, aby, S::mul(b1, aby));
+        V t1z = S::select(onBC, abz, S::mul(b1, abz));
+        V t2x = S::select(onBC, S::mul(vBC, S::sub(acx, abx)), S::mul(b2, acx));
+        V t2y = S::select(onBC, S::mul(vBC, S::sub(acy, aby)), S::mul(b2, acy));
+        V t2z = S::select(onBC, S::mul(vBC, S::sub(acz, abz)), S::mul(b2, acz));
+        V px = S::add(S::add(p0x, t1x), t2x);
+        V py = S::add(S::add(p0y, t1y), t2y);
+        V pz = S::add(S::add(p0z, t1z), t2z);
+
+        V dx = S::sub(px, qx), dy = S::sub(py, qy), dz = S::sub(pz, qz);
+        V dist2 = dot3<S>(dx, dy, dz, dx, dy, dz);
+
+        V nx = S::load(packed.plane(P::NX) + at);
+        V ny = S::load(packed.plane(P::NY) + at);
+        V nz = S::load(packed.plane(P::NZ) + at);
+        V ndot = dot3<S>(nqx, nqy, nqz, nx, ny, nz);
+
+        S::store(out.px + off, px);
+        S::store(out.py + off, py);
+        S::store(out.pz + off, pz);
+        S::store(out.b0 + off, b0);
+        S::store(out.b1 + off, b1);
+        S::store(out.b2 + off, b2);
+        S::store(out.dist2 + off, dist2);
+        S::store(out.ndot + off, ndot);
+        S::store(out.region + off, region);
+    }
+    return pick_lane(out, count, cosTol);
+}
@@ -0,0 +1,91 @@
+#include <vector>
+#include <cmath>
+
+#include "bvh/v2/executor.h"
+
+#include "mesh_ingest.h"
+
+
+template <typename T>
+void assemble_tris(
+    bvh::v2::ThreadPool& thread_pool,
+    const float* points,
+    const std::vector<int>& triVerts,
+    std::vector<TriT<T>>& tris
+) {
+    bvh::v2::ParallelExecutor executor(thread_pool, kIngestParallelMin);
+    tris.resize(triVerts.size() / 3);
+    executor.for_each(0, tris.size(), [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const float* p0 = &points[triVerts[3 * i + 0] * 3];
+            const float* p1 = &points[triVerts[3 * i + 1] * 3];
+            const float* p2 = &points[triVerts[3 * i + 2] * 3];
+
+            // notice 0 2 1.  This reverses the direction of the normal
+            // Also the order of the barycenters
+            tris[i] = TriT<T>(
+                Vec3T<T>(p0[0], p0[1], p0[2]),
+                Vec3T<T>(p2[0], p2[1], p2[2]),
+                Vec3T<T>(p1[0], p1[1], p1[2])
+            );
+        }
+    });
+}
+
+
+bool vertex_normals(
+    bvh::v2::ThreadPool& thread_pool,
+    const float* points,
+    size_t numPoints,
+    const std::vector<int>& triVerts,
+    std::vector<float>& normals
+) {
+    bvh::v2::ParallelExecutor executor(thread_pool, kIngestParallelMin);
+    size_t numTris = triVerts.size() / 3;
+
+    // The triangles around each point, in triangle order.  Gathering them
+    // instead of scattering into the points keeps the threads apart.  Counting
+    // them checks every corner before any point gets read through it
+    std::vector<uint32_t> start(numPoints + 1, 0);
+    for (int v : triVerts) {
+        if (v < 0 || (size_t)v >= numPoints) return false;
+        start[v + 1]++;
+    }
+    for (size_t i = 0; i < numPoints; ++i) start[i + 1] += start[i];
+    std::vector<uint32_t> around(triVerts.size());
+    {
+        std::vector<uint32_t> fill(start.begin(), start.end() - 1);
+        for (size_t k = 0; k < triVerts.size(); ++k) around[fill[triVerts[k]]++] = (uint32_t)(k / 3);
+    }
+
+    // The cross product of each triangle's edges is its normal at twice its
+    // area, so adding them up weights the bigger ones more
+    std::vector<Vec3T<double>> faceNormals(numTris);
+    executor.for_each(0, numTris, [&] (size_t begin, size_t end) {
+        for (size_t t = begin; t < end; ++t) {
+            const float* p0 = &points[triVerts[3 * t + 0] * 3];
+            const float* p1 = &points[triVerts[3 * t + 1] * 3];
+            const float* p2 = &points[triVerts[3 * t + 2] * 3];
+            Vec3T<double> e1((double)p1[0] - p0[0], (double)p1[1] - p0[1], (double)p1[2] - p0[2]);
+            Vec3T<double> e2((double)p2[0] - p0[0], (double)p2[1] - p0[1], (double)p2[2] - p0[2]);
+            faceNormals[t] = bvh::v2::cross(e1, e2);
+        }
+    });
+
+    normals.resize(3 * numPoints);
+    executor.for_each(0, numPoints, [&] (size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Vec3T<double> sum(0.0);
+            for (uint32_t k = start[i]; k < start[i + 1]; ++k) sum = sum + faceNormals[around[k]];
+            double len = bvh::v2::length(sum);
+            double inv = (len > 0.0) ? 1.0 / len : 0.0;
+            normals[3 * i + 0] = (float)(sum[0] * inv);
+            normals[3 * i + 1] = (float)(sum[1] * inv);
+            normals[3 * i + 2] = (float)(sum[2] * inv);
+        }
+    });
+    return true;
+}
+
+template void assemble_tris<float>(bvh::v2::ThreadPool&, const float*, const std::vector<int>&, std::vector<TriT<float>>&);
+template void assemble_tris<double>(bvh::v2::ThreadPool&, const float*, const std::vector<int>&, std::vector<TriT<double>>&);
@@ -0,0 +1,46 @@
+#ifndef MESH_INGEST_H
+#define MESH_INGEST_H
+
+#include <vector>
+#include <cstddef>
+
+#include "bvh/v2/thread_pool.h"
+
+#include "cpom_types.h"
+
+// Everything the engine needs from a mesh comes straight off its raw float
+// points and its triangle corners, split across the pool, and written into
+// storage that's sized once up front
+
+// Fewer triangles or points than this run on the calling thread.  Waking the
+// pool costs more than it saves until then: 20k triangles took 0.22 ms in
+// the serial loop and 0.49 ms split across the pool
+static constexpr size_t kIngestParallelMin = 32768;
+
+// Assemble the triangles for the builder.  triVerts holds 3 point indices
+// per triangle, and the corners are stored 0 2 1, which flips the normal
+// and the order of the barycentric coordinates
+template <typename T>
+void assemble_tris(
+    bvh::v2::ThreadPool& thread_pool,
+    const float* points,
+    const std::vector<int>& triVerts,
+    std::vector<TriT<T>>& tris
+);
+
+// Area weighted vertex normals, as packed xyz floats, facing the way the
+// triangles wind counterclockwise.  Each vertex sums its triangles in order,
+// so the result is the same whatever the thread count.  A point that isn't
+// on any triangle with an area gets a zero normal.  Returns false, with
+// normals left alone, if a corner isn't one of the numPoints points.  Only
+// the headless tools use these; the node takes Maya's own normals, which
+// honor locked and custom normals
+bool vertex_normals(
+    bvh::v2::ThreadPool& thread_pool,
+    const float* points,
+    size_t numPoints,
+    const std::vector<int>& triVerts,
+    std::vector<float>& normals
+);
+
+#endif
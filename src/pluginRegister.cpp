@@ -1,14 +1,22 @@
 #include "blurNormalShrinkWrap.h"
+#include "registryCommand.h"
+#include "statsCommand.h"
+#include "bindingData.h"
 #include "version.h"
 #include <maya/MGlobal.h>
 #include <maya/MFnPlugin.h>
+#include <maya/MProfiler.h>
 
 // standard initialization procedures
 MStatus initializePlugin(MObject obj) {
     MStatus result;
     MFnPlugin plugin(obj, "Blur Studio", VERSION_STRING, "Any");
+    NormalShrinkWrapDeformer::profilerCategory = MProfiler::addCategory(DEFORMER_NAME, "Bvh builds, binds and deforms");
+    result = plugin.registerData(BINDING_DATA_NAME, BindingData::id, BindingData::creator);
     result = plugin.registerNode(DEFORMER_NAME, NormalShrinkWrapDeformer::id, NormalShrinkWrapDeformer::creator,
                                   NormalShrinkWrapDeformer::initialize, MPxNode::kDeformerNode);
+    result = plugin.registerCommand(REGISTRY_COMMAND_NAME, RegistryCommand::creator, RegistryCommand::newSyntax);
+    result = plugin.registerCommand(STATS_COMMAND_NAME, StatsCommand::creator, StatsCommand::newSyntax);
 
     MString nodeClassName(DEFORMER_NAME);
     MString registrantId("BlurPlugin");
@@ -26,6 +34,10 @@ MStatus uninitializePlugin(MObject obj) {
     MStatus result;
     MFnPlugin plugin(obj);
     result = plugin.deregisterNode(NormalShrinkWrapDeformer::id);
+    result = plugin.deregisterCommand(REGISTRY_COMMAND_NAME);
+    result = plugin.deregisterCommand(STATS_COMMAND_NAME);
+    result = plugin.deregisterData(BindingData::id);
+    MProfiler::removeCategory(DEFORMER_NAME);
 
     MString nodeClassName(DEFORMER_NAME);
     MString registrantId("BlurPlugin");
@@ -0,0 +1,80 @@
+#include "registryCommand.h"
+#include "accel_registry.h"
+
+#include <maya/MArgDatabase.h>
+#include <maya/MGlobal.h>
+#include <maya/MString.h>
+
+#define CHECKSTAT(stat, msg) if ( !stat ) {  MGlobal::displayError(msg); return stat; }
+
+static const char* kMemoryFlag = "-m";
+static const char* kMemoryFlagLong = "-memory";
+static const char* kSavedFlag = "-s";
+static const char* kSavedFlagLong = "-saved";
+static const char* kEntriesFlag = "-e";
+static const char* kEntriesFlagLong = "-entries";
+static const char* kUsersFlag = "-u";
+static const char* kUsersFlagLong = "-users";
+static const char* kHitRateFlag = "-hr";
+static const char* kHitRateFlagLong = "-hitRate";
+static const char* kResetFlag = "-r";
+static const char* kResetFlagLong = "-reset";
+
+
+MSyntax RegistryCommand::newSyntax() {
+    MSyntax syntax;
+    syntax.addFlag(kMemoryFlag, kMemoryFlagLong);
+    syntax.addFlag(kSavedFlag, kSavedFlagLong);
+    syntax.addFlag(kEntriesFlag, kEntriesFlagLong);
+    syntax.addFlag(kUsersFlag, kUsersFlagLong);
+    syntax.addFlag(kHitRateFlag, kHitRateFlagLong);
+    syntax.addFlag(kResetFlag, kResetFlagLong);
+    return syntax;
+}
+
+MStatus RegistryCommand::doIt(const MArgList& args) {
+    MStatus stat;
+    MArgDatabase argData(syntax(), args, &stat);
+    CHECKSTAT(stat, "Error parsing " REGISTRY_COMMAND_NAME " flags");
+
+    auto& registry = AccelRegistry::instance();
+    RegistryStats stats = registry.stats();
+
+    // Sizes are in bytes, so a double to keep the big ones exact enough
+    if (argData.isFlagSet(kMemoryFlag)) {
+        setResult((double)stats.bytes);
+    }
+    else if (argData.isFlagSet(kSavedFlag)) {
+        setResult((double)stats.savedBytes);
+    }
+    else if (argData.isFlagSet(kEntriesFlag)) {
+        setResult((int)stats.entries);
+    }
+    else if (argData.isFlagSet(kUsersFlag)) {
+        setResult((int)stats.users);
+    }
+    else if (argData.isFlagSet(kHitRateFlag)) {
+        setResult(stats.hit_rate());
+    }
+    else if (!argData.isFlagSet(kResetFlag)) {
+        MString msg;
+        msg += (int)stats.entries;
+        msg += " shared targets, ";
+        msg += (int)stats.users;
+        msg += " users, ";
+        msg += (double)stats.bytes / (1024.0 * 1024.0);
+        msg += " MB held, ";
+        msg += (double)stats.savedBytes / (1024.0 * 1024.0);
+        msg += " MB saved, ";
+        msg += (int)stats.hits;
+        msg += " hits, ";
+        msg += (int)stats.misses;
+        msg += " misses";
+        displayInfo(msg);
+        setResult(msg);
+    }
+
+    // Reset after reporting, so one call can read the counters and start over
+    if (argData.isFlagSet(kResetFlag)) registry.reset_counters();
+    return MS::kSuccess;
+}
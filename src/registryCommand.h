@@ -0,0 +1,19 @@
+#pragma once
+
+#include <maya/MPxCommand.h>
+#include <maya/MSyntax.h>
+#include <maya/MArgList.h>
+
+#define REGISTRY_COMMAND_NAME "blurNormalShrinkWrapRegistry"
+
+
+// Reports on the target structures that are shared between the nodes
+// With no flags it prints a summary.  Each flag returns that one number
+class RegistryCommand : public MPxCommand {
+public:
+    static void* creator() { return new RegistryCommand(); }
+    static MSyntax newSyntax();
+
+    MStatus doIt(const MArgList& args) override;
+    bool isUndoable() const override { return false; }
+};
@@ -0,0 +1,151 @@
+#include "statsCommand.h"
+#include "blurNormalShrinkWrap.h"
+
+#include <maya/MArgDatabase.h>
+#include <maya/MGlobal.h>
+#include <maya/MString.h>
+#include <maya/MSelectionList.h>
+#include <maya/MFnDependencyNode.h>
+
+#include <algorithm>
+
+#define CHECKSTAT(stat, msg) if ( !stat ) {  MGlobal::displayError(msg); return stat; }
+
+static const char* kQueriesFlag = "-q";
+static const char* kQueriesFlagLong = "-queries";
+static const char* kNodesFlag = "-nv";
+static const char* kNodesFlagLong = "-nodesVisited";
+static const char* kLeavesFlag = "-lv";
+static const char* kLeavesFlagLong = "-leavesVisited";
+static const char* kTriTestsFlag = "-tt";
+static const char* kTriTestsFlagLong = "-triTests";
+static const char* kAngleRejectsFlag = "-ar";
+static const char* kAngleRejectsFlagLong = "-angleRejects";
+static const char* kConeRejectsFlag = "-cr";
+static const char* kConeRejectsFlagLong = "-coneRejects";
+static const char* kMissesFlag = "-ms";
+static const char* kMissesFlagLong = "-misses";
+static const char* kRefinedFlag = "-rf";
+static const char* kRefinedFlagLong = "-refined";
+static const char* kWidenedFlag = "-w";
+static const char* kWidenedFlagLong = "-widened";
+static const char* kFallbacksFlag = "-fb";
+static const char* kFallbacksFlagLong = "-fallbacks";
+static const char* kBuildTimeFlag = "-bt";
+static const char* kBuildTimeFlagLong = "-buildTime";
+static const char* kBindTimeFlag = "-bdt";
+static const char* kBindTimeFlagLong = "-bindTime";
+static const char* kDeformsFlag = "-d";
+static const char* kDeformsFlagLong = "-deforms";
+static const char* kDeformPointsFlag = "-dp";
+static const char* kDeformPointsFlagLong = "-deformPoints";
+static const char* kDeformTimeFlag = "-dt";
+static const char* kDeformTimeFlagLong = "-deformTime";
+static const char* kResetFlag = "-r";
+static const char* kResetFlagLong = "-reset";
+
+
+MSyntax StatsCommand::newSyntax() {
+    MSyntax syntax;
+    syntax.addFlag(kQueriesFlag, kQueriesFlagLong);
+    syntax.addFlag(kNodesFlag, kNodesFlagLong);
+    syntax.addFlag(kLeavesFlag, kLeavesFlagLong);
+    syntax.addFlag(kTriTestsFlag, kTriTestsFlagLong);
+    syntax.addFlag(kAngleRejectsFlag, kAngleRejectsFlagLong);
+    syntax.addFlag(kConeRejectsFlag, kConeRejectsFlagLong);
+    syntax.addFlag(kMissesFlag, kMissesFlagLong);
+    syntax.addFlag(kRefinedFlag, kRefinedFlagLong);
+    syntax.addFlag(kWidenedFlag, kWidenedFlagLong);
+    syntax.addFlag(kFallbacksFlag, kFallbacksFlagLong);
+    syntax.addFlag(kBuildTimeFlag, kBuildTimeFlagLong);
+    syntax.addFlag(kBindTimeFlag, kBindTimeFlagLong);
+    syntax.addFlag(kDeformsFlag, kDeformsFlagLong);
+    syntax.addFlag(kDeformPointsFlag, kDeformPointsFlagLong);
+    syntax.addFlag(kDeformTimeFlag, kDeformTimeFlagLong);
+    syntax.addFlag(kResetFlag, kResetFlagLong);
+    syntax.setObjectType(MSyntax::kSelectionList, 0, 1);
+    syntax.useSelectionAsDefault(true);
+    return syntax;
+}
+
+MStatus StatsCommand::doIt(const MArgList& args) {
+    MStatus stat;
+    MArgDatabase argData(syntax(), args, &stat);
+    CHECKSTAT(stat, "Error parsing " STATS_COMMAND_NAME " flags");
+
+    MSelectionList sel;
+    argData.getObjects(sel);
+    MObject obj;
+    if (sel.length() == 0 || !sel.getDependNode(0, obj)) {
+        MGlobal::displayError(STATS_COMMAND_NAME " needs a " DEFORMER_NAME " node");
+        return MS::kInvalidParameter;
+    }
+    MFnDependencyNode fnNode(obj);
+    NormalShrinkWrapDeformer* node = nullptr;
+    if (fnNode.typeId() == NormalShrinkWrapDeformer::id) {
+        node = dynamic_cast<NormalShrinkWrapDeformer*>(fnNode.userNode());
+    }
+    if (node == nullptr) {
+        MGlobal::displayError(fnNode.name() + " is not a " DEFORMER_NAME " node");
+        return MS::kInvalidParameter;
+    }
+
+    NodeStats stats = node->getStats();
+    const QueryStats& q = stats.query;
+
+    // Counts can get past an int in a long session, so they come back as doubles
+    if (argData.isFlagSet(kQueriesFlag)) setResult((double)q.queries);
+    else if (argData.isFlagSet(kNodesFlag)) setResult((double)q.nodesVisited);
+    else if (argData.isFlagSet(kLeavesFlag)) setResult((double)q.leavesVisited);
+    else if (argData.isFlagSet(kTriTestsFlag)) setResult((double)q.triTests);
+    else if (argData.isFlagSet(kAngleRejectsFlag)) setResult((double)q.angleRejects);
+    else if (argData.isFlagSet(kConeRejectsFlag)) setResult((double)q.coneRejects);
+    else if (argData.isFlagSet(kMissesFlag)) setResult((double)q.misses);
+    else if (argData.isFlagSet(kRefinedFlag)) setResult((double)q.refined);
+    else if (argData.isFlagSet(kWidenedFlag)) setResult((double)q.widened);
+    else if (argData.isFlagSet(kFallbacksFlag)) setResult((double)q.fallbacks);
+    else if (argData.isFlagSet(kBuildTimeFlag)) setResult(stats.buildMs);
+    else if (argData.isFlagSet(kBindTimeFlag)) setResult(stats.bindMs);
+    else if (argData.isFlagSet(kDeformsFlag)) setResult((double)stats.deforms);
+    else if (argData.isFlagSet(kDeformPointsFlag)) setResult((double)stats.deformPoints);
+    else if (argData.isFlagSet(kDeformTimeFlag)) setResult(stats.deformMs);
+    else if (!argData.isFlagSet(kResetFlag)) {
+        double perQuery = 1.0 / (double)std::max<size_t>(1, q.queries);
+        MString msg = fnNode.name();
+        msg += ": ";
+        msg += (int)stats.builds;
+        msg += " builds in ";
+        msg += stats.buildMs;
+        msg += " ms, ";
+        msg += (int)stats.binds;
+        msg += " binds in ";
+        msg += stats.bindMs;
+        msg += " ms (";
+        msg += (double)q.queries;
+        msg += " queries, ";
+        msg += (double)q.nodesVisited * perQuery;
+        msg += " nodes, ";
+        msg += (double)q.leavesVisited * perQuery;
+        msg += " leaves, ";
+        msg += (double)q.triTests * perQuery;
+        msg += " triangles, ";
+        msg += (double)q.angleRejects * perQuery;
+        msg += " angle rejects per query, ";
+        msg += (double)q.misses;
+        msg += " misses, ";
+        msg += (double)q.fallbacks;
+        msg += " fallbacks), ";
+        msg += (int)stats.deforms;
+        msg += " deforms of ";
+        msg += (double)stats.deformPoints;
+        msg += " points in ";
+        msg += stats.deformMs;
+        msg += " ms";
+        displayInfo(msg);
+        setResult(msg);
+    }
+
+    // Reset after reporting, so one call can read the counters and start over
+    if (argData.isFlagSet(kResetFlag)) node->resetStats();
+    return MS::kSuccess;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <maya/MPxCommand.h>
+#include <maya/MSyntax.h>
+#include <maya/MArgList.h>
+
+#define STATS_COMMAND_NAME "blurNormalShrinkWrapStats"
+
+
+// Reports the counters a node has gathered since they were last reset: the
+// bvh traversal totals of its binds, and the time spent building, binding
+// and deforming.  Takes the node, or uses the selection.  With no flags it
+// prints a summary.  Each flag returns that one number
+class StatsCommand : public MPxCommand {
+public:
+    static void* creator() { return new StatsCommand(); }
+    static MSyntax newSyntax();
+
+    MStatus doIt(const MArgList& args) override;
+    bool isUndoable() const override { return false; }
+};
@@ -0,0 +1,1323 @@
+// Headless benchmark for the closest point engine
+// Builds the bvh for procedural or loaded meshes and times the batch queries
+// at a range of angle tolerances.  Results are written out as JSON
+
+#include <vector>
+#include <algorithm>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <numbers>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <type_traits>
+#include <thread>
+#include <atomic>
+
+#include "bvh/v2/thread_pool.h"
+
+#include "cpom_types.h"
+#include "cpom_normal.h"
+#include "bind_cache.h"
+#include "bind_file.h"
+#include "accel_registry.h"
+#include "leaf_kernel.h"
+#include "deform_kernel.h"
+#include "mesh_ingest.h"
+#include "mesh_io.h"
+#include "json_writer.h"
+
+
+struct BenchCase {
+    std::string name;
+    MeshData mesh;
+};
+
+struct BenchArgs {
+    std::vector<std::string> meshPaths;
+    std::vector<size_t> spheres;
+    std::vector<size_t> tori;
+    std::vector<double> anglesDeg {10.0, 30.0, 60.0, 90.0, 180.0};
+    size_t queries = 100000;
+    size_t threads = 0;
+    size_t repeat = 3;
+    unsigned int seed = 1;
+    std::string precision = "both";
+    std::string cones = "both";
+    double floatTolerance = 1.0e-6;
+    size_t leafSize = kLeafLanes;
+    BuildStrategy build = BuildStrategy::Auto;
+    std::string simd = "auto";
+    bool coherent = true;
+    size_t validate = 0;
+    std::string cacheDir;
+    std::string outPath;
+};
+
+
+static void usage() {
+    std::cerr <<
+        "usage: cpom_bench [options]\n"
+        "  --mesh PATH        load an .obj or .ply (repeatable)\n"
+        "  --sphere TRIS      procedural sphere with about TRIS triangles (repeatable)\n"
+        "  --torus TRIS       procedural torus with about TRIS triangles (repeatable)\n"
+        "  --angles A,B,...   angle tolerances in degrees (default 10,30,60,90,180)\n"
+        "  --queries N        query points per tolerance (default 100000)\n"
+        "  --threads N        worker threads, 0 for all cores (default 0)\n"
+        "  --repeat N         keep the fastest of N runs (default 3)\n"
+        "  --seed N           random seed for the query points (default 1)\n"
+        "  --precision P      double, float or both (default both)\n"
+        "  --cones C          on, off or both, to compare node visits with and without normal cones (default both)\n"
+        "  --float-tol T      relative tie tolerance for re-checking float results in double (default 1e-6)\n"
+        "  --leaf-size N      most triangles per bvh leaf (default 8)\n"
+        "  --build B          bvh builder for the main runs: auto, sah or lbvh (default auto).\n"
+        "                     Both builders are always timed against each other too\n"
+        "  --order O          query order: morton (coherent packets) or index (default morton)\n"
+        "  --simd S           leaf kernel to use: auto, scalar, sse or avx2 (default auto)\n"
+        "  --validate N       check every leaf kernel against the scalar code on N random\n"
+        "                     triangle/query pairs, then exit\n"
+        "  --cache-dir DIR    round trip each bvh through a cache file in DIR and time loading it\n"
+        "  --out PATH         write the JSON here instead of stdout\n";
+}
+
+static std::vector<double> parse_list(const std::string& s) {
+    std::vector<double> ret;
+    std::stringstream ss(s);
+    std::string tok;
+    while (std::getline(ss, tok, ',')) {
+        if (!tok.empty()) ret.push_back(std::atof(tok.c_str()));
+    }
+    return ret;
+}
+
+static bool parse_args(int argc, char** argv, BenchArgs& args) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto next = [&] () -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+        if (a == "--mesh") args.meshPaths.push_back(next());
+        else if (a == "--sphere") args.spheres.push_back(std::strtoull(next().c_str(), nullptr, 10));
+        else if (a == "--torus") args.tori.push_back(std::strtoull(next().c_str(), nullptr, 10));
+        else if (a == "--angles") args.anglesDeg = parse_list(next());
+        else if (a == "--queries") args.queries = std::strtoull(next().c_str(), nullptr, 10);
+        else if (a == "--threads") args.threads = std::strtoull(next().c_str(), nullptr, 10);
+        else if (a == "--repeat") args.repeat = std::max<size_t>(1, std::strtoull(next().c_str(), nullptr, 10));
+        else if (a == "--seed") args.seed = (unsigned int)std::strtoul(next().c_str(), nullptr, 10);
+        else if (a == "--precision") args.precision = next();
+        else if (a == "--cones") args.cones = next();
+        else if (a == "--float-tol") args.floatTolerance = std::atof(next().c_str());
+        else if (a == "--leaf-size") args.leafSize = std::max<size_t>(1, std::strtoull(next().c_str(), nullptr, 10));
+        else if (a == "--build") {
+            std::string b = next();
+            if (b == "sah") args.build = BuildStrategy::Sah;
+            else if (b == "lbvh") args.build = BuildStrategy::Lbvh;
+            else if (b == "auto") args.build = BuildStrategy::Auto;
+            else {
+                std::cerr << "Unknown builder " << b << "\n";
+                return false;
+            }
+        }
+        else if (a == "--simd") args.simd = next();
+        else if (a == "--order") args.coherent = (next() != "index");
+        else if (a == "--validate") args.validate = std::strtoull(next().c_str(), nullptr, 10);
+        else if (a == "--cache-dir") args.cacheDir = next();
+        else if (a == "--out") args.outPath = next();
+        else if (a == "--help" || a == "-h") {
+            usage();
+            std::exit(0);
+        }
+        else {
+            std::cerr << "Unknown argument " << a << "\n";
+            usage();
+            return false;
+        }
+    }
+
+    if (args.meshPaths.empty() && args.spheres.empty() && args.tori.empty()) {
+        args.spheres = {10000, 100000, 1000000};
+        args.tori = {100000};
+    }
+    return true;
+}
+
+
+// Random triangles (some of them degenerate) and query points all over, so every
+// region of closest_point_tri gets hit.  Every leaf kernel the cpu can run has to
+// classify them exactly like the scalar code.  Returns the number of mismatches
+template <typename T>
+static size_t validate_leaf_kernels(size_t count, unsigned int seed) {
+    using P = PackedTrisT<T>;
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<T> unit(-1, 1);
+    std::uniform_int_distribution<int> kind(0, 19);
+    auto rvec = [&] () { return Vec3T<T>(unit(rng), unit(rng), unit(rng)); };
+
+    size_t numTris = ((count + kLeafLanes - 1) / kLeafLanes) * kLeafLanes;
+    P packed;
+    packed.resize(numTris);
+    for (size_t i = 0; i < numTris; ++i) {
+        Vec3T<T> p0 = rvec(), p1 = rvec(), p2 = rvec();
+        switch (kind(rng)) {
+            case 0: p2 = p0 + (p1 - p0) * unit(rng); break;  // Collinear
+            case 1: p1 = p0; break;                          // Repeated corner
+            case 2: p1 = p0; p2 = p0; break;                 // A single point
+            case 3: p1 = p0 + (p1 - p0) * T(1e-5); p2 = p0 + (p2 - p0) * T(1e-5); break;  // Tiny
+            default: break;
+        }
+        auto e1 = p1 - p0, e2 = p2 - p0;
+        packed.set(P::P0X, i, p0);
+        packed.set(P::E1X, i, e1);
+        packed.set(P::E2X, i, e2);
+        packed.set(P::NX, i, bvh::v2::normalize(bvh::v2::cross(Vec3T<T>(0) - e1, e2)));
+    }
+
+    size_t mismatches = 0;
+    SimdIsa isas[] = {SimdIsa::SSE, SimdIsa::AVX2};
+    for (SimdIsa isa : isas) {
+        auto kernel = get_leaf_kernel<T>(isa);
+        if (kernel == nullptr) continue;
+
+        size_t bad = 0, badLane = 0;
+        T maxDiff = 0;
+        LeafLanes<T> ref, out;
+        auto scalar = get_leaf_kernel<T>(SimdIsa::Scalar);
+        for (size_t begin = 0; begin < numTris; begin += kLeafLanes) {
+            // Some queries sit right on a corner of one of the triangles
+            Vec3T<T> qp = rvec() * T(2);
+            if (kind(rng) < 2) qp = packed.get(P::P0X, begin + kind(rng) % kLeafLanes);
+            Vec3T<T> qn = bvh::v2::normalize(rvec());
+            T cosTol = unit(rng);
+
+            int refLane = scalar(packed, begin, kLeafLanes, qp, qn, cosTol, ref);
+            int lane = kernel(packed, begin, kLeafLanes, qp, qn, cosTol, out);
+            badLane += (refLane != lane) ? 1 : 0;
+            for (size_t i = 0; i < kLeafLanes; ++i) {
+                bad += (ref.region[i] != out.region[i]) ? 1 : 0;
+                if (std::isfinite(ref.dist2[i])) {
+                    maxDiff = std::max(maxDiff, std::abs(ref.dist2[i] - out.dist2[i]));
+                }
+            }
+        }
+        std::cerr << (std::is_same_v<T, float> ? "float " : "double ") << simd_isa_name(isa)
+            << ": " << bad << " region mismatches, " << badLane << " closest lane mismatches"
+            << " in " << numTris << " triangles, max dist2 difference " << maxDiff << "\n";
+        mismatches += bad;
+    }
+    return mismatches;
+}
+
+
+// Points scattered just off the surface, with normals that wander away from
+// the face normal so the angle tolerance actually has something to reject
+static void make_queries(
+    const MeshData& mesh,
+    size_t count,
+    unsigned int seed,
+    std::vector<Vec3>& qps,
+    std::vector<Vec3>& norms
+) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<size_t> triDist(0, mesh.numTris() - 1);
+    std::uniform_real_distribution<Scalar> unit(0.0, 1.0);
+    std::normal_distribution<Scalar> noise(0.0, 0.25);
+
+    auto point = [&] (int idx) {
+        return Vec3(mesh.points[3 * idx + 0], mesh.points[3 * idx + 1], mesh.points[3 * idx + 2]);
+    };
+
+    BBox bbox = BBox::make_empty();
+    for (size_t i = 0; i < mesh.numPoints(); ++i) bbox.extend(point((int)i));
+    Scalar offset = bvh::v2::length(bbox.get_diagonal()) * 0.02;
+
+    qps.resize(count);
+    norms.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        size_t t = triDist(rng);
+        // Same winding as the engine uses, so the normals face the same way
+        Vec3 p0 = point(mesh.triVerts[3 * t + 0]);
+        Vec3 p1 = point(mesh.triVerts[3 * t + 2]);
+        Vec3 p2 = point(mesh.triVerts[3 * t + 1]);
+        Scalar u = unit(rng), v = unit(rng);
+        if (u + v > 1.0) {
+            u = 1.0 - u;
+            v = 1.0 - v;
+        }
+        Vec3 n = bvh::v2::cross(p0 - p1, p2 - p0);
+        Scalar nlen = bvh::v2::length(n);
+        n = (nlen > 0.0) ? n * (1.0 / nlen) : Vec3(0.0, 1.0, 0.0);
+
+        Vec3 p = p0 + (p1 - p0) * u + (p2 - p0) * v;
+        qps[i] = p + n * ((unit(rng) * 2.0 - 1.0) * offset);
+
+        Vec3 jitter(noise(rng), noise(rng), noise(rng));
+        Vec3 qn = n + jitter;
+        Scalar len = bvh::v2::length(qn);
+        norms[i] = (len > 0.0 && std::isfinite(len)) ? qn * (1.0 / len) : n;
+    }
+}
+
+
+// Write the current bvh out, load it back into a fresh cache, and check that
+// the loaded one answers queries exactly like the one that was built
+template <typename T>
+static void cache_round_trip(
+    const BenchArgs& args,
+    BindCache& cache,
+    const BenchCase& c,
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& norms,
+    JsonWriter& json
+) {
+    const char* precisionName = std::is_same_v<T, float> ? "float" : "double";
+    std::string path = args.cacheDir + "/" + c.name + "_" + precisionName + ".cpombind";
+    // Paths from --mesh can have slashes in them
+    for (size_t i = args.cacheDir.size() + 1; i < path.size(); ++i) {
+        if (path[i] == '/' || path[i] == '\\') path[i] = '_';
+    }
+
+    auto pool = cache.get_pool(args.threads);
+    auto& threadPool = *pool;
+    auto& accel = cache.get_accel<T>();
+    double angle = std::numbers::pi / 3.0;
+    QueryOptions options;
+    options.refineTol = args.floatTolerance;
+    options.coherent = args.coherent;
+    QueryResult result, loadedResult;
+    get_closest_batch(threadPool, accel.bvh, accel.tris, accel.packed, accel.cones, qps, norms, angle, result, options);
+    const std::vector<Index>& triIdxs = result.triIdxs;
+    const std::vector<Vec3>& barys = result.barys;
+    std::vector<Index> loadedIdxs;
+    std::vector<Vec3> loadedBarys;
+
+    uint64_t key = target_key(c.mesh.points.data(), c.mesh.numPoints(), c.mesh.triVerts, cache.precision, cache.leafSize, cache.buildStrategy);
+    auto start = std::chrono::steady_clock::now();
+    bool ok = write_bind_file(path, cache, key, 0, triIdxs, barys, {});
+    double writeMs = elapsed_ms(start);
+
+    double loadMs = 1e300;
+    BindCache loaded;
+    for (size_t r = 0; ok && r < args.repeat; ++r) {
+        start = std::chrono::steady_clock::now();
+        BindFile file;
+        ok = file.open(path) && file.target_key() == key && file.load_accel(loaded, c.mesh.points.data(), c.mesh.triVerts);
+        std::vector<int8_t> loadedTiers;
+        ok = ok && file.load_binding(loadedIdxs, loadedBarys, loadedTiers) && loadedTiers.empty();
+        loadMs = std::min(loadMs, elapsed_ms(start));
+    }
+
+    bool matches = ok && loadedIdxs == triIdxs;
+    if (matches) {
+        auto& la = loaded.get_accel<T>();
+        get_closest_batch(threadPool, la.bvh, la.tris, la.packed, la.cones, qps, norms, angle, loadedResult, options);
+        // Bitwise, since a degenerate triangle can give nan barys
+        matches = loadedResult.triIdxs == triIdxs && loadedResult.barys.size() == barys.size();
+        matches = matches && std::memcmp(loadedResult.barys.data(), barys.data(), barys.size() * sizeof(Vec3)) == 0;
+    }
+    if (!matches) {
+        std::cerr << "  cache file " << path << (ok ? " gave different results" : " could not be written or read") << "\n";
+    }
+
+    std::error_code ec;
+    json.value("cache_bytes", ok ? (size_t)std::filesystem::file_size(path, ec) : (size_t)0);
+    json.value("cache_write_ms", writeMs);
+    json.value("cache_load_ms", ok ? loadMs : 0.0);
+    json.value("cache_matches", matches);
+    std::cerr << "  cache: write " << writeMs << " ms, load " << loadMs << " ms\n";
+}
+
+
+// Deform with only a small patch of the target moving, the way a hand moves
+// while the rest of the body holds still, then move the inputs under a still
+// target.  The dirty evaluation has to give exactly what a full one does
+static void dirty_deform_times(
+    const BenchArgs& args,
+    bvh::v2::ThreadPool& threadPool,
+    const BenchCase& c,
+    const DeformIndex& index,
+    const std::vector<double>& inputs,
+    JsonWriter& json
+) {
+    size_t count = index.size();
+    int maxVert = index.max_vert();
+    DeformDependents dependents;
+    DeformState state;
+    build_dependents(index, (size_t)(maxVert + 1), dependents);
+
+    const double mat[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+    std::vector<float> target = c.mesh.points;
+    std::vector<double> full(inputs.size()), dirty(inputs.size());
+    size_t moved = std::max<size_t>(1, c.mesh.numPoints() / 50);
+
+    double fullMs = 1e300, dirtyMs = 1e300;
+    size_t evaluated = 0;
+    bool matches = true;
+    DirtyStats stats;
+    for (size_t r = 0; r < args.repeat + 1; ++r) {
+        // Prime the state on the first pass, then move a patch each frame
+        if (r > 0) {
+            for (size_t i = 0; i < 3 * moved; ++i) target[i] += 0.01f;
+        }
+
+        full = inputs;
+        auto start = std::chrono::steady_clock::now();
+        evaluate_deform(threadPool, index, target.data(), nullptr, mat, 1.0f, full.data(), count);
+        if (r > 0) fullMs = std::min(fullMs, elapsed_ms(start));
+
+        dirty = inputs;
+        start = std::chrono::steady_clock::now();
+        evaluated = evaluate_deform_dirty(threadPool, index, dependents, state, target.data(), nullptr, mat, 1.0f, dirty.data(), count, &stats);
+        if (r > 0) dirtyMs = std::min(dirtyMs, elapsed_ms(start));
+        matches = matches && std::memcmp(full.data(), dirty.data(), full.size() * sizeof(double)) == 0;
+    }
+
+    // Unbound points keep their input even with every weight at 1, so with the
+    // target held still, moving the inputs has to move them and nothing else
+    DeformIndex partial = index;
+    for (size_t i = 0; i < count; i += 97) partial.set_unbound(i);
+    DeformDependents partialDependents;
+    DeformState partialState;
+    build_dependents(partial, (size_t)(maxVert + 1), partialDependents);
+    std::vector<double> moving = inputs;
+    for (size_t r = 0; r < 3; ++r) {
+        if (r > 0) {
+            for (size_t i = 0; i < moving.size(); i += 4) moving[i] += 0.01;
+        }
+        full = moving;
+        evaluate_deform(threadPool, partial, target.data(), nullptr, mat, 1.0f, full.data(), count);
+        dirty = moving;
+        evaluate_deform_dirty(threadPool, partial, partialDependents, partialState, target.data(), nullptr, mat, 1.0f, dirty.data(), count);
+        matches = matches && std::memcmp(full.data(), dirty.data(), full.size() * sizeof(double)) == 0;
+    }
+
+    json.value("deform_full_ms", fullMs);
+    json.value("deform_dirty_ms", dirtyMs);
+    json.value("deform_dirty_evaluated", evaluated);
+    json.value("deform_dirty_target_chunks", stats.dirtyTargetChunks);
+    json.value("deform_dirty_matches", matches);
+    std::cerr << "  deform: full " << fullMs << " ms, dirty " << dirtyMs << " ms ("
+        << evaluated << " of " << count << " points)" << (matches ? "" : ", MISMATCH") << "\n";
+}
+
+// Deform with the offsets kept.  On the rest target every point has to come
+// back to where it was bound from, up to the float the offsets are kept in
+// Degenerate and sliver triangles (the poles of the sphere) have no normal, so the points
+// bound to them lose part of their offset and are left out of the error
+static void offset_deform(
+    const BenchArgs& args,
+    bvh::v2::ThreadPool& threadPool,
+    const BenchCase& c,
+    const DeformIndex& index,
+    const std::vector<double>& inputs,
+    JsonWriter& json
+) {
+    size_t count = index.size();
+    const float* tp = c.mesh.points.data();
+    DeformIndex withOffsets;
+    withOffsets.resize(count, index.slots, true);
+    std::vector<unsigned char> degenerate(count, 0);
+    for (size_t i = 0; i < count; ++i) {
+        withOffsets.copy_point(i, index, i);
+        for (size_t k = 0; k + 2 < index.slots; k += 3) {
+            if (index.vert(i, k) < 0) continue;
+            double corners[3][3], spot[3] = {0.0, 0.0, 0.0}, w = 0.0;
+            for (size_t j = 0; j < 3; ++j) {
+                double wj = index.weight(i, k + j);
+                w += wj;
+                for (size_t a = 0; a < 3; ++a) {
+                    corners[j][a] = tp[3 * index.vert(i, k + j) + a];
+                    spot[a] += corners[j][a] * wj;
+                }
+            }
+            if (w == 0.0) continue;
+            double d[3], t[3], b[3], n[3];
+            for (size_t a = 0; a < 3; ++a) d[a] = inputs[4 * i + a] - spot[a] / w;
+            triangle_frame(corners[0], corners[1], corners[2], t, b, n);
+            if (n[0] == 0.0 && n[1] == 0.0 && n[2] == 0.0) degenerate[i] = 1;
+            withOffsets.set_offset(i, k,
+                (float)(w * (d[0] * t[0] + d[1] * t[1] + d[2] * t[2])),
+                (float)(w * (d[0] * b[0] + d[1] * b[1] + d[2] * b[2])),
+                (float)(w * (d[0] * n[0] + d[1] * n[1] + d[2] * n[2]))
+            );
+        }
+    }
+
+    const double mat[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+    std::vector<double> snapped, kept;
+    double snapMs = 1e300, keepMs = 1e300;
+    for (size_t r = 0; r < args.repeat; ++r) {
+        snapped = inputs;
+        auto start = std::chrono::steady_clock::now();
+        evaluate_deform(threadPool, index, tp, nullptr, mat, 1.0f, snapped.data(), count);
+        snapMs = std::min(snapMs, elapsed_ms(start));
+        kept = inputs;
+        start = std::chrono::steady_clock::now();
+        evaluate_deform(threadPool, withOffsets, tp, nullptr, mat, 1.0f, kept.data(), count);
+        keepMs = std::min(keepMs, elapsed_ms(start));
+    }
+
+    double maxError = 0.0;
+    size_t degenerateCount = 0;
+    for (size_t i = 0; i < count; ++i) {
+        degenerateCount += degenerate[i];
+        if (!index.is_bound(i) || degenerate[i]) continue;
+        for (size_t a = 0; a < 3; ++a) maxError = std::max(maxError, std::abs(kept[4 * i + a] - inputs[4 * i + a]));
+    }
+    json.value("offset_snap_ms", snapMs);
+    json.value("offset_keep_ms", keepMs);
+    json.value("offset_rest_max_error", maxError);
+    json.value("offset_degenerate", degenerateCount);
+    std::cerr << "  offsets: snap " << snapMs << " ms, keep " << keepMs << " ms, rest error " << maxError
+        << " (" << degenerateCount << " on degenerate triangles)\n";
+}
+
+// Several callers evaluating one shared binding at once, each working through
+// the frames in its own order, the way overlapping parallel and cached
+// playback evaluations would.  Every result has to match a plain evaluation
+static void concurrent_deform(
+    const BenchArgs& args,
+    bvh::v2::ThreadPool& threadPool,
+    const BenchCase& c,
+    const DeformIndex& index,
+    const std::vector<double>& inputs,
+    JsonWriter& json
+) {
+    const size_t callerCount = 4;
+    const size_t frameCount = 8;
+    size_t count = index.size();
+
+    auto binding = std::make_shared<DeformBinding>();
+    binding->index = index;
+    binding->maxVert = index.max_vert();
+    build_dependents(binding->index, (size_t)(binding->maxVert + 1), binding->dependents);
+    std::shared_ptr<const DeformBinding> shared = binding;
+    DeformCache deformCache;
+
+    // Each frame moves a different patch of the target
+    const double mat[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+    size_t patch = std::max<size_t>(1, c.mesh.numPoints() / frameCount);
+    std::vector<std::vector<float>> frames(frameCount, c.mesh.points);
+    std::vector<std::vector<double>> expected(frameCount, inputs);
+    for (size_t f = 0; f < frameCount; ++f) {
+        for (size_t i = 3 * f * patch; i < std::min(frames[f].size(), 3 * (f + 1) * patch); ++i) {
+            frames[f][i] += 0.01f * (float)(f + 1);
+        }
+        evaluate_deform(threadPool, index, frames[f].data(), nullptr, mat, 1.0f, expected[f].data(), count);
+    }
+
+    std::atomic<size_t> evaluations = 0, mismatches = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> callers;
+    for (size_t t = 0; t < callerCount; ++t) {
+        callers.emplace_back([&, t] {
+            std::vector<double> positions;
+            for (size_t r = 0; r < args.repeat; ++r) {
+                for (size_t k = 0; k < frameCount; ++k) {
+                    size_t f = (t % 2) ? (k * (t + 1) + r) % frameCount : (frameCount - 1 - k);
+                    positions = inputs;
+                    evaluate_binding(deformCache, args.threads, shared, frames[f].data(), nullptr, mat, 1.0f, positions.data(), count);
+                    if (std::memcmp(positions.data(), expected[f].data(), positions.size() * sizeof(double)) != 0) {
+                        ++mismatches;
+                    }
+                    ++evaluations;
+                }
+            }
+        });
+    }
+    for (auto& caller : callers) caller.join();
+    double totalMs = elapsed_ms(start);
+
+    json.value("concurrent_evaluations", evaluations.load());
+    json.value("concurrent_mismatches", mismatches.load());
+    json.value("concurrent_ms", totalMs);
+    std::cerr << "  concurrent deform: " << evaluations.load() << " evaluations from " << callerCount
+        << " callers in " << totalMs << " ms, " << mismatches.load() << " mismatches\n";
+}
+
+// What the first evaluation after a scene open costs.  Without a saved
+// binding it's a full build and bind.  With the saved bary corners and
+// values, it's only flattening them into the deform index
+template <typename T>
+static void startup_times(
+    const BenchArgs& args,
+    BindCache& cache,
+    const BenchCase& c,
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& norms,
+    JsonWriter& json
+) {
+    Precision precision = std::is_same_v<T, float> ? Precision::Float : Precision::Double;
+    auto pool = cache.get_pool(args.threads);
+    auto& threadPool = *pool;
+    double angle = std::numbers::pi / 3.0;
+    size_t count = qps.size();
+
+    QueryOptions options;
+    options.refineTol = args.floatTolerance;
+    options.coherent = args.coherent;
+    QueryResult result;
+    const std::vector<Index>& triIdxs = result.triIdxs;
+    const std::vector<Vec3>& barys = result.barys;
+    std::vector<int> corners(3 * count);
+    DeformIndex index;
+
+    double rebuildMs = 1e300;
+    for (size_t r = 0; r < args.repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        cache.clear();
+        cache.update(c.mesh.points.data(), c.mesh.triVerts, args.threads, precision);
+        auto& accel = cache.get_accel<T>();
+        get_closest_batch(threadPool, accel.bvh, accel.tris, accel.packed, accel.cones, qps, norms, angle, result, options);
+        for (size_t i = 0; i < count; ++i) {
+            bool bound = triIdxs[i] != InvalidIndex;
+            for (size_t k = 0; k < 3; ++k) {
+                corners[3 * i + k] = bound ? cache.tri_verts()[3 * triIdxs[i] + k] : -1;
+            }
+        }
+        rebuildMs = std::min(rebuildMs, elapsed_ms(start));
+    }
+
+    double savedMs = 1e300;
+    for (size_t r = 0; r < args.repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        index.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            const int* abc = &corners[3 * i];
+            if (abc[0] < 0) {
+                index.set_unbound(i);
+                continue;
+            }
+            // The same 0 2 1 swap the node does
+            index.set(i, abc[0], abc[1], abc[2], (float)barys[i][0], (float)barys[i][2], (float)barys[i][1]);
+        }
+        savedMs = std::min(savedMs, elapsed_ms(start));
+    }
+
+    json.value("startup_rebuild_ms", rebuildMs);
+    json.value("startup_saved_ms", savedMs);
+    std::cerr << "  startup: rebuild " << rebuildMs << " ms, saved binding " << savedMs << " ms\n";
+
+    // The query points stand in for the deformed mesh.  A real mesh numbers
+    // its points with some locality, so order them along the target the same way
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&] (size_t a, size_t b) { return index.vert(a, 0) < index.vert(b, 0); });
+    DeformIndex sorted;
+    sorted.resize(count);
+    std::vector<double> inputs(4 * count);
+    for (size_t i = 0; i < count; ++i) {
+        size_t j = order[i];
+        sorted.copy_point(i, index, j);
+        for (size_t k = 0; k < 3; ++k) inputs[4 * i + k] = (double)qps[j][k];
+        inputs[4 * i + 3] = 1.0;
+    }
+    dirty_deform_times(args, threadPool, c, sorted, inputs, json);
+    concurrent_deform(args, threadPool, c, sorted, inputs, json);
+    offset_deform(args, threadPool, c, sorted, inputs, json);
+}
+
+// Every fourth query gets its normal flipped, so nothing nearby faces it, the
+// way the inside of an open garment finds nothing.  Times the full search
+// against a capped one and the progressive one.  Progressive has to give
+// exactly the full search's answers, and the capped one only drops the far ones
+template <typename T>
+static void search_modes(
+    const BenchArgs& args,
+    BindCache& cache,
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& norms,
+    JsonWriter& json
+) {
+    auto& accel = cache.get_accel<T>();
+    auto pool = cache.get_pool(args.threads);
+    auto& threadPool = *pool;
+    double angle = std::numbers::pi / 3.0;
+    std::vector<Vec3T<T>> flipped = norms;
+    for (size_t i = 0; i < flipped.size(); i += 4) flipped[i] = -flipped[i];
+    double maxDistance = (double)bvh::v2::length(accel.bvh.get_bbox().get_diagonal()) * 0.05;
+
+    QueryOptions fullOptions;
+    fullOptions.refineTol = args.floatTolerance;
+    fullOptions.coherent = args.coherent;
+    QueryOptions cappedOptions = fullOptions;
+    cappedOptions.maxDistance = maxDistance;
+    QueryOptions progOptions = fullOptions;
+    progOptions.progressive = true;
+
+    QueryResult full, capped, prog;
+    double fullMs = 1e300, cappedMs = 1e300, progMs = 1e300;
+    for (size_t r = 0; r < args.repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        get_closest_batch(threadPool, accel.bvh, accel.tris, accel.packed, accel.cones, qps, flipped, angle, full, fullOptions);
+        fullMs = std::min(fullMs, elapsed_ms(start));
+
+        start = std::chrono::steady_clock::now();
+        get_closest_batch(threadPool, accel.bvh, accel.tris, accel.packed, accel.cones, qps, flipped, angle, capped, cappedOptions);
+        cappedMs = std::min(cappedMs, elapsed_ms(start));
+
+        start = std::chrono::steady_clock::now();
+        get_closest_batch(threadPool, accel.bvh, accel.tris, accel.packed, accel.cones, qps, flipped, angle, prog, progOptions);
+        progMs = std::min(progMs, elapsed_ms(start));
+    }
+    const auto& fullIdxs = full.triIdxs;
+    const auto& fullBarys = full.barys;
+    const auto& cappedIdxs = capped.triIdxs;
+    const auto& cappedBarys = capped.barys;
+    const auto& progIdxs = prog.triIdxs;
+    const auto& progBarys = prog.barys;
+    const auto& widened = prog.widened;
+
+    size_t progMismatches = 0, cappedMismatches = 0;
+    for (size_t i = 0; i < qps.size(); ++i) {
+        progMismatches += (progIdxs[i] != fullIdxs[i] || std::memcmp(&progBarys[i], &fullBarys[i], sizeof(Vec3)) != 0) ? 1 : 0;
+        // The capped search may only lose answers, never change them
+        if (cappedIdxs[i] != InvalidIndex) {
+            cappedMismatches += (cappedIdxs[i] != fullIdxs[i] || std::memcmp(&cappedBarys[i], &fullBarys[i], sizeof(Vec3)) != 0) ? 1 : 0;
+        }
+    }
+    size_t widenedCount = std::count(widened.begin(), widened.end(), (unsigned char)1);
+
+    double q = (double)std::max<size_t>(1, qps.size());
+    json.begin_object("search_modes");
+    json.value("max_distance", maxDistance);
+    json.value("full_ms", fullMs);
+    json.value("full_nodes_per_query", (double)full.stats.nodesVisited / q);
+    json.value("full_miss_rate", (double)full.stats.misses / q);
+    json.value("capped_ms", cappedMs);
+    json.value("capped_nodes_per_query", (double)capped.stats.nodesVisited / q);
+    json.value("capped_miss_rate", (double)capped.stats.misses / q);
+    json.value("capped_mismatches", cappedMismatches);
+    json.value("progressive_ms", progMs);
+    json.value("progressive_nodes_per_query", (double)prog.stats.nodesVisited / q);
+    json.value("progressive_widened", widenedCount);
+    json.value("progressive_mismatches", progMismatches);
+    json.end_object();
+    std::cerr << "  search: full " << fullMs << " ms, capped " << cappedMs << " ms, progressive "
+        << progMs << " ms (" << widenedCount << " widened)"
+        << ((progMismatches || cappedMismatches) ? ", MISMATCH" : "") << "\n";
+}
+
+// A tight tolerance with a capped search leaves plenty of points with nothing
+// in range, so they fall back on twice the tolerance and then on anything.
+// The batch asks again for just the misses at each looser tolerance, and is
+// timed against the tolerance alone to show what the fallbacks add.  It has
+// to land on the same tier at the same distance as re-running the misses by
+// hand, though ties can still pick a different triangle
+template <typename T>
+static void tolerance_fallbacks(
+    const BenchArgs& args,
+    BindCache& cache,
+    const BenchCase& c,
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& norms,
+    JsonWriter& json
+) {
+    auto& accel = cache.get_accel<T>();
+    auto pool = cache.get_pool(args.threads);
+    auto& threadPool = *pool;
+    double angle = std::numbers::pi / 18.0;
+    double maxDistance = (double)bvh::v2::length(accel.bvh.get_bbox().get_diagonal()) * 0.05;
+    FallbackTolerances fallbacks;
+    fallbacks.angles[fallbacks.count++] = 2.0 * angle;
+    fallbacks.angles[fallbacks.count++] = std::numbers::pi;
+
+    QueryOptions plainOptions;
+    plainOptions.refineTol = args.floatTolerance;
+    plainOptions.coherent = args.coherent;
+    plainOptions.maxDistance = maxDistance;
+    QueryOptions fallbackOptions = plainOptions;
+    fallbackOptions.fallbacks = &fallbacks;
+
+    QueryResult withFallbacks, plain, sub;
+    double fallbackMs = 1e300, plainMs = 1e300;
+    for (size_t r = 0; r < args.repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        get_closest_batch(threadPool, accel.bvh, accel.tris, accel.packed, accel.cones, qps, norms, angle,
+            withFallbacks, fallbackOptions);
+        fallbackMs = std::min(fallbackMs, elapsed_ms(start));
+
+        start = std::chrono::steady_clock::now();
+        get_closest_batch(threadPool, accel.bvh, accel.tris, accel.packed, accel.cones, qps, norms, angle,
+            plain, plainOptions);
+        plainMs = std::min(plainMs, elapsed_ms(start));
+    }
+    const auto& fallbackIdxs = withFallbacks.triIdxs;
+    const auto& fallbackBarys = withFallbacks.barys;
+    const auto& fallbackTiers = withFallbacks.tiers;
+    const QueryStats& fallbackStats = withFallbacks.stats;
+    const QueryStats& plainStats = plain.stats;
+
+    // The same thing by hand: everything at the tolerance, then only what
+    // missed at each looser one, as batches of their own
+    std::vector<Index> seqIdxs = plain.triIdxs;
+    std::vector<Vec3> seqBarys = plain.barys;
+    std::vector<int8_t> seqTiers;
+    seqTiers.assign(qps.size(), int8_t(-1));
+    for (size_t i = 0; i < qps.size(); ++i) {
+        if (seqIdxs[i] != InvalidIndex) seqTiers[i] = 0;
+    }
+    for (size_t k = 0; k < fallbacks.count; ++k) {
+        std::vector<size_t> missed;
+        std::vector<Vec3T<T>> missQps, missNorms;
+        for (size_t i = 0; i < qps.size(); ++i) {
+            if (seqIdxs[i] != InvalidIndex) continue;
+            missed.push_back(i);
+            missQps.push_back(qps[i]);
+            missNorms.push_back(norms[i]);
+        }
+        if (missed.empty()) break;
+        get_closest_batch(threadPool, accel.bvh, accel.tris, accel.packed, accel.cones, missQps, missNorms,
+            fallbacks.angles[k], sub, plainOptions);
+        for (size_t m = 0; m < missed.size(); ++m) {
+            if (sub.triIdxs[m] == InvalidIndex) continue;
+            seqIdxs[missed[m]] = sub.triIdxs[m];
+            seqBarys[missed[m]] = sub.barys[m];
+            seqTiers[missed[m]] = (int8_t)(k + 1);
+        }
+    }
+
+    auto point = [&] (int idx) {
+        return Vec3(c.mesh.points[3 * idx + 0], c.mesh.points[3 * idx + 1], c.mesh.points[3 * idx + 2]);
+    };
+    auto dist2 = [&] (size_t q, Index tri, const Vec3& bary) {
+        if (tri == InvalidIndex) return -1.0;
+        Vec3 p = point(c.mesh.triVerts[3 * tri + 0]) * bary[0] +
+            point(c.mesh.triVerts[3 * tri + 2]) * bary[1] +
+            point(c.mesh.triVerts[3 * tri + 1]) * bary[2];
+        Vec3 d = p - Vec3(qps[q][0], qps[q][1], qps[q][2]);
+        return bvh::v2::dot(d, d);
+    };
+
+    size_t mismatches = 0;
+    size_t tierCounts[1 + kMaxFallbacks] = {};
+    size_t unbound = 0;
+    for (size_t i = 0; i < qps.size(); ++i) {
+        double d = dist2(i, fallbackIdxs[i], fallbackBarys[i]);
+        double base = dist2(i, seqIdxs[i], seqBarys[i]);
+        bool same = (d < 0.0 || base < 0.0) ? d == base : std::abs(d - base) <= 1.0e-5 * std::max(base, 1.0e-12);
+        mismatches += (same && fallbackTiers[i] == seqTiers[i]) ? 0 : 1;
+        if (fallbackTiers[i] < 0) unbound++;
+        else tierCounts[fallbackTiers[i]]++;
+    }
+
+    double q = (double)std::max<size_t>(1, qps.size());
+    json.begin_object("tolerance_fallbacks");
+    json.value("angle_deg", angle * 180.0 / std::numbers::pi);
+    json.value("max_distance", maxDistance);
+    json.value("fallback_ms", fallbackMs);
+    json.value("fallback_nodes_per_query", (double)fallbackStats.nodesVisited / q);
+    json.value("plain_ms", plainMs);
+    json.value("plain_nodes_per_query", (double)plainStats.nodesVisited / q);
+    json.begin_array("tier_counts");
+    for (size_t k = 0; k <= fallbacks.count; ++k) {
+        json.begin_object();
+        json.value("tier", k);
+        json.value("count", tierCounts[k]);
+        json.end_object();
+    }
+    json.end_array();
+    json.value("unbound", unbound);
+    json.value("fallbacks", fallbackStats.fallbacks);
+    json.value("misses", fallbackStats.misses);
+    json.value("mismatches", mismatches);
+    json.end_object();
+    std::cerr << "  fallbacks: " << fallbackMs << " ms, tolerance alone " << plainMs << " ms ("
+        << tierCounts[0] << "/" << tierCounts[1] << "/" << tierCounts[2] << " by tier, " << unbound << " unbound)"
+        << (mismatches ? ", MISMATCH" : "") << "\n";
+}
+
+// Blending each point over its nearest few triangles, against sticking to the
+// closest one.  Times the query and the deform it feeds, and checks that the
+// blend weights of every bound point add up to one
+template <typename T>
+static void knn_times(
+    const BenchArgs& args,
+    BindCache& cache,
+    const BenchCase& c,
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& norms,
+    JsonWriter& json
+) {
+    const size_t k = 4;
+    auto& accel = cache.get_accel<T>();
+    auto pool = cache.get_pool(args.threads);
+    auto& threadPool = *pool;
+    double angle = std::numbers::pi / 3.0;
+    size_t count = qps.size();
+
+    std::vector<Index> triIdxs;
+    std::vector<Vec3> barys;
+    std::vector<double> weights;
+    double queryMs = 1e300;
+    for (size_t r = 0; r < args.repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        get_closest_k_batch(threadPool, accel.bvh, accel.packed, accel.cones,
+            qps, norms, angle, k, 0.0, triIdxs, barys, weights);
+        queryMs = std::min(queryMs, elapsed_ms(start));
+    }
+
+    // Build the index the way the node does, with the barys scaled by the weights
+    DeformIndex index;
+    index.resize(count, 3 * k);
+    size_t badSums = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t slot = 0;
+        double sum = 0.0;
+        for (size_t j = 0; j < k; ++j) {
+            size_t e = i * k + j;
+            if (triIdxs[e] == InvalidIndex) continue;
+            sum += weights[e];
+            const int* abc = &cache.tri_verts()[3 * triIdxs[e]];
+            index.set_slot(i, slot++, abc[0], (float)(barys[e][0] * weights[e]));
+            index.set_slot(i, slot++, abc[1], (float)(barys[e][2] * weights[e]));
+            index.set_slot(i, slot++, abc[2], (float)(barys[e][1] * weights[e]));
+        }
+        if (slot > 0 && std::abs(sum - 1.0) > 1e-9) ++badSums;
+    }
+
+    // The single closest triangle from the same entries, for comparison
+    DeformIndex single;
+    single.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (!index.is_bound(i)) continue;
+        single.set(i, index.vert(i, 0), index.vert(i, 1), index.vert(i, 2), 0.25f, 0.25f, 0.5f);
+    }
+
+    const double mat[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+    std::vector<double> pts(4 * count, 1.0);
+    double singleMs = 1e300, blendMs = 1e300;
+    for (size_t r = 0; r < args.repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        evaluate_deform(threadPool, single, c.mesh.points.data(), nullptr, mat, 1.0f, pts.data(), count);
+        singleMs = std::min(singleMs, elapsed_ms(start));
+        start = std::chrono::steady_clock::now();
+        evaluate_deform(threadPool, index, c.mesh.points.data(), nullptr, mat, 1.0f, pts.data(), count);
+        blendMs = std::min(blendMs, elapsed_ms(start));
+    }
+
+    json.value("knn_count", k);
+    json.value("knn_query_ms", queryMs);
+    json.value("knn_deform_single_ms", singleMs);
+    json.value("knn_deform_blend_ms", blendMs);
+    json.value("knn_bad_weight_sums", badSums);
+    std::cerr << "  k nearest (" << k << "): query " << queryMs << " ms, deform " << blendMs
+        << " ms against " << singleMs << " ms" << (badSums ? ", BAD WEIGHTS" : "") << "\n";
+}
+
+// Several caches on the same target, the way several nodes would be.  The
+// first one builds and the rest should pick up that structure, and moving
+// one of them afterwards must leave the others alone
+template <typename T>
+static void registry_sharing(
+    const BenchArgs& args,
+    const BenchCase& c,
+    JsonWriter& json
+) {
+    Precision precision = std::is_same_v<T, float> ? Precision::Float : Precision::Double;
+    const size_t cacheCount = 4;
+    auto& registry = AccelRegistry::instance();
+    registry.reset_counters();
+
+    std::vector<BindCache> caches(cacheCount);
+    for (auto& cache : caches) {
+        cache.leafSize = args.leafSize;
+        cache.buildStrategy = args.build;
+    }
+    uint64_t key = target_key(c.mesh.points.data(), c.mesh.numPoints(), c.mesh.triVerts, precision, args.leafSize, args.build);
+    caches[0].update(c.mesh.points.data(), c.mesh.triVerts, args.threads, precision, key);
+    double buildMs = caches[0].timings.ingestMs + caches[0].timings.buildMs;
+
+    double shareMs = 0.0;
+    bool shared = true;
+    for (size_t i = 1; i < cacheCount; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        caches[i].update(c.mesh.points.data(), c.mesh.triVerts, args.threads, precision, key);
+        shareMs = std::max(shareMs, elapsed_ms(start));
+        shared = shared && caches[i].timings.shared && &caches[i].get_accel<T>() == &caches[0].get_accel<T>();
+    }
+    RegistryStats stats = registry.stats();
+
+    // Nudge one cache's target.  It has to copy before refitting
+    std::vector<float> moved = c.mesh.points;
+    for (float& v : moved) v *= 1.01f;
+    WideNode rootBefore = caches[0].get_accel<T>().bvh.nodes[0];
+    uint64_t movedKey = target_key(moved.data(), c.mesh.numPoints(), c.mesh.triVerts, precision, args.leafSize, args.build);
+    caches[1].update(moved.data(), c.mesh.triVerts, args.threads, precision, movedKey);
+    bool isolated = (
+        &caches[1].get_accel<T>() != &caches[0].get_accel<T>() &&
+        std::memcmp(&rootBefore, &caches[0].get_accel<T>().bvh.nodes[0], sizeof(rootBefore)) == 0 &&
+        caches[1].timings.refit
+    );
+
+    json.begin_object("registry");
+    json.value("caches", cacheCount);
+    json.value("build_ms", buildMs);
+    json.value("share_ms", shareMs);
+    json.value("shared", shared);
+    json.value("copy_on_refit", isolated);
+    json.value("entries", stats.entries);
+    json.value("bytes", stats.bytes);
+    json.value("saved_bytes", stats.savedBytes);
+    json.value("hit_rate", stats.hit_rate());
+    json.end_object();
+    std::cerr << "  registry: build " << buildMs << " ms, share " << shareMs << " ms, "
+        << stats.savedBytes / (1024 * 1024) << " MB saved"
+        << (shared ? "" : ", NOT SHARED") << (isolated ? "" : ", REFIT LEAKED") << "\n";
+}
+
+
+static const char* build_strategy_name(BuildStrategy strategy) {
+    switch (strategy) {
+        case BuildStrategy::Sah: return "sah";
+        case BuildStrategy::Lbvh: return "lbvh";
+        default: return "auto";
+    }
+}
+
+// Build the target with each builder and run the same queries through both,
+// to weigh how much build time the lbvh saves against what it costs every query.
+// Ties can land on a different triangle, so the answers are compared by
+// distance rather than by index
+template <typename T>
+static void build_strategies(
+    const BenchArgs& args,
+    const BenchCase& c,
+    const std::vector<Vec3T<T>>& qps,
+    const std::vector<Vec3T<T>>& norms,
+    bool useCones,
+    JsonWriter& json
+) {
+    Precision precision = std::is_same_v<T, float> ? Precision::Float : Precision::Double;
+    auto point = [&] (int idx) {
+        return Vec3(c.mesh.points[3 * idx + 0], c.mesh.points[3 * idx + 1], c.mesh.points[3 * idx + 2]);
+    };
+    // Squared distance to the bound point, worked out from the original mesh
+    auto dist2 = [&] (size_t q, Index tri, const Vec3& bary) {
+        if (tri == InvalidIndex) return -1.0;
+        Vec3 p = point(c.mesh.triVerts[3 * tri + 0]) * bary[0] +
+            point(c.mesh.triVerts[3 * tri + 2]) * bary[1] +
+            point(c.mesh.triVerts[3 * tri + 1]) * bary[2];
+        Vec3 d = p - Vec3(qps[q][0], qps[q][1], qps[q][2]);
+        return bvh::v2::dot(d, d);
+    };
+
+    std::vector<std::vector<double>> baseDists(args.anglesDeg.size());
+    json.begin_array("builders");
+    for (BuildStrategy strategy : {BuildStrategy::Sah, BuildStrategy::Lbvh}) {
+        BindCache cache;
+        cache.leafSize = args.leafSize;
+        cache.buildStrategy = strategy;
+        double buildMs = 1e300;
+        for (size_t r = 0; r < args.repeat; ++r) {
+            cache.clear();
+            cache.update(c.mesh.points.data(), c.mesh.triVerts, args.threads, precision);
+            buildMs = std::min(buildMs, cache.timings.buildMs);
+        }
+        auto& accel = cache.get_accel<T>();
+        auto pool = cache.get_pool(args.threads);
+        auto& threadPool = *pool;
+        const std::vector<NormalConeT<T>> noCones;
+        const auto& cones = useCones ? accel.cones : noCones;
+
+        json.begin_object();
+        json.value("builder", std::string(build_strategy_name(strategy)));
+        json.value("build_ms", buildMs);
+        json.value("bvh_nodes", accel.bvh.nodes.size());
+        json.value("bvh_bytes", accel.memory_bytes());
+        json.begin_array("tolerances");
+        std::cerr << "  " << build_strategy_name(strategy) << ": build " << buildMs << " ms, query";
+
+        QueryOptions options;
+        options.refineTol = args.floatTolerance;
+        options.coherent = args.coherent;
+        QueryResult result;
+        const std::vector<Index>& triIdxs = result.triIdxs;
+        const std::vector<Vec3>& barys = result.barys;
+        const QueryStats& stats = result.stats;
+        for (size_t a = 0; a < args.anglesDeg.size(); ++a) {
+            double angle = args.anglesDeg[a] * std::numbers::pi / 180.0;
+            double queryMs = 1e300;
+            for (size_t r = 0; r < args.repeat + 1; ++r) {
+                auto start = std::chrono::steady_clock::now();
+                get_closest_batch(threadPool, accel.bvh, accel.tris, accel.packed, cones, qps, norms, angle, result, options);
+                // The first run warms up
+                if (r > 0) queryMs = std::min(queryMs, elapsed_ms(start));
+            }
+
+            // The sah build goes first and is what the lbvh answers get checked against
+            size_t mismatches = 0;
+            if (baseDists[a].empty()) {
+                baseDists[a].resize(qps.size());
+                for (size_t q = 0; q < qps.size(); ++q) baseDists[a][q] = dist2(q, triIdxs[q], barys[q]);
+            }
+            else {
+                for (size_t q = 0; q < qps.size(); ++q) {
+                    double d = dist2(q, triIdxs[q], barys[q]);
+                    double base = baseDists[a][q];
+                    bool same = (d < 0.0 || base < 0.0) ? d == base : std::abs(d - base) <= 1.0e-5 * std::max(base, 1.0e-12);
+                    mismatches += same ? 0 : 1;
+                }
+            }
+
+            double q = (double)std::max<size_t>(1, stats.queries);
+            json.begin_object();
+            json.value("angle_deg", args.anglesDeg[a]);
+            json.value("query_ms", queryMs);
+            json.value("nodes_visited_per_query", (double)stats.nodesVisited / q);
+            json.value("tri_tests_per_query", (double)stats.triTests / q);
+            json.value("mismatches", mismatches);
+            json.end_object();
+            std::cerr << " " << queryMs << " ms" << (mismatches ? " (MISMATCH)" : "");
+        }
+        json.end_array();
+        json.end_object();
+        std::cerr << "\n";
+    }
+    json.end_array();
+}
+
+
+// Assemble the triangles and the vertex normals on one thread and on the
+// whole pool.  The normals have to come out the same bits either way, since
+// cpom_bind's keys hash them.  Meshes under kIngestParallelMin stay on one
+// thread, so both columns time the same loop there
+template <typename T>
+static void ingest_times(
+    const BenchArgs& args,
+    bvh::v2::ThreadPool& threadPool,
+    const BenchCase& c,
+    JsonWriter& json
+) {
+    bvh::v2::ThreadPool serialPool(1);
+    std::vector<TriT<T>> serialTris, parallelTris;
+    std::vector<float> serialNormals, parallelNormals;
+    double trisSerialMs = 1e300, trisParallelMs = 1e300;
+    double normalsSerialMs = 1e300, normalsParallelMs = 1e300;
+    for (size_t r = 0; r < args.repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        assemble_tris(serialPool, c.mesh.points.data(), c.mesh.triVerts, serialTris);
+        trisSerialMs = std::min(trisSerialMs, elapsed_ms(start));
+
+        start = std::chrono::steady_clock::now();
+        assemble_tris(threadPool, c.mesh.points.data(), c.mesh.triVerts, parallelTris);
+        trisParallelMs = std::min(trisParallelMs, elapsed_ms(start));
+
+        start = std::chrono::steady_clock::now();
+        vertex_normals(serialPool, c.mesh.points.data(), c.mesh.numPoints(), c.mesh.triVerts, serialNormals);
+        normalsSerialMs = std::min(normalsSerialMs, elapsed_ms(start));
+
+        start = std::chrono::steady_clock::now();
+        vertex_normals(threadPool, c.mesh.points.data(), c.mesh.numPoints(), c.mesh.triVerts, parallelNormals);
+        normalsParallelMs = std::min(normalsParallelMs, elapsed_ms(start));
+    }
+    bool matches = serialTris.size() == parallelTris.size() && serialNormals == parallelNormals;
+    for (size_t i = 0; matches && i < serialTris.size(); ++i) {
+        matches = std::memcmp(&serialTris[i], &parallelTris[i], sizeof(TriT<T>)) == 0;
+    }
+
+    json.value("ingest_tris_serial_ms", trisSerialMs);
+    json.value("ingest_tris_parallel_ms", trisParallelMs);
+    json.value("ingest_normals_serial_ms", normalsSerialMs);
+    json.value("ingest_normals_parallel_ms", normalsParallelMs);
+    json.value("ingest_matches", matches);
+    std::cerr << "  ingest: tris " << trisSerialMs << " -> " << trisParallelMs << " ms, normals "
+        << normalsSerialMs << " -> " << normalsParallelMs << " ms" << (matches ? "" : ", MISMATCH") << "\n";
+}
+
+template <typename T>
+static void run_case(
+    const BenchArgs& args,
+    BindCache& cache,
+    const BenchCase& c,
+    const std::vector<Vec3>& dqps,
+    const std::vector<Vec3>& dnorms,
+    bool useCones,
+    JsonWriter& json
+) {
+    Precision precision = std::is_same_v<T, float> ? Precision::Float : Precision::Double;
+    const char* precisionName = std::is_same_v<T, float> ? "float" : "double";
+    std::cerr << c.name << " (" << precisionName << (useCones ? ", cones" : "") << "): "
+        << c.mesh.numTris() << " triangles\n";
+
+    // Full build, then a second update with the same connectivity to time the refit
+    double ingestMs = 1e300, buildMs = 1e300, refitMs = 1e300;
+    for (size_t r = 0; r < args.repeat; ++r) {
+        cache.clear();
+        cache.update(c.mesh.points.data(), c.mesh.triVerts, args.threads, precision);
+        ingestMs = std::min(ingestMs, cache.timings.ingestMs);
+        buildMs = std::min(buildMs, cache.timings.buildMs);
+        cache.update(c.mesh.points.data(), c.mesh.triVerts, args.threads, precision);
+        refitMs = std::min(refitMs, cache.timings.buildMs);
+    }
+    auto& accel = cache.get_accel<T>();
+    auto pool = cache.get_pool(args.threads);
+    auto& threadPool = *pool;
+    // No cones means the angle is only checked at the triangles
+    const std::vector<NormalConeT<T>> noCones;
+    const auto& cones = useCones ? accel.cones : noCones;
+
+    std::vector<Vec3T<T>> qps(dqps.size()), norms(dnorms.size());
+    for (size_t i = 0; i < dqps.size(); ++i) {
+        qps[i] = Vec3T<T>((T)dqps[i][0], (T)dqps[i][1], (T)dqps[i][2]);
+        norms[i] = Vec3T<T>((T)dnorms[i][0], (T)dnorms[i][1], (T)dnorms[i][2]);
+    }
+
+    json.begin_object();
+    json.value("name", c.name);
+    json.value("precision", std::string(precisionName));
+    json.value("cones", useCones);
+    json.value("triangles", c.mesh.numTris());
+    json.value("points", c.mesh.numPoints());
+    json.value("bvh_nodes", accel.bvh.nodes.size());
+    json.value("bvh_bytes", accel.memory_bytes());
+    std::cerr << "  bvh: " << accel.bvh.nodes.size() << " nodes, "
+        << (double)accel.memory_bytes() / (1024.0 * 1024.0) << " MB\n";
+    json.value("leaf_size", args.leafSize);
+    json.value("build_strategy", std::string(build_strategy_name(accel.strategy)));
+    json.value("ingest_ms", ingestMs);
+    json.value("build_ms", buildMs);
+    json.value("refit_ms", refitMs);
+    ingest_times<T>(args, threadPool, c, json);
+    if (!args.cacheDir.empty()) {
+        cache_round_trip<T>(args, cache, c, qps, norms, json);
+    }
+    json.begin_array("tolerances");
+
+    QueryOptions options;
+    options.refineTol = args.floatTolerance;
+    options.coherent = args.coherent;
+    QueryResult result;
+    const QueryStats& stats = result.stats;
+    for (double angleDeg : args.anglesDeg) {
+        double angle = angleDeg * std::numbers::pi / 180.0;
+
+        double queryMs = 1e300;
+        for (size_t r = 0; r < args.repeat + 1; ++r) {
+            auto start = std::chrono::steady_clock::now();
+            get_closest_batch(threadPool, accel.bvh, accel.tris, accel.packed, cones, qps, norms, angle, result, options);
+            // The first run warms up
+            if (r > 0) queryMs = std::min(queryMs, elapsed_ms(start));
+        }
+
+        double q = (double)std::max<size_t>(1, stats.queries);
+        json.begin_object();
+        json.value("angle_deg", angleDeg);
+        json.value("query_ms", queryMs);
+        json.value("queries_per_sec", (double)qps.size() / (queryMs / 1000.0));
+        json.value("nodes_visited_per_query", (double)stats.nodesVisited / q);
+        json.value("leaves_visited_per_query", (double)stats.leavesVisited / q);
+        json.value("tri_tests_per_query", (double)stats.triTests / q);
+        json.value("angle_rejects_per_query", (double)stats.angleRejects / q);
+        json.value("cone_rejects_per_query", (double)stats.coneRejects / q);
+        json.value("miss_rate", (double)stats.misses / q);
+        json.value("refined_rate", (double)stats.refined / q);
+        json.end_object();
+
+        std::cerr << "  " << angleDeg << " deg: " << queryMs << " ms, "
+            << (double)stats.nodesVisited / q << " nodes/query\n";
+    }
+
+    json.end_array();
+    startup_times<T>(args, cache, c, qps, norms, json);
+    knn_times<T>(args, cache, c, qps, norms, json);
+    search_modes<T>(args, cache, qps, norms, json);
+    tolerance_fallbacks<T>(args, cache, c, qps, norms, json);
+    registry_sharing<T>(args, c, json);
+    build_strategies<T>(args, c, qps, norms, useCones, json);
+    json.end_object();
+}
+
+
+int main(int argc, char** argv) {
+    BenchArgs args;
+    if (!parse_args(argc, argv, args)) return 1;
+
+    if (args.validate > 0) {
+        size_t bad = validate_leaf_kernels<float>(args.validate, args.seed);
+        bad += validate_leaf_kernels<double>(args.validate, args.seed);
+        return (bad == 0) ? 0 : 1;
+    }
+
+    if (args.simd == "scalar") limit_simd_isa(SimdIsa::Scalar);
+    else if (args.simd == "sse") limit_simd_isa(SimdIsa::SSE);
+
+    std::vector<BenchCase> cases;
+    for (const auto& path : args.meshPaths) {
+        BenchCase c;
+        std::string err;
+        if (!load_mesh(path, c.mesh, err)) {
+            std::cerr << err << "\n";
+            return 1;
+        }
+        c.name = path;
+        cases.push_back(std::move(c));
+    }
+    for (size_t n : args.spheres) cases.push_back({"sphere_" + std::to_string(n), make_sphere(n)});
+    for (size_t n : args.tori) cases.push_back({"torus_" + std::to_string(n), make_torus(n)});
+
+    BindCache cache;
+    cache.leafSize = args.leafSize;
+    cache.buildStrategy = args.build;
+    auto pool = cache.get_pool(args.threads);
+    auto& threadPool = *pool;
+
+    JsonWriter json;
+    json.out.precision(6);
+    json.begin_object();
+    json.value("format", std::string("cpom_bench"));
+    json.value("version", (size_t)18);
+    json.value("threads", threadPool.get_thread_count());
+    json.value("queries", args.queries);
+    json.value("repeat", args.repeat);
+    json.value("seed", (size_t)args.seed);
+    json.value("float_tolerance", args.floatTolerance);
+    json.value("simd", std::string(simd_isa_name(best_simd_isa())));
+    json.value("query_order", std::string(args.coherent ? "morton" : "index"));
+    json.begin_array("cases");
+
+    for (auto& c : cases) {
+        if (c.mesh.numTris() == 0) {
+            std::cerr << "Skipping " << c.name << ": no triangles\n";
+            continue;
+        }
+
+        std::vector<Vec3> qps, norms;
+        make_queries(c.mesh, args.queries, args.seed, qps, norms);
+
+        for (bool useCones : {false, true}) {
+            if (args.cones == (useCones ? "off" : "on")) continue;
+            if (args.precision != "float") {
+                run_case<double>(args, cache, c, qps, norms, useCones, json);
+            }
+            if (args.precision != "double") {
+                run_case<float>(args, cache, c, qps, norms, useCones, json);
+            }
+        }
+    }
+
+    json.end_array();
+    json.end_object();
+
+    if (args.outPath.empty()) {
+        std::cout << json.out.str() << std::endl;
+    }
+    else {
+        std::ofstream f(args.outPath);
+        if (!f) {
+            std::cerr << "Could not write " << args.outPath << "\n";
+            return 1;
+        }
+        f << json.out.str() << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,711 @@
+// Headless batch binder for the asset pipeline
+// Binds source meshes to their targets without Maya and writes the same cache
+// file the node does, so pointing a node's cacheFile at one skips the bind.
+// Assets are dealt out to worker threads, and a worker that runs out steals
+// from the others, so a few big assets don't hold up the whole batch
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <numbers>
+#include <fstream>
+#include <filesystem>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <system_error>
+
+#include "bvh/v2/thread_pool.h"
+
+#include "cpom_types.h"
+#include "cpom_normal.h"
+#include "bind_cache.h"
+#include "bind_batch.h"
+#include "bind_file.h"
+#include "mesh_ingest.h"
+#include "mesh_io.h"
+#include "json_writer.h"
+
+
+struct SourceSpec {
+    std::string path;
+    unsigned int multiIndex = 0;
+    double matrix[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};  // Source to target space
+};
+
+// One cache file's worth of binding: a target and every source bound to it
+struct AssetSpec {
+    std::string outPath;
+    std::string targetPath;
+    std::vector<SourceSpec> sources;
+    BindSettings settings;
+    Precision precision = Precision::Double;
+    BuildStrategy build = BuildStrategy::Auto;
+    uintmax_t cost = 0;  // Bytes of input, as a guess at how long it takes
+};
+
+struct AssetResult {
+    bool ok = false;
+    std::string err;
+    size_t worker = 0;
+    bool stolen = false;       // Taken from another worker's queue
+    bool sharedTarget = false; // The target bvh was already built for another asset
+    bool computedNormals = false;
+    size_t verts = 0;
+    size_t tris = 0;
+    double loadMs = 0.0;
+    double buildMs = 0.0;
+    double bindMs = 0.0;
+    double writeMs = 0.0;
+    double totalMs = 0.0;
+    QueryStats query;
+};
+
+struct BindArgs {
+    std::vector<std::string> manifests;
+    std::string targetPath;
+    std::vector<std::string> sourcePaths;
+    std::string outPath;
+    BindSettings settings;
+    Precision precision = Precision::Double;
+    BuildStrategy build = BuildStrategy::Auto;
+    size_t jobs = 0;
+    size_t threadsPerJob = 1;
+    std::string statsPath;
+    bool quiet = false;
+};
+
+
+static void usage() {
+    std::cerr <<
+        "usage: cpom_bind [options]\n"
+        "  --list PATH          bind every asset in a manifest (repeatable)\n"
+        "  --target PATH        bind one asset to this target mesh ...\n"
+        "  --source PATH        ... from these sources, at multiIndex 0, 1, ... (repeatable)\n"
+        "  --out PATH           ... into this cache file\n"
+        "  --angle DEG          angle tolerance in degrees (default 60)\n"
+        "  --float-tol T        relative tie tolerance for re-checking float results in double (default 1e-6)\n"
+        "  --neighbors N        triangles to blend per vertex (default 1)\n"
+        "  --radius R           blend radius with more than one neighbor (default 0)\n"
+        "  --max-distance D     furthest a vertex looks, 0 for no limit (default 0)\n"
+        "  --search S           full or progressive (default full)\n"
+        "  --fallback F         off, double, doubleThenAny or any (default off)\n"
+        "  --precision P        double or float (default double)\n"
+        "  --build B            bvh builder: auto, sah or lbvh (default auto)\n"
+        "  --jobs N             assets bound at once, 0 for all cores (default 0)\n"
+        "  --threads-per-job N  threads each asset's build and bind use (default 1)\n"
+        "  --stats PATH         write per asset timings as JSON\n"
+        "  --quiet              only report failures\n"
+        "\n"
+        "Manifest lines, with # for comments and paths relative to the manifest.\n"
+        "A path with spaces goes in double quotes:\n"
+        "  asset OUT                      start an asset writing the cache file OUT\n"
+        "  target PATH                    its target mesh\n"
+        "  source INDEX PATH [M00..M33]   a source at this multiIndex, with an optional\n"
+        "                                 row major source to target matrix\n"
+        "  set ATTR VALUE                 a node attribute for this asset: angleTolerance\n"
+        "                                 (radians), floatTolerance, neighborCount,\n"
+        "                                 neighborRadius, maxDistance, searchMode,\n"
+        "                                 toleranceFallback, precision or buildStrategy\n"
+        "Meshes are .obj, .ply or .cpm.  The node only takes the file if the points,\n"
+        "triangles, normals, matrices and settings match its own exactly, which the\n"
+        "exporter in blurNormalShrinkWrap.py takes care of\n";
+}
+
+static bool parse_fallback(const std::string& s, short& mode) {
+    if (s == "off") mode = 0;
+    else if (s == "double") mode = 1;
+    else if (s == "doubleThenAny") mode = 2;
+    else if (s == "any") mode = 3;
+    else return false;
+    return true;
+}
+
+static bool parse_build(const std::string& s, BuildStrategy& build) {
+    if (s == "auto") build = BuildStrategy::Auto;
+    else if (s == "sah") build = BuildStrategy::Sah;
+    else if (s == "lbvh") build = BuildStrategy::Lbvh;
+    else return false;
+    return true;
+}
+
+static bool parse_args(int argc, char** argv, BindArgs& args) {
+    for (int i = 1; i < argc; ++i) {
+        std::string a = argv[i];
+        auto next = [&] () -> std::string {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << a << "\n";
+                std::exit(1);
+            }
+            return argv[++i];
+        };
+        if (a == "--list") args.manifests.push_back(next());
+        else if (a == "--target") args.targetPath = next();
+        else if (a == "--source") args.sourcePaths.push_back(next());
+        else if (a == "--out") args.outPath = next();
+        else if (a == "--angle") args.settings.angleTol = std::atof(next().c_str()) * std::numbers::pi / 180.0;
+        else if (a == "--float-tol") args.settings.floatTol = std::atof(next().c_str());
+        else if (a == "--neighbors") args.settings.neighbors = std::strtoull(next().c_str(), nullptr, 10);
+        else if (a == "--radius") args.settings.radius = std::atof(next().c_str());
+        else if (a == "--max-distance") args.settings.maxDistance = std::atof(next().c_str());
+        else if (a == "--search") args.settings.progressive = (next() == "progressive");
+        else if (a == "--fallback") {
+            std::string f = next();
+            if (!parse_fallback(f, args.settings.fallbackMode)) {
+                std::cerr << "Unknown fallback " << f << "\n";
+                return false;
+            }
+        }
+        else if (a == "--precision") args.precision = (next() == "float") ? Precision::Float : Precision::Double;
+        else if (a == "--build") {
+            std::string b = next();
+            if (!parse_build(b, args.build)) {
+                std::cerr << "Unknown builder " << b << "\n";
+                return false;
+            }
+        }
+        else if (a == "--jobs") args.jobs = std::strtoull(next().c_str(), nullptr, 10);
+        else if (a == "--threads-per-job") args.threadsPerJob = std::max<size_t>(1, std::strtoull(next().c_str(), nullptr, 10));
+        else if (a == "--stats") args.statsPath = next();
+        else if (a == "--quiet") args.quiet = true;
+        else if (a == "--help" || a == "-h") {
+            usage();
+            std::exit(0);
+        }
+        else {
+            std::cerr << "Unknown argument " << a << "\n";
+            usage();
+            return false;
+        }
+    }
+    if (args.manifests.empty() && args.targetPath.empty()) {
+        usage();
+        return false;
+    }
+    if (!args.targetPath.empty() && (args.sourcePaths.empty() || args.outPath.empty())) {
+        std::cerr << "--target needs at least one --source and an --out\n";
+        return false;
+    }
+    return true;
+}
+
+
+// A whole number from 0 up to count - 1, the way an enum attribute holds its fields
+static bool enum_field(double v, int count, int& field) {
+    if (v != std::floor(v) || v < 0.0 || v >= (double)count) return false;
+    field = (int)v;
+    return true;
+}
+
+// Set one node attribute on an asset, by the attribute's long name.  Anything
+// outside the range the attribute takes on the node is rejected
+static bool set_attribute(AssetSpec& asset, const std::string& name, const std::string& value) {
+    char* end = nullptr;
+    double v = std::strtod(value.c_str(), &end);
+    if (end == value.c_str()) return false;
+    int field = 0;
+    if (name == "angleTolerance") asset.settings.angleTol = v;
+    else if (name == "floatTolerance") asset.settings.floatTol = v;
+    else if (name == "neighborCount") {
+        if (!(v < (double)kMaxNeighbors)) return false;
+        asset.settings.neighbors = (size_t)std::max(1.0, v);
+    }
+    else if (name == "neighborRadius") asset.settings.radius = v;
+    else if (name == "maxDistance") asset.settings.maxDistance = v;
+    else if (name == "searchMode") {
+        if (!enum_field(v, 2, field)) return false;
+        asset.settings.progressive = (field == 1);
+    }
+    else if (name == "toleranceFallback") {
+        if (!enum_field(v, 4, field)) return false;
+        asset.settings.fallbackMode = (short)field;
+    }
+    else if (name == "precision") {
+        if (!enum_field(v, 2, field)) return false;
+        asset.precision = (Precision)field;
+    }
+    else if (name == "buildStrategy") {
+        if (!enum_field(v, 3, field)) return false;
+        asset.build = (BuildStrategy)field;
+    }
+    else return false;
+    return true;
+}
+
+// A path on a manifest line, in double quotes if it has spaces.  Backslashes
+// are kept as they are, since Windows paths are written with them
+static bool read_path(std::istream& ss, std::string& p) {
+    return (bool)(ss >> std::quoted(p, '"', '\0'));
+}
+
+// Everything before a # that isn't inside a quoted path
+static void strip_comment(std::string& line) {
+    bool quoted = false;
+    for (size_t i = 0; i < line.size(); ++i) {
+        if (line[i] == '"') quoted = !quoted;
+        else if (line[i] == '#' && !quoted) {
+            line.resize(i);
+            return;
+        }
+    }
+}
+
+static bool parse_manifest(const std::string& path, const BindArgs& args, std::vector<AssetSpec>& assets, std::string& err) {
+    std::ifstream in(path);
+    if (!in) {
+        err = "Could not open " + path;
+        return false;
+    }
+    std::filesystem::path base = std::filesystem::path(path).parent_path();
+    auto resolve = [&](const std::string& p) {
+        std::filesystem::path fp(p);
+        return (fp.is_absolute() ? fp : base / fp).string();
+    };
+
+    std::string line;
+    size_t lineNum = 0;
+    AssetSpec* asset = nullptr;
+    while (std::getline(in, line)) {
+        ++lineNum;
+        strip_comment(line);
+        std::istringstream ss(line);
+        std::string key;
+        if (!(ss >> key)) continue;
+
+        auto fail = [&](const std::string& msg) {
+            err = path + ":" + std::to_string(lineNum) + ": " + msg;
+            return false;
+        };
+        if (key == "asset") {
+            std::string out;
+            if (!read_path(ss, out)) return fail("asset needs an output path");
+            assets.emplace_back();
+            asset = &assets.back();
+            asset->outPath = resolve(out);
+            asset->settings = args.settings;
+            asset->precision = args.precision;
+            asset->build = args.build;
+            continue;
+        }
+        if (asset == nullptr) return fail(key + " before any asset");
+
+        if (key == "target") {
+            std::string p;
+            if (!read_path(ss, p)) return fail("target needs a path");
+            asset->targetPath = resolve(p);
+        }
+        else if (key == "source") {
+            SourceSpec src;
+            std::string p;
+            if (!(ss >> src.multiIndex) || !read_path(ss, p)) return fail("source needs an index and a path");
+            src.path = resolve(p);
+            std::vector<double> m;
+            double v;
+            while (ss >> v) m.push_back(v);
+            if (!m.empty() && m.size() != 16) return fail("a source matrix needs 16 values");
+            for (size_t k = 0; k < m.size(); ++k) src.matrix[k / 4][k % 4] = m[k];
+            asset->sources.push_back(src);
+        }
+        else if (key == "set") {
+            std::string name, value;
+            if (!(ss >> name >> value) || !set_attribute(*asset, name, value)) return fail("bad setting");
+        }
+        else {
+            return fail("unknown line " + key);
+        }
+    }
+    return true;
+}
+
+
+// Loaded meshes, so the targets that many assets share are only read once
+// Only weak references are kept, so a mesh goes away once nothing is using it
+class MeshLibrary {
+public:
+    std::shared_ptr<const MeshData> get(const std::string& path, std::string& err) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (auto mesh = meshes[path].lock()) return mesh;
+        }
+        // Loading happens outside the lock.  If two workers race, the first one in wins
+        auto mesh = std::make_shared<MeshData>();
+        if (!load_mesh(path, *mesh, err)) return nullptr;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (auto existing = meshes[path].lock()) return existing;
+        meshes[path] = mesh;
+        return mesh;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<std::string, std::weak_ptr<const MeshData>> meshes;
+};
+
+
+// A lock per target key, held while that target is being built.  Without it,
+// every worker that starts on the same target at once would build its own
+// copy, where this way the others wait and then share the first one's
+class BuildLocks {
+public:
+    std::shared_ptr<std::mutex> get(uint64_t key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto& ret = locks[key];
+        if (!ret) ret = std::make_shared<std::mutex>();
+        return ret;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<uint64_t, std::shared_ptr<std::mutex>> locks;
+};
+
+
+// One queue of asset indices per worker.  A worker takes from the front of
+// its own, and steals from the back of the others once it runs dry
+class StealQueues {
+public:
+    explicit StealQueues(size_t workers) : queues(workers) {
+        for (auto& q : queues) q = std::make_unique<Queue>();
+    }
+
+    void push(size_t worker, size_t item) {
+        queues[worker]->items.push_back(item);
+    }
+
+    bool pop(size_t worker, size_t& item, bool& stolen) {
+        {
+            Queue& own = *queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.items.empty()) {
+                item = own.items.front();
+                own.items.pop_front();
+                stolen = false;
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); ++k) {
+            Queue& victim = *queues[(worker + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.items.empty()) {
+                item = victim.items.back();
+                victim.items.pop_back();
+                stolen = true;
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> items;
+    };
+    std::vector<std::unique_ptr<Queue>> queues;
+};
+
+
+template <typename T>
+static void bind_asset_queries(
+    BindCache& cache,
+    size_t threadsPerJob,
+    const AssetSpec& asset,
+    const std::vector<std::shared_ptr<const MeshData>>& sources,
+    const std::vector<std::vector<float>>& normals,
+    QueryResult& result
+) {
+    std::vector<Vec3T<T>> qps, qns;
+    std::vector<unsigned int> verts;
+    for (size_t s = 0; s < sources.size(); ++s) {
+        verts.resize(sources[s]->numPoints());
+        std::iota(verts.begin(), verts.end(), 0u);
+        append_queries<T>(asset.sources[s].matrix, sources[s]->points.data(), normals[s].data(), verts, qps, qns);
+    }
+    bind_queries(*cache.get_pool(threadsPerJob), cache.get_accel<T>(), qps, qns, asset.settings, result);
+}
+
+// Load, build, bind and write one asset, with the worker's own cache
+static AssetResult bind_asset(
+    const AssetSpec& asset,
+    BindCache& cache,
+    MeshLibrary& library,
+    BuildLocks& buildLocks,
+    size_t threadsPerJob
+) {
+    AssetResult ret;
+    auto start = std::chrono::steady_clock::now();
+    auto fail = [&](const std::string& msg) {
+        ret.err = msg;
+        ret.totalMs = elapsed_ms(start);
+        return ret;
+    };
+    if (asset.targetPath.empty()) return fail("no target");
+    if (asset.sources.empty()) return fail("no sources");
+
+    std::string err;
+    auto target = library.get(asset.targetPath, err);
+    if (!target) return fail(err);
+    if (target->numTris() == 0) return fail(asset.targetPath + " has no triangles");
+
+    // The file holds the sources back to back in multiIndex order, like the node does
+    std::vector<size_t> order(asset.sources.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return asset.sources[a].multiIndex < asset.sources[b].multiIndex;
+    });
+    AssetSpec sorted = asset;
+    for (size_t s = 0; s < order.size(); ++s) sorted.sources[s] = asset.sources[order[s]];
+    for (size_t s = 1; s < sorted.sources.size(); ++s) {
+        if (sorted.sources[s].multiIndex == sorted.sources[s - 1].multiIndex) {
+            return fail("multiIndex " + std::to_string(sorted.sources[s].multiIndex) + " is used twice");
+        }
+    }
+
+    std::vector<std::shared_ptr<const MeshData>> sources;
+    std::vector<std::vector<float>> normals(sorted.sources.size());
+    for (size_t s = 0; s < sorted.sources.size(); ++s) {
+        auto mesh = library.get(sorted.sources[s].path, err);
+        if (!mesh) return fail(err);
+        if (mesh->normals.empty()) {
+            // Close to what Maya gives, but only its own normals key the same as the node
+            if (!vertex_normals(*cache.get_pool(threadsPerJob), mesh->points.data(), mesh->numPoints(), mesh->triVerts, normals[s])) {
+                return fail(sorted.sources[s].path + ": face index out of range");
+            }
+            ret.computedNormals = true;
+        }
+        else {
+            normals[s] = mesh->normals;
+        }
+        ret.verts += mesh->numPoints();
+        sources.push_back(std::move(mesh));
+    }
+    ret.tris = target->numTris();
+    ret.loadMs = elapsed_ms(start);
+
+    // Building publishes the structure, so the other workers pick it up instead
+    // of building their own for as long as somebody holds it
+    auto buildStart = std::chrono::steady_clock::now();
+    cache.buildStrategy = asset.build;
+    uint64_t targetKey = target_key(
+        target->points.data(), target->numPoints(), target->triVerts, asset.precision, cache.leafSize, asset.build
+    );
+    bool alreadyHeld = cache.key == targetKey && cache.precision == asset.precision && cache.is_valid();
+    {
+        auto buildLock = buildLocks.get(targetKey);
+        std::lock_guard<std::mutex> lock(*buildLock);
+        cache.update(target->points.data(), target->triVerts, threadsPerJob, asset.precision, targetKey);
+    }
+    ret.sharedTarget = alreadyHeld || cache.timings.shared;
+    ret.buildMs = elapsed_ms(buildStart);
+
+    auto bindStart = std::chrono::steady_clock::now();
+    QueryResult result;
+    if (asset.precision == Precision::Float) {
+        bind_asset_queries<float>(cache, threadsPerJob, sorted, sources, normals, result);
+    }
+    else {
+        bind_asset_queries<double>(cache, threadsPerJob, sorted, sources, normals, result);
+    }
+    ret.query = result.stats;
+    ret.bindMs = elapsed_ms(bindStart);
+
+    auto writeStart = std::chrono::steady_clock::now();
+    uint64_t bindKey = bind_key(targetKey, asset.settings);
+    for (size_t s = 0; s < sources.size(); ++s) {
+        const SourceSpec& src = sorted.sources[s];
+        bindKey = bind_piece_key(bindKey, src.multiIndex, sources[s]->points.data(), sources[s]->numPoints(), normals[s], src.matrix);
+    }
+    std::error_code ec;
+    auto parent = std::filesystem::path(asset.outPath).parent_path();
+    if (!parent.empty()) std::filesystem::create_directories(parent, ec);
+    if (!write_bind_file(asset.outPath, cache, targetKey, bindKey, result.triIdxs, result.barys, result.tiers)) {
+        return fail("could not write " + asset.outPath);
+    }
+    // Make sure the node will see what was just written
+    BindFile check;
+    if (!check.open(asset.outPath) || check.target_key() != targetKey || check.bind_key() != bindKey) {
+        return fail(asset.outPath + " did not read back");
+    }
+    ret.writeMs = elapsed_ms(writeStart);
+
+    ret.ok = true;
+    ret.totalMs = elapsed_ms(start);
+    return ret;
+}
+
+
+static void write_stats(
+    const std::string& path,
+    const std::vector<AssetSpec>& assets,
+    const std::vector<AssetResult>& results,
+    size_t workers,
+    size_t threadsPerJob,
+    double wallMs
+) {
+    JsonWriter json;
+    json.out.precision(6);
+    json.begin_object();
+    json.value("format", std::string("cpom_bind"));
+    json.value("version", (size_t)1);
+    json.value("workers", workers);
+    json.value("threads_per_job", threadsPerJob);
+    json.value("wall_ms", wallMs);
+
+    size_t verts = 0, failed = 0, stolen = 0;
+    for (const auto& r : results) {
+        verts += r.ok ? r.verts : 0;
+        failed += r.ok ? 0 : 1;
+        stolen += r.stolen ? 1 : 0;
+    }
+    json.value("assets", results.size());
+    json.value("failed", failed);
+    json.value("stolen", stolen);
+    json.value("verts", verts);
+    json.value("verts_per_sec", wallMs > 0.0 ? (double)verts / (wallMs / 1000.0) : 0.0);
+
+    json.begin_array("results");
+    for (size_t a = 0; a < results.size(); ++a) {
+        const auto& r = results[a];
+        json.begin_object();
+        json.value("out", assets[a].outPath);
+        json.value("target", assets[a].targetPath);
+        json.value("ok", r.ok);
+        if (!r.ok) json.value("error", r.err);
+        json.value("worker", r.worker);
+        json.value("stolen", r.stolen);
+        json.value("shared_target", r.sharedTarget);
+        json.value("computed_normals", r.computedNormals);
+        json.value("sources", assets[a].sources.size());
+        json.value("verts", r.verts);
+        json.value("target_tris", r.tris);
+        json.value("load_ms", r.loadMs);
+        json.value("build_ms", r.buildMs);
+        json.value("bind_ms", r.bindMs);
+        json.value("write_ms", r.writeMs);
+        json.value("total_ms", r.totalMs);
+        json.value("bind_verts_per_sec", r.bindMs > 0.0 ? (double)r.verts / (r.bindMs / 1000.0) : 0.0);
+        json.value("nodes_per_query", r.query.queries ? (double)r.query.nodesVisited / (double)r.query.queries : 0.0);
+        json.value("misses", r.query.misses);
+        json.value("refined", r.query.refined);
+        json.value("fallbacks", r.query.fallbacks);
+        json.end_object();
+    }
+    json.end_array();
+    json.end_object();
+
+    std::ofstream f(path);
+    f << json.out.str() << "\n";
+    if (!f) std::cerr << "Could not write " << path << "\n";
+}
+
+
+int main(int argc, char** argv) {
+    BindArgs args;
+    if (!parse_args(argc, argv, args)) return 1;
+
+    std::vector<AssetSpec> assets;
+    for (const auto& path : args.manifests) {
+        std::string err;
+        if (!parse_manifest(path, args, assets, err)) {
+            std::cerr << err << "\n";
+            return 1;
+        }
+    }
+    if (!args.targetPath.empty()) {
+        AssetSpec asset;
+        asset.outPath = args.outPath;
+        asset.targetPath = args.targetPath;
+        for (size_t s = 0; s < args.sourcePaths.size(); ++s) {
+            SourceSpec src;
+            src.path = args.sourcePaths[s];
+            src.multiIndex = (unsigned int)s;
+            asset.sources.push_back(src);
+        }
+        asset.settings = args.settings;
+        asset.precision = args.precision;
+        asset.build = args.build;
+        assets.push_back(asset);
+    }
+
+    for (auto& asset : assets) {
+        // The node clamps these the same way before keying the binding
+        asset.settings.neighbors = std::clamp<size_t>(asset.settings.neighbors, 1, kMaxNeighbors - 1);
+        if (asset.settings.neighbors == 1) asset.settings.radius = 0.0;
+        std::error_code ec;
+        asset.cost = std::filesystem::file_size(asset.targetPath, ec);
+        for (const auto& src : asset.sources) asset.cost += std::filesystem::file_size(src.path, ec);
+    }
+
+    size_t workers = args.jobs ? args.jobs : std::max(1u, std::thread::hardware_concurrency());
+    workers = std::max<size_t>(1, std::min(workers, assets.size()));
+
+    // Deal the biggest assets out first so they start early, and leave the
+    // small ones at the backs of the queues for the thieves
+    std::vector<size_t> order(assets.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return assets[a].cost > assets[b].cost; });
+    StealQueues queues(workers);
+    for (size_t k = 0; k < order.size(); ++k) queues.push(k % workers, order[k]);
+
+    std::vector<AssetResult> results(assets.size());
+    MeshLibrary library;
+    BuildLocks buildLocks;
+    std::mutex printMutex;
+    auto wallStart = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; ++w) {
+        threads.emplace_back([&, w]() {
+            BindCache cache;
+            size_t item;
+            bool stolen;
+            while (queues.pop(w, item, stolen)) {
+                AssetResult r = bind_asset(assets[item], cache, library, buildLocks, args.threadsPerJob);
+                r.worker = w;
+                r.stolen = stolen;
+
+                std::lock_guard<std::mutex> lock(printMutex);
+                if (!r.ok) {
+                    std::cerr << assets[item].outPath << ": " << r.err << "\n";
+                }
+                else if (!args.quiet) {
+                    char buf[256];
+                    std::snprintf(buf, sizeof(buf),
+                        "%-40s %9zu verts  build %8.2f ms%s  bind %8.2f ms  %7.2f Mverts/s",
+                        std::filesystem::path(assets[item].outPath).filename().string().c_str(),
+                        r.verts, r.buildMs, r.sharedTarget ? " (shared)" : "         ", r.bindMs,
+                        r.bindMs > 0.0 ? (double)r.verts / (r.bindMs * 1000.0) : 0.0
+                    );
+                    std::cout << buf << "\n";
+                }
+                results[item] = std::move(r);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    double wallMs = elapsed_ms(wallStart);
+
+    size_t failed = 0, verts = 0;
+    for (const auto& r : results) {
+        failed += r.ok ? 0 : 1;
+        verts += r.ok ? r.verts : 0;
+    }
+    if (!args.quiet) {
+        std::cout << (assets.size() - failed) << " of " << assets.size() << " assets bound, " << verts
+            << " verts in " << wallMs << " ms on " << workers << " workers\n";
+    }
+    if (!args.statsPath.empty()) write_stats(args.statsPath, assets, results, workers, args.threadsPerJob, wallMs);
+    return (failed == 0) ? 0 : 1;
+}
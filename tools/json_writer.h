@@ -0,0 +1,46 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string>
+#include <sstream>
+#include <cmath>
+#include <cstddef>
+
+// Minimal JSON writer.  Just enough to keep the output valid
+class JsonWriter {
+public:
+    std::ostringstream out;
+
+    void begin_object() { sep(); out << "{"; first = true; }
+    void begin_object(const std::string& k) { key(k); out << "{"; first = true; }
+    void end_object() { out << "}"; first = false; }
+    void begin_array(const std::string& k) { key(k); out << "["; first = true; }
+    void end_array() { out << "]"; first = false; }
+    void key(const std::string& k) { sep(); out << "\"" << k << "\": "; first = true; }
+    void value(const std::string& k, const std::string& v) { key(k); out << "\"" << escape(v) << "\""; first = false; }
+    void value(const std::string& k, double v) {
+        key(k);
+        if (std::isfinite(v)) out << v;
+        else out << "null";
+        first = false;
+    }
+    void value(const std::string& k, size_t v) { key(k); out << v; first = false; }
+    void value(const std::string& k, bool v) { key(k); out << (v ? "true" : "false"); first = false; }
+
+private:
+    bool first = true;
+    void sep() {
+        if (!first) out << ", ";
+        first = false;
+    }
+    static std::string escape(const std::string& s) {
+        std::string r;
+        for (char c : s) {
+            if (c == '"' || c == '\\') r += '\\';
+            r += c;
+        }
+        return r;
+    }
+};
+
+#endif
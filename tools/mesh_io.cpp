@@ -0,0 +1,439 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <cctype>
+#include <cstdint>
+#include <tuple>
+#include <numbers>
+#include <algorithm>
+#include <limits>
+
+#include "mesh_io.h"
+
+
+static void add_fan(MeshData& mesh, const std::vector<int>& face) {
+    for (size_t i = 2; i < face.size(); ++i) {
+        mesh.triVerts.push_back(face[0]);
+        mesh.triVerts.push_back(face[i - 1]);
+        mesh.triVerts.push_back(face[i]);
+    }
+}
+
+bool load_obj(const std::string& path, MeshData& mesh, std::string& err) {
+    std::ifstream in(path);
+    if (!in) {
+        err = "Could not open " + path;
+        return false;
+    }
+    mesh = MeshData();
+
+    std::string line;
+    std::vector<int> face;
+    // The first normal any face gives each point.  They're only kept if every point got one
+    std::vector<float> fileNormals;
+    std::vector<int> pointNormal;
+    size_t lineNum = 0;
+    while (std::getline(in, line)) {
+        ++lineNum;
+        if (line.size() < 2) continue;
+        if (line[0] == 'v' && line[1] == 'n' && line.size() > 2 && line[2] == ' ') {
+            float x = 0, y = 0, z = 0;
+            if (std::sscanf(line.c_str() + 3, "%f %f %f", &x, &y, &z) != 3) {
+                err = path + ":" + std::to_string(lineNum) + ": bad normal";
+                return false;
+            }
+            fileNormals.insert(fileNormals.end(), {x, y, z});
+        }
+        else if (line[0] == 'v' && line[1] == ' ') {
+            float x = 0, y = 0, z = 0;
+            if (std::sscanf(line.c_str() + 2, "%f %f %f", &x, &y, &z) != 3) {
+                err = path + ":" + std::to_string(lineNum) + ": bad vertex";
+                return false;
+            }
+            mesh.points.push_back(x);
+            mesh.points.push_back(y);
+            mesh.points.push_back(z);
+        }
+        else if (line[0] == 'f' && line[1] == ' ') {
+            face.clear();
+            std::istringstream ss(line.substr(2));
+            std::string tok;
+            while (ss >> tok) {
+                // Only the position index matters: v, v/vt, v//vn or v/vt/vn
+                int idx = std::atoi(tok.c_str());
+                if (idx < 0) idx = (int)mesh.numPoints() + idx;
+                else idx -= 1;
+                if (idx < 0 || (size_t)idx >= mesh.numPoints()) {
+                    err = path + ":" + std::to_string(lineNum) + ": face index out of range";
+                    return false;
+                }
+                face.push_back(idx);
+
+                auto slash = tok.find('/');
+                slash = (slash == std::string::npos) ? slash : tok.find('/', slash + 1);
+                if (slash == std::string::npos) continue;
+                int nIdx = std::atoi(tok.c_str() + slash + 1);
+                if (nIdx < 0) nIdx = (int)(fileNormals.size() / 3) + nIdx;
+                else nIdx -= 1;
+                if (nIdx < 0 || (size_t)nIdx >= fileNormals.size() / 3) continue;
+                pointNormal.resize(mesh.numPoints(), -1);
+                if (pointNormal[idx] < 0) pointNormal[idx] = nIdx;
+            }
+            add_fan(mesh, face);
+        }
+    }
+
+    bool allNormals = !pointNormal.empty() && pointNormal.size() == mesh.numPoints() &&
+        std::none_of(pointNormal.begin(), pointNormal.end(), [](int n) { return n < 0; });
+    if (allNormals) {
+        mesh.normals.resize(mesh.points.size());
+        for (size_t i = 0; i < pointNormal.size(); ++i) {
+            std::copy(&fileNormals[3 * pointNormal[i]], &fileNormals[3 * pointNormal[i] + 3], &mesh.normals[3 * i]);
+        }
+    }
+    return true;
+}
+
+
+namespace {
+
+constexpr char kCpmMagic[8] = {'C', 'P', 'O', 'M', 'M', 'E', 'S', 'H'};
+constexpr uint32_t kCpmVersion = 1;
+constexpr uint32_t kCpmHasNormals = 1;
+
+struct CpmHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint64_t numPoints;
+    uint64_t numTris;
+};
+static_assert(sizeof(CpmHeader) == 32);
+
+}
+
+
+bool load_cpm(const std::string& path, MeshData& mesh, std::string& err) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        err = "Could not open " + path;
+        return false;
+    }
+    mesh = MeshData();
+
+    CpmHeader header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || std::memcmp(header.magic, kCpmMagic, sizeof(kCpmMagic)) != 0) {
+        err = path + " is not a cpm file";
+        return false;
+    }
+    if (header.version != kCpmVersion) {
+        err = path + ": unsupported cpm version " + std::to_string(header.version);
+        return false;
+    }
+    // Anything bigger than an int can index is surely a bad header
+    if (header.numPoints > (uint64_t)std::numeric_limits<int>::max() || header.numTris > (uint64_t)std::numeric_limits<int>::max()) {
+        err = path + ": bad cpm header";
+        return false;
+    }
+
+    mesh.points.resize(3 * header.numPoints);
+    mesh.triVerts.resize(3 * header.numTris);
+    in.read(reinterpret_cast<char*>(mesh.points.data()), mesh.points.size() * sizeof(float));
+    in.read(reinterpret_cast<char*>(mesh.triVerts.data()), mesh.triVerts.size() * sizeof(int));
+    if (header.flags & kCpmHasNormals) {
+        mesh.normals.resize(mesh.points.size());
+        in.read(reinterpret_cast<char*>(mesh.normals.data()), mesh.normals.size() * sizeof(float));
+    }
+    if (!in) {
+        err = path + ": unexpected end of file";
+        return false;
+    }
+    for (int v : mesh.triVerts) {
+        if (v < 0 || (size_t)v >= mesh.numPoints()) {
+            err = path + ": face index out of range";
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool write_cpm(const std::string& path, const MeshData& mesh, std::string& err) {
+    CpmHeader header = {};
+    std::memcpy(header.magic, kCpmMagic, sizeof(kCpmMagic));
+    header.version = kCpmVersion;
+    header.flags = mesh.normals.empty() ? 0 : kCpmHasNormals;
+    header.numPoints = mesh.numPoints();
+    header.numTris = mesh.numTris();
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.write(reinterpret_cast<const char*>(mesh.points.data()), mesh.points.size() * sizeof(float));
+    out.write(reinterpret_cast<const char*>(mesh.triVerts.data()), mesh.triVerts.size() * sizeof(int));
+    out.write(reinterpret_cast<const char*>(mesh.normals.data()), mesh.normals.size() * sizeof(float));
+    if (!out) {
+        err = "Could not write " + path;
+        return false;
+    }
+    return true;
+}
+
+
+namespace {
+
+struct PlyProperty {
+    std::string name;
+    std::string type;
+    std::string countType;  // Only set for list properties
+};
+
+struct PlyElement {
+    std::string name;
+    size_t count = 0;
+    std::vector<PlyProperty> props;
+};
+
+size_t ply_type_size(const std::string& t) {
+    if (t == "char" || t == "uchar" || t == "int8" || t == "uint8") return 1;
+    if (t == "short" || t == "ushort" || t == "int16" || t == "uint16") return 2;
+    if (t == "int" || t == "uint" || t == "float" || t == "int32" || t == "uint32" || t == "float32") return 4;
+    if (t == "double" || t == "float64") return 8;
+    return 0;
+}
+
+double ply_read_binary(const unsigned char* p, const std::string& t, bool swap) {
+    unsigned char buf[8];
+    size_t size = ply_type_size(t);
+    std::memcpy(buf, p, size);
+    if (swap) std::reverse(buf, buf + size);
+
+    if (t == "char" || t == "int8") { int8_t v; std::memcpy(&v, buf, 1); return v; }
+    if (t == "uchar" || t == "uint8") { uint8_t v; std::memcpy(&v, buf, 1); return v; }
+    if (t == "short" || t == "int16") { int16_t v; std::memcpy(&v, buf, 2); return v; }
+    if (t == "ushort" || t == "uint16") { uint16_t v; std::memcpy(&v, buf, 2); return v; }
+    if (t == "int" || t == "int32") { int32_t v; std::memcpy(&v, buf, 4); return v; }
+    if (t == "uint" || t == "uint32") { uint32_t v; std::memcpy(&v, buf, 4); return v; }
+    if (t == "float" || t == "float32") { float v; std::memcpy(&v, buf, 4); return v; }
+    double v; std::memcpy(&v, buf, 8); return v;
+}
+
+bool is_little_endian() {
+    uint16_t v = 1;
+    unsigned char c;
+    std::memcpy(&c, &v, 1);
+    return c == 1;
+}
+
+}
+
+
+bool load_ply(const std::string& path, MeshData& mesh, std::string& err) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        err = "Could not open " + path;
+        return false;
+    }
+    mesh = MeshData();
+
+    std::string line;
+    std::getline(in, line);
+    if (line.rfind("ply", 0) != 0) {
+        err = path + " is not a ply file";
+        return false;
+    }
+
+    std::string format;
+    std::vector<PlyElement> elements;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line.back() == '\r') line.pop_back();
+        std::istringstream ss(line);
+        std::string key;
+        ss >> key;
+        if (key == "format") {
+            ss >> format;
+        }
+        else if (key == "element") {
+            PlyElement el;
+            ss >> el.name >> el.count;
+            elements.push_back(el);
+        }
+        else if (key == "property" && !elements.empty()) {
+            PlyProperty prop;
+            ss >> prop.type;
+            if (prop.type == "list") {
+                ss >> prop.countType >> prop.type;
+            }
+            ss >> prop.name;
+            elements.back().props.push_back(prop);
+        }
+        else if (key == "end_header") {
+            break;
+        }
+    }
+
+    bool ascii = format == "ascii";
+    bool swap = false;
+    if (format == "binary_little_endian") swap = !is_little_endian();
+    else if (format == "binary_big_endian") swap = is_little_endian();
+    else if (!ascii) {
+        err = path + ": unsupported ply format '" + format + "'";
+        return false;
+    }
+
+    std::vector<int> face;
+    std::vector<double> values;
+    std::vector<unsigned char> buf(8);
+    for (const auto& el : elements) {
+        for (size_t e = 0; e < el.count; ++e) {
+            // Read every property of this element, flattening the lists into values
+            values.clear();
+            size_t listStart = 0, listCount = 0;
+            std::istringstream ss;
+            if (ascii) {
+                if (!std::getline(in, line)) {
+                    err = path + ": unexpected end of file";
+                    return false;
+                }
+                ss.str(line);
+            }
+            auto read_one = [&] (const std::string& type) -> double {
+                if (ascii) {
+                    double v = 0;
+                    ss >> v;
+                    return v;
+                }
+                in.read((char*)buf.data(), ply_type_size(type));
+                return ply_read_binary(buf.data(), type, swap);
+            };
+            for (const auto& prop : el.props) {
+                if (prop.countType.empty()) {
+                    values.push_back(read_one(prop.type));
+                    continue;
+                }
+                size_t count = (size_t)read_one(prop.countType);
+                if (prop.name == "vertex_indices" || prop.name == "vertex_index") {
+                    listStart = values.size();
+                    listCount = count;
+                }
+                for (size_t i = 0; i < count; ++i) {
+                    values.push_back(read_one(prop.type));
+                }
+            }
+            if (!in) {
+                err = path + ": unexpected end of file";
+                return false;
+            }
+
+            if (el.name == "vertex") {
+                // x y z are assumed to be the first three properties
+                if (values.size() < 3) {
+                    err = path + ": vertex element needs x y z";
+                    return false;
+                }
+                mesh.points.push_back((float)values[0]);
+                mesh.points.push_back((float)values[1]);
+                mesh.points.push_back((float)values[2]);
+            }
+            else if (el.name == "face") {
+                face.clear();
+                for (size_t i = 0; i < listCount; ++i) {
+                    int idx = (int)values[listStart + i];
+                    if (idx < 0 || (size_t)idx >= mesh.numPoints()) {
+                        err = path + ": face index out of range";
+                        return false;
+                    }
+                    face.push_back(idx);
+                }
+                add_fan(mesh, face);
+            }
+        }
+    }
+    return true;
+}
+
+
+bool load_mesh(const std::string& path, MeshData& mesh, std::string& err) {
+    auto dot = path.find_last_of('.');
+    std::string ext = (dot == std::string::npos) ? "" : path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(), [] (unsigned char c) { return (char)std::tolower(c); });
+
+    if (ext == "obj") return load_obj(path, mesh, err);
+    if (ext == "ply") return load_ply(path, mesh, err);
+    if (ext == "cpm") return load_cpm(path, mesh, err);
+    err = "Unknown mesh extension: " + path;
+    return false;
+}
+
+
+// A grid of rows x cols quads.  The columns always wrap around, and the
+// rows also wrap when wrapRows is set.  pointAt gives the xyz of each (row, col)
+template <typename Func>
+static MeshData make_wrapped_grid(size_t rows, size_t cols, bool wrapRows, Func&& pointAt) {
+    MeshData mesh;
+    size_t pointRows = wrapRows ? rows : rows + 1;
+    mesh.points.reserve(pointRows * cols * 3);
+    for (size_t r = 0; r < pointRows; ++r) {
+        for (size_t c = 0; c < cols; ++c) {
+            auto [x, y, z] = pointAt(r, c);
+            mesh.points.push_back(x);
+            mesh.points.push_back(y);
+            mesh.points.push_back(z);
+        }
+    }
+
+    mesh.triVerts.reserve(rows * cols * 6);
+    for (size_t r = 0; r < rows; ++r) {
+        size_t r1 = (r + 1) % pointRows;
+        for (size_t c = 0; c < cols; ++c) {
+            size_t c1 = (c + 1) % cols;
+            int a = (int)(r * cols + c);
+            int b = (int)(r * cols + c1);
+            int d = (int)(r1 * cols + c);
+            int e = (int)(r1 * cols + c1);
+            mesh.triVerts.insert(mesh.triVerts.end(), {a, d, b, b, d, e});
+        }
+    }
+    return mesh;
+}
+
+MeshData make_sphere(size_t targetTris, float radius) {
+    // A UV sphere with twice as many columns as rows is close to square quads
+    size_t rows = std::max<size_t>(2, (size_t)std::sqrt((double)targetTris / 4.0));
+    size_t cols = rows * 2;
+    const double pi = std::numbers::pi;
+
+    // The poles are made of rings of coincident points.  Those degenerate triangles
+    // are left in on purpose since real production meshes have them too
+    return make_wrapped_grid(rows, cols, false, [&] (size_t r, size_t c) {
+        double theta = pi * (double)r / (double)rows;
+        double phi = 2.0 * pi * (double)c / (double)cols;
+        return std::make_tuple(
+            (float)(radius * std::sin(theta) * std::cos(phi)),
+            (float)(radius * std::cos(theta)),
+            (float)(radius * std::sin(theta) * std::sin(phi))
+        );
+    });
+}
+
+MeshData make_torus(size_t targetTris, float majorRadius, float minorRadius) {
+    size_t rows = std::max<size_t>(3, (size_t)std::sqrt((double)targetTris / 6.0));
+    size_t cols = rows * 3;
+    const double pi = std::numbers::pi;
+
+    return make_wrapped_grid(cols, rows, true, [&] (size_t r, size_t c) {
+        double u = 2.0 * pi * (double)r / (double)cols;
+        double v = 2.0 * pi * (double)c / (double)rows;
+        double ring = majorRadius + minorRadius * std::cos(v);
+        return std::make_tuple(
+            (float)(ring * std::cos(u)),
+            (float)(minorRadius * std::sin(v)),
+            (float)(ring * std::sin(u))
+        );
+    });
+}
@@ -0,0 +1,40 @@
+#ifndef MESH_IO_H
+#define MESH_IO_H
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+// A triangulated mesh in the same layout Maya hands the plugin:
+// packed xyz floats, and 3 point indices per triangle.  The per point
+// normals are only filled in when the file had them
+struct MeshData {
+    std::vector<float> points;
+    std::vector<int> triVerts;
+    std::vector<float> normals;
+
+    size_t numPoints() const { return points.size() / 3; }
+    size_t numTris() const { return triVerts.size() / 3; }
+};
+
+// Polygons with more than 3 sides are fan triangulated
+// On failure these return false and fill in err
+bool load_obj(const std::string& path, MeshData& mesh, std::string& err);
+bool load_ply(const std::string& path, MeshData& mesh, std::string& err);
+
+// The binary .cpm mesh: an 8 byte "CPOMMESH" magic, a uint32 version and
+// flags (1 if normals follow), uint64 point and triangle counts, then the
+// points, the triangle corners as int32, and the normals if there are any.
+// All little endian.  It holds exactly what the node reads off a Maya mesh,
+// so a binding made from one keys the same as the node's own
+bool load_cpm(const std::string& path, MeshData& mesh, std::string& err);
+bool write_cpm(const std::string& path, const MeshData& mesh, std::string& err);
+
+// Picks the loader from the file extension
+bool load_mesh(const std::string& path, MeshData& mesh, std::string& err);
+
+// Procedural meshes with roughly the requested number of triangles
+MeshData make_sphere(size_t targetTris, float radius = 1.0f);
+MeshData make_torus(size_t targetTris, float majorRadius = 1.0f, float minorRadius = 0.35f);
+
+#endif